@@ -0,0 +1,429 @@
+/* mul_fft -- radix 2 fft routines for MPIR.
+
+Copyright 2009, 2011 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of William Hart.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpir.h"
+#include "gmp-impl.h"
+#include "mul_fft.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && GMP_LIMB_BITS == 64
+#define FFT_X86_64 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define FFT_X86_64 0
+#endif
+
+/*
+   Each kernel in this file is compiled for the instruction set it is 
+   written for with a target attribute, so that the file itself can be
+   compiled for the baseline of the architecture and one binary can be 
+   run on all hosts. The carry propagating arithmetic the kernels call 
+   (mpn_sumdiff_n, mpn_add_n, etc.) is already dispatched by a fat build
+   of MPIR. What we dispatch here is the code around those calls, and the
+   shifts and negations, which have no carries between limbs and so 
+   vectorise.
+*/
+
+#if FFT_X86_64
+
+/*
+   As per mpn_addlsh_generic, but shifting and adding in one pass 
+   with shlx/shrx and a single carry chain, rather than writing the 
+   shifted value to temp and reading it back.
+*/
+__attribute__((target("bmi2,adx")))
+static void mpn_addlsh_bmi2_adx(mp_limb_t * r, mp_limb_t * a, mp_size_t n, 
+                                    mp_bitcnt_t s, mp_limb_t * temp)
+{
+   unsigned long long sum;
+   unsigned char c = 0;
+   mp_limb_t hi = 0, x;
+   mp_size_t i;
+
+   for (i = 0; i < n; i++)
+   {
+      x = (a[i] << s) | hi;
+      hi = a[i] >> (GMP_LIMB_BITS - s);
+      c = _addcarryx_u64(c, r[i], x, &sum);
+      r[i] = sum;
+   }
+}
+
+/*
+   Vectorised shifts and negation for AVX2 (4 limbs) and AVX-512 (8 limbs
+   per vector). Each output limb of a shift by 0 < d < GMP_LIMB_BITS bits
+   combines two neighbouring input limbs, so the second is read with an 
+   unaligned load one limb along rather than shuffled into place. The 
+   left shift runs from the top down and the right shift from the bottom 
+   up, so that, like mpn_lshift and mpn_rshift, either may be done in 
+   place. The mod 2^nw + 1 fixups of the top limb are the same as in the
+   generic kernels.
+*/
+
+__attribute__((target("avx2")))
+static mp_limb_t FFT_lshift_avx2(mp_limb_t * t, mp_limb_t * a, mp_size_t n, mp_bitcnt_t d)
+{
+   __m128i cl = _mm_cvtsi32_si128(d);
+   __m128i cr = _mm_cvtsi32_si128(GMP_LIMB_BITS - d);
+   __m256i x, y;
+   mp_limb_t ret = a[n - 1] >> (GMP_LIMB_BITS - d);
+   mp_size_t i;
+
+   for (i = n - 4; i >= 1; i -= 4)
+   {
+      x = _mm256_loadu_si256((const __m256i *) (a + i));
+      y = _mm256_loadu_si256((const __m256i *) (a + i - 1));
+      x = _mm256_or_si256(_mm256_sll_epi64(x, cl), _mm256_srl_epi64(y, cr));
+      _mm256_storeu_si256((__m256i *) (t + i), x);
+   }
+
+   for (i += 3; i >= 1; i--)
+      t[i] = (a[i] << d) | (a[i - 1] >> (GMP_LIMB_BITS - d));
+   t[0] = a[0] << d;
+
+   return ret;
+}
+
+__attribute__((target("avx2")))
+static mp_limb_t FFT_rshift_avx2(mp_limb_t * t, mp_limb_t * a, mp_size_t n, mp_bitcnt_t d)
+{
+   __m128i cr = _mm_cvtsi32_si128(d);
+   __m128i cl = _mm_cvtsi32_si128(GMP_LIMB_BITS - d);
+   __m256i x, y;
+   mp_limb_t ret = a[0] << (GMP_LIMB_BITS - d);
+   mp_size_t i;
+
+   for (i = 0; i + 4 < n; i += 4)
+   {
+      x = _mm256_loadu_si256((const __m256i *) (a + i));
+      y = _mm256_loadu_si256((const __m256i *) (a + i + 1));
+      x = _mm256_or_si256(_mm256_srl_epi64(x, cr), _mm256_sll_epi64(y, cl));
+      _mm256_storeu_si256((__m256i *) (t + i), x);
+   }
+
+   for ( ; i < n - 1; i++)
+      t[i] = (a[i] >> d) | (a[i + 1] << (GMP_LIMB_BITS - d));
+   t[n - 1] = a[n - 1] >> d;
+
+   return ret;
+}
+
+/*
+   -s = ~s + 1, and the carry of the + 1 stops at the first nonzero limb.
+*/
+__attribute__((target("avx2")))
+static mp_limb_t mpn_neg_n_avx2(mp_limb_t * r, mp_limb_t * s, mp_size_t n)
+{
+   __m256i ones = _mm256_set1_epi64x(-1);
+   mp_size_t i;
+
+   for (i = 0; i < n && s[i] == 0; i++)
+      r[i] = 0;
+   if (i == n)
+      return 0;
+
+   r[i] = -s[i];
+   for (i++; i + 4 <= n; i += 4)
+      _mm256_storeu_si256((__m256i *) (r + i), 
+         _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (s + i)), ones));
+   for ( ; i < n; i++)
+      r[i] = ~s[i];
+
+   return 1;
+}
+
+__attribute__((target("avx512f")))
+static mp_limb_t FFT_lshift_avx512(mp_limb_t * t, mp_limb_t * a, mp_size_t n, mp_bitcnt_t d)
+{
+   __m128i cl = _mm_cvtsi32_si128(d);
+   __m128i cr = _mm_cvtsi32_si128(GMP_LIMB_BITS - d);
+   __m512i x, y;
+   mp_limb_t ret = a[n - 1] >> (GMP_LIMB_BITS - d);
+   mp_size_t i;
+
+   for (i = n - 8; i >= 1; i -= 8)
+   {
+      x = _mm512_loadu_si512((const void *) (a + i));
+      y = _mm512_loadu_si512((const void *) (a + i - 1));
+      x = _mm512_or_si512(_mm512_sll_epi64(x, cl), _mm512_srl_epi64(y, cr));
+      _mm512_storeu_si512((void *) (t + i), x);
+   }
+
+   for (i += 7; i >= 1; i--)
+      t[i] = (a[i] << d) | (a[i - 1] >> (GMP_LIMB_BITS - d));
+   t[0] = a[0] << d;
+
+   return ret;
+}
+
+__attribute__((target("avx512f")))
+static mp_limb_t FFT_rshift_avx512(mp_limb_t * t, mp_limb_t * a, mp_size_t n, mp_bitcnt_t d)
+{
+   __m128i cr = _mm_cvtsi32_si128(d);
+   __m128i cl = _mm_cvtsi32_si128(GMP_LIMB_BITS - d);
+   __m512i x, y;
+   mp_limb_t ret = a[0] << (GMP_LIMB_BITS - d);
+   mp_size_t i;
+
+   for (i = 0; i + 8 < n; i += 8)
+   {
+      x = _mm512_loadu_si512((const void *) (a + i));
+      y = _mm512_loadu_si512((const void *) (a + i + 1));
+      x = _mm512_or_si512(_mm512_srl_epi64(x, cr), _mm512_sll_epi64(y, cl));
+      _mm512_storeu_si512((void *) (t + i), x);
+   }
+
+   for ( ; i < n - 1; i++)
+      t[i] = (a[i] >> d) | (a[i + 1] << (GMP_LIMB_BITS - d));
+   t[n - 1] = a[n - 1] >> d;
+
+   return ret;
+}
+
+__attribute__((target("avx512f")))
+static mp_limb_t mpn_neg_n_avx512(mp_limb_t * r, mp_limb_t * s, mp_size_t n)
+{
+   __m512i ones = _mm512_set1_epi64(-1);
+   mp_size_t i;
+
+   for (i = 0; i < n && s[i] == 0; i++)
+      r[i] = 0;
+   if (i == n)
+      return 0;
+
+   r[i] = -s[i];
+   for (i++; i + 8 <= n; i += 8)
+      _mm512_storeu_si512((void *) (r + i), 
+         _mm512_xor_si512(_mm512_loadu_si512((const void *) (s + i)), ones));
+   for ( ; i < n; i++)
+      r[i] = ~s[i];
+
+   return 1;
+}
+
+/*
+   The mod 2^nw + 1 shifts, as per mpn_mul_2expmod_2expp1_generic and 
+   mpn_div_2expmod_2expp1_generic, around the given limb shift.
+*/
+#define FFT_MUL_2EXPMOD(lshift) \
+   do { \
+      mp_limb_signed_t hi, hi2; \
+      if (d == 0) \
+      { \
+         if (t != i1) \
+            MPN_COPY(t, i1, limbs + 1); \
+      } else \
+      { \
+         hi = i1[limbs]; \
+         lshift(t, i1, limbs + 1, d); \
+         hi2 = t[limbs]; \
+         t[limbs] = CNST_LIMB(0); \
+         mpn_sub_1(t, t, limbs + 1, hi2); \
+         hi >>= (GMP_LIMB_BITS - d); \
+         mpn_addmod_2expp1_1(t + 1, limbs - 1, -hi); \
+      } \
+   } while (0)
+
+#define FFT_DIV_2EXPMOD(rshift) \
+   do { \
+      mp_limb_t lo; \
+      mp_limb_t * ptr; \
+      mp_limb_signed_t hi; \
+      if (d == 0) \
+      { \
+         if (t != i1) \
+            MPN_COPY(t, i1, limbs + 1); \
+      } else \
+      { \
+         hi = i1[limbs]; \
+         lo = rshift(t, i1, limbs + 1, d); \
+         t[limbs] = (hi>>d); \
+         ptr = t + limbs - 1; \
+         sub_ddmmss(ptr[1], ptr[0], ptr[1], ptr[0], CNST_LIMB(0), lo); \
+      } \
+   } while (0)
+
+__attribute__((target("avx2")))
+static void mpn_mul_2expmod_2expp1_avx2(mp_limb_t * t, mp_limb_t * i1, 
+                                           mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_MUL_2EXPMOD(FFT_lshift_avx2);
+}
+
+__attribute__((target("avx2")))
+static void mpn_div_2expmod_2expp1_avx2(mp_limb_t * t, mp_limb_t * i1, 
+                                           mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_DIV_2EXPMOD(FFT_rshift_avx2);
+}
+
+__attribute__((target("avx512f")))
+static void mpn_mul_2expmod_2expp1_avx512(mp_limb_t * t, mp_limb_t * i1, 
+                                           mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_MUL_2EXPMOD(FFT_lshift_avx512);
+}
+
+__attribute__((target("avx512f")))
+static void mpn_div_2expmod_2expp1_avx512(mp_limb_t * t, mp_limb_t * i1, 
+                                           mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_DIV_2EXPMOD(FFT_rshift_avx512);
+}
+
+/*
+   Returns the FFT_CPU_* features of the CPU, as reported by cpuid and,
+   for the vector extensions, enabled by the OS (xgetbv).
+*/
+static unsigned int FFT_cpuid_features(void)
+{
+   unsigned int a, b, c, d, xcr0 = 0, f = 0;
+
+   if (__get_cpuid_max(0, NULL) < 7)
+      return 0;
+
+   __cpuid(1, a, b, c, d);
+   if (c & bit_OSXSAVE)
+      __asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+
+   __cpuid_count(7, 0, a, b, c, d);
+   if ((b & bit_BMI2) && (b & bit_ADX))
+      f |= FFT_CPU_BMI2_ADX;
+   if ((b & bit_AVX2) && (xcr0 & 0x06) == 0x06) /* XMM and YMM state */
+      f |= FFT_CPU_AVX2;
+   if ((b & bit_AVX512F) && (b & bit_AVX512BW) && (xcr0 & 0xe6) == 0xe6) /* and ZMM */
+      f |= FFT_CPU_AVX512;
+
+   return f;
+}
+
+#else
+
+static unsigned int FFT_cpuid_features(void)
+{
+   return 0;
+}
+
+#endif
+
+/*
+   The implementations, from the most to the least specialised. An entry
+   is usable if the CPU has all its features, and each NULL kernel is 
+   taken from the next usable entry down. The last entry is the generic C
+   code, which is always usable.
+*/
+static const fft_kernels_t fft_kernels_table[] = 
+{
+#if FFT_X86_64
+   { "avx512", FFT_CPU_AVX512, NULL, NULL, NULL, mpn_mul_2expmod_2expp1_avx512,
+      mpn_div_2expmod_2expp1_avx512, mpn_neg_n_avx512, NULL },
+   { "avx2", FFT_CPU_AVX2, NULL, NULL, NULL, mpn_mul_2expmod_2expp1_avx2,
+      mpn_div_2expmod_2expp1_avx2, mpn_neg_n_avx2, NULL },
+   { "bmi2_adx", FFT_CPU_BMI2_ADX, NULL, NULL, NULL, NULL, NULL, NULL, 
+      mpn_addlsh_bmi2_adx },
+#endif
+   { "generic", 0, mpn_normmod_2expp1_generic, mpn_lshB_sumdiffmod_2expp1_generic,
+      mpn_sumdiff_rshBmod_2expp1_generic, mpn_mul_2expmod_2expp1_generic, 
+      mpn_div_2expmod_2expp1_generic, mpn_neg_n_generic, mpn_addlsh_generic }
+};
+
+#define FFT_KERNEL_IMPLS (sizeof(fft_kernels_table)/sizeof(fft_kernels_t))
+
+fft_kernels_t fft_kernels = 
+{
+   "generic", 0, mpn_normmod_2expp1_generic, mpn_lshB_sumdiffmod_2expp1_generic,
+      mpn_sumdiff_rshBmod_2expp1_generic, mpn_mul_2expmod_2expp1_generic, 
+      mpn_div_2expmod_2expp1_generic, mpn_neg_n_generic, mpn_addlsh_generic
+};
+
+static unsigned int fft_cpu_detected = 0;
+static int fft_cpu_probed = 0;
+
+unsigned int fft_cpu_features(void)
+{
+   if (!fft_cpu_probed)
+   {
+      fft_cpu_detected = FFT_cpuid_features();
+      fft_cpu_probed = 1;
+   }
+
+   return fft_cpu_detected;
+}
+
+unsigned int fft_cpu_select(unsigned int features)
+{
+   const fft_kernels_t * k;
+   fft_kernels_t sel;
+   size_t i;
+
+   features &= fft_cpu_features();
+
+   memset(&sel, 0, sizeof(fft_kernels_t));
+   sel.features = features;
+
+   for (i = 0; i < FFT_KERNEL_IMPLS; i++)
+   {
+      k = fft_kernels_table + i;
+      if ((k->features & features) != k->features)
+         continue;
+
+      if (sel.name == NULL) /* the best usable entry names the selection */
+         sel.name = k->name;
+
+      if (sel.normmod == NULL) sel.normmod = k->normmod;
+      if (sel.lshB_sumdiffmod == NULL) sel.lshB_sumdiffmod = k->lshB_sumdiffmod;
+      if (sel.sumdiff_rshBmod == NULL) sel.sumdiff_rshBmod = k->sumdiff_rshBmod;
+      if (sel.mul_2expmod == NULL) sel.mul_2expmod = k->mul_2expmod;
+      if (sel.div_2expmod == NULL) sel.div_2expmod = k->div_2expmod;
+      if (sel.neg_n == NULL) sel.neg_n = k->neg_n;
+      if (sel.addlsh == NULL) sel.addlsh = k->addlsh;
+   }
+
+   fft_kernels = sel;
+
+   return sel.features;
+}
+
+const char * fft_cpu_name(void)
+{
+   return fft_kernels.name;
+}
+
+/*
+   Select the best kernels when the library is loaded.
+*/
+__attribute__((constructor))
+static void FFT_cpu_init(void)
+{
+   fft_cpu_select(~0U);
+}
@@ -0,0 +1,292 @@
+/* mul_fft -- radix 2 fft routines for MPIR.
+
+Copyright 2009, 2011 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of William Hart.
+
+*/
+
+#ifndef MPIRFFT_H
+#define MPIRFFT_H
+
+#include "mpir.h"
+
+/*
+   Phases of a multiplication, for which new_mpn_mul6 and the truncated 
+   sqrt2 MFA transforms record timings in fft_phase_stats when built 
+   with FFT_PHASE_STATS defined. new_mpn_mul6 scales the coefficients as
+   it combines them, so its scaling is timed as part of the combine.
+*/
+typedef enum
+{
+   FFT_PHASE_SPLIT,
+   FFT_PHASE_FFT_COLUMNS,
+   FFT_PHASE_FFT_ROWS,
+   FFT_PHASE_POINTWISE,
+   FFT_PHASE_IFFT_ROWS,
+   FFT_PHASE_IFFT_COLUMNS,
+   FFT_PHASE_SCALE,
+   FFT_PHASE_COMBINE,
+   FFT_PHASES
+} fft_phase_t;
+
+/*
+   Hardware events counted in each phase when built with FFT_PERF_EVENTS
+   defined. Events the kernel will not count for us read as zero.
+*/
+typedef enum
+{
+   FFT_EVENT_CYCLES,
+   FFT_EVENT_INSTRUCTIONS,
+   FFT_EVENT_L1D_MISSES,
+   FFT_EVENT_LLC_MISSES,
+   FFT_EVENT_DTLB_MISSES,
+   FFT_EVENTS
+} fft_event_t;
+
+typedef struct
+{
+   unsigned long long cycles[FFT_PHASES]; /* cycles (or ns) spent in each phase */
+   unsigned long calls[FFT_PHASES]; /* number of times each phase was entered */
+   unsigned long long events[FFT_PHASES][FFT_EVENTS]; /* hardware event counts */
+} fft_phase_stats_t;
+
+extern fft_phase_stats_t fft_phase_stats;
+
+extern const char * fft_phase_names[FFT_PHASES];
+
+extern const char * fft_event_names[FFT_EVENTS];
+
+void fft_phase_stats_reset(void);
+
+int fft_event_available(fft_event_t e);
+
+/*
+   Kernels whose calls are counted in fft_op_counts when built with 
+   FFT_OP_COUNTS defined. Along with the number of calls, the limbs of 
+   coefficient data each call reads and writes are totalled.
+*/
+typedef enum
+{
+   FFT_OP_BUTTERFLY,
+   FFT_OP_BUTTERFLY_SQRT2,
+   FFT_OP_INVERSE_BUTTERFLY,
+   FFT_OP_INVERSE_BUTTERFLY_SQRT2,
+   FFT_OP_TWIDDLE,
+   FFT_OP_TWIDDLE_SQRT2,
+   FFT_OP_MUL_2EXP,
+   FFT_OP_DIV_2EXP,
+   FFT_OP_NORMMOD,
+   FFT_OP_POINTWISE,
+   FFT_OPS
+} fft_op_t;
+
+typedef struct
+{
+   unsigned long long count[FFT_OPS]; /* number of calls */
+   unsigned long long limbs[FFT_OPS]; /* limbs read and written */
+} fft_op_counts_t;
+
+extern fft_op_counts_t fft_op_counts;
+
+extern const char * fft_op_names[FFT_OPS];
+
+void fft_op_counts_reset(void);
+
+/*
+   Multiplication variants a plan can select.
+*/
+typedef enum
+{
+   FFT_MUL6,
+   FFT_MUL6_LOWMEM,
+   FFT_MUL6_MMAP,
+   FFT_MUL6_THREADED
+} fft_mul_variant_t;
+
+/*
+   A plan for multiplying integers of given sizes, with the cost predicted
+   by the cost model in fft_mul_estimate. The MFA has n1 columns and 
+   2^(depth+1)/n1 rows.
+*/
+typedef struct
+{
+   fft_mul_variant_t variant;
+   mp_bitcnt_t depth, w;
+   mp_size_t n1; /* columns of the MFA */
+   mp_size_t trunc; /* coefficients of the product computed */
+   int threads; /* for FFT_MUL6_THREADED */
+   const char * dir; /* for FFT_MUL6_MMAP, from FFT_MMAP_DIR */
+   double butterflies; /* predicted butterflies (all transforms) */
+   double pointwise; /* predicted pointwise multiplications */
+   double cycles; /* predicted time in cycles */
+   size_t memory; /* predicted peak bytes of RAM */
+   size_t disk; /* bytes of disk, for FFT_MUL6_MMAP */
+} fft_mul_plan_t;
+
+extern const char * fft_mul_variant_names[];
+
+mp_size_t fft_mul_plans(fft_mul_plan_t * plans, mp_size_t max, mp_size_t an, mp_size_t bn);
+
+int fft_mul_estimate(mp_size_t an, mp_size_t bn, fft_mul_plan_t * plan);
+
+void fft_mul_plan_run(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                 mp_limb_t * i2, mp_size_t n2, const fft_mul_plan_t * plan);
+
+/*
+   Instruction set extensions the kernels can be dispatched on. The best
+   kernels the CPU supports are selected when the library is loaded.
+   fft_cpu_select restricts the choice to the given features (and those
+   detected) and returns the features in use; it must not be called while
+   a multiplication is running.
+*/
+#define FFT_CPU_BMI2_ADX 1
+#define FFT_CPU_AVX2 2
+#define FFT_CPU_AVX512 4
+
+unsigned int fft_cpu_features(void);
+
+unsigned int fft_cpu_select(unsigned int features);
+
+const char * fft_cpu_name(void);
+
+/*
+   Multiplication of {i1, n1} by {i2, n2}, n1 >= n2, writing the n1 + n2
+   limbs of the product to r1, which must not overlap the inputs. The 
+   _auto functions choose the transform parameters themselves, falling 
+   back to mpn_mul for small integers.
+*/
+void new_mpn_mul_auto(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                    mp_limb_t * i2, mp_size_t n2);
+
+void new_mpn_sqr_auto(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1);
+
+/*
+   Multiplication and squaring of signed integers, r may be an input.
+*/
+void mpz_mul_fft(mpz_ptr r, mpz_srcptr a, mpz_srcptr b);
+
+void mpz_sqr_fft(mpz_ptr r, mpz_srcptr a);
+
+/*
+   Products modulo B^k + 1 and B^k - 1, B = 2^GMP_LIMB_BITS, of operands 
+   of any length, for any k, by a wrapped convolution at about half the 
+   cost of the full product. They are fastest for 
+   k = mpn_mulmod_Bexp_fft_next_size(k), otherwise they may fall back to 
+   the full product. The result has k + 1 and k limbs respectively.
+*/
+void mpn_mulmod_Bexpp1_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                           mp_limb_t * i2, mp_size_t n2, mp_size_t k);
+
+void mpn_mulmod_Bexpm1_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                           mp_limb_t * i2, mp_size_t n2, mp_size_t k);
+
+mp_size_t mpn_mulmod_Bexp_fft_next_size(mp_size_t k);
+
+/*
+   Limbs n2 to n1 of {i1, n1}*{i2, n2}, n1 >= n2, computed with a 
+   transform of length about n1 instead of n1 + n2.
+*/
+void mpn_mulmid_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                                   mp_limb_t * i2, mp_size_t n2);
+
+int FFT_mul6_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, mp_size_t n1, mp_size_t n2);
+
+void new_mpn_mul6(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w);
+
+mp_size_t new_mpn_mul6_workspace(mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul6_ws(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w, mp_limb_t * ws);
+
+void new_mpn_mul6_lowmem(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                  mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul6_mmap(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, 
+                 const char * dir);
+
+void new_mpn_mul6_threaded(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1,
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, int threads);
+
+/*
+   Multiplication of {i1, n1} by a much shorter {i2, n2}: i2 is transformed
+   once and i1 multiplied by it in chunks.
+*/
+void new_mpn_mul_unbalanced(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                          mp_limb_t * i2, mp_size_t n2);
+
+/*
+   An integer transformed once to be multiplied by many others of at most 
+   m limbs, see fft_mul_precomp_init.
+*/
+typedef struct
+{
+   mp_limb_t * i2;
+   mp_size_t n2, m;
+   mp_bitcnt_t depth, w;
+   mp_size_t j2, trunc;
+   mp_limb_t ** ii, ** jj;
+   mp_limb_t * t1, * t2, * s1, * tt;
+   mp_limb_t * ws;
+   mp_size_t ws_limbs;
+} fft_mul_precomp_t;
+
+void fft_mul_precomp_init(fft_mul_precomp_t * pre, mp_limb_t * i2, 
+                                        mp_size_t n2, mp_size_t m);
+
+void fft_mul_precomp_clear(fft_mul_precomp_t * pre);
+
+void fft_mul_precomp(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                        fft_mul_precomp_t * pre);
+
+/*
+   The product of count integers {x[i], xn[i]}, computed in a product 
+   tree, returning the limbs of the product written to r.
+*/
+mp_size_t mpn_prod_tree(mp_limb_t * r, mp_limb_t ** x, mp_size_t * xn, mp_size_t count);
+
+mp_size_t mpn_prod_tree_threaded(mp_limb_t * r, mp_limb_t ** x, mp_size_t * xn, 
+                                              mp_size_t count, int threads);
+
+/*
+   The product {r, alen + blen - 1} of polynomials over Z, with each 
+   coefficient mapped directly to transform coefficients, or by Kronecker
+   substitution if that is predicted to be faster.
+*/
+void fft_poly_mul(mpz_t * r, mpz_t * a, mp_size_t alen, mpz_t * b, mp_size_t blen);
+
+/*
+   The products {r[i], n1 + n2} = {i1[i], n1}*{i2[i], n2}, 0 <= i < count,
+   sharing one choice of parameters and, per thread, one workspace.
+*/
+void mpn_mul_fft_batch(mp_limb_t ** r, mp_limb_t ** i1, mp_size_t n1, 
+                       mp_limb_t ** i2, mp_size_t n2, mp_size_t count);
+
+void mpn_mul_fft_batch_threaded(mp_limb_t ** r, mp_limb_t ** i1, mp_size_t n1, 
+         mp_limb_t ** i2, mp_size_t n2, mp_size_t count, int threads);
+
+#endif
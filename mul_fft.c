@@ -28,19 +28,33 @@ or implied, of William Hart.
 
 */
 
-#define TEST 0
-#define TIME 1
+#if FFT_THREADS
+#define _GNU_SOURCE /* for pthread_setaffinity_np and sched_getaffinity */
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#if FFT_PERF_EVENTS
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if FFT_THREADS
+#include <pthread.h>
+#include <sched.h>
+#if HAVE_LIBNUMA
+#include <numa.h>
+#endif
+#endif
 #include "mpir.h"
 #include "gmp-impl.h"
 #include "longlong.h"
 #include "mul_fft.h"
 
-mp_limb_t new_mpn_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2, 
-                           mp_limb_t c, mp_limb_t bits, mp_limb_t * tt);
-
 /*
    NOTES: throughout the following we use the following notation:
    
@@ -49,6 +63,230 @@ mp_limb_t new_mpn_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2,
    * l = {wn}/GMP_LIMB_BITS (number of limbs)
 */
 
+/*
+   Per phase timings. The phases are timed with the time stamp counter 
+   where there is one, otherwise in nanoseconds. When FFT_PHASE_STATS is 
+   zero the macros expand to nothing, so cost nothing. The statistics are 
+   global and not updated atomically, so they are only recorded by the 
+   thread that calls a multiplication. The threads started by the threaded
+   functions (new_mpn_mul6_threaded, mpn_mul_fft_batch_threaded and the 
+   subtrees of mpn_prod_tree_threaded) record nothing and do not touch the
+   perf counters, so the statistics only cover the work done by the 
+   calling thread.
+*/
+fft_phase_stats_t fft_phase_stats;
+
+const char * fft_phase_names[FFT_PHASES] = 
+{
+   "split", "fft columns", "fft rows", "pointwise", 
+   "ifft rows", "ifft columns", "scale", "combine"
+};
+
+void fft_phase_stats_reset(void)
+{
+   memset(&fft_phase_stats, 0, sizeof(fft_phase_stats_t));
+}
+
+static inline
+unsigned long long FFT_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __builtin_ia32_rdtsc();
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+const char * fft_event_names[FFT_EVENTS] = 
+{
+   "cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses"
+};
+
+#if FFT_PERF_EVENTS
+
+/*
+   File descriptors of the counters opened by FFT_perf_open, -1 for 
+   those the kernel refused (e.g. in containers, or on virtual machines
+   without a PMU). If perf_event_open is not permitted at all, every 
+   counter is -1 and the event counts simply stay zero.
+*/
+int fft_perf_fd[FFT_EVENTS];
+int fft_perf_opened = 0;
+
+void FFT_perf_open(void)
+{
+   static const unsigned int type[FFT_EVENTS] = 
+   {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, 
+      PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE
+   };
+   static const unsigned long long config[FFT_EVENTS] = 
+   {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) 
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) 
+                             | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) 
+                               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+   };
+   struct perf_event_attr attr;
+   int e;
+
+   for (e = 0; e < FFT_EVENTS; e++)
+   {
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type[e];
+      attr.config = config[e];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      // this thread, any cpu, no group
+      fft_perf_fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+   }
+
+   fft_perf_opened = 1;
+}
+
+static inline
+void FFT_perf_read(unsigned long long * v)
+{
+   int e;
+
+   if (!fft_perf_opened) FFT_perf_open();
+
+   for (e = 0; e < FFT_EVENTS; e++)
+   {
+      if (fft_perf_fd[e] == -1 
+         || read(fft_perf_fd[e], v + e, sizeof(unsigned long long)) != sizeof(unsigned long long))
+         v[e] = 0;
+   }
+}
+
+/*
+   Adds the events counted since the counts in start were read to the 
+   counts for phase p.
+*/
+static inline
+void FFT_perf_accumulate(fft_phase_t p, unsigned long long * start)
+{
+   unsigned long long v[FFT_EVENTS];
+   int e;
+
+   FFT_perf_read(v);
+
+   for (e = 0; e < FFT_EVENTS; e++)
+      fft_phase_stats.events[p][e] += v[e] - start[e];
+}
+
+int fft_event_available(fft_event_t e)
+{
+   if (!fft_perf_opened) FFT_perf_open();
+
+   return fft_perf_fd[e] != -1;
+}
+
+#else
+
+int fft_event_available(fft_event_t e)
+{
+   return 0;
+}
+
+#endif
+
+#if FFT_PHASE_STATS && FFT_THREADS
+/*
+   Nonzero on the threads started by the threaded functions, which set it
+   with FFT_PHASE_WORKER before doing any work.
+*/
+static __thread int fft_phase_worker = 0;
+#define FFT_PHASE_RECORD (!fft_phase_worker)
+#define FFT_PHASE_WORKER do { fft_phase_worker = 1; } while (0)
+#else
+#define FFT_PHASE_RECORD 1
+#define FFT_PHASE_WORKER do { } while (0)
+#endif
+
+#if FFT_PERF_EVENTS
+#define FFT_PHASE_DECL unsigned long long __phase_start = 0, __phase_events[FFT_EVENTS]
+#define FFT_PHASE_START \
+   do { \
+      if (FFT_PHASE_RECORD) \
+      { \
+         FFT_perf_read(__phase_events); \
+         __phase_start = FFT_cycles(); \
+      } \
+   } while (0)
+#define FFT_PHASE_END(p) \
+   do { \
+      if (FFT_PHASE_RECORD) \
+      { \
+         fft_phase_stats.cycles[p] += FFT_cycles() - __phase_start; \
+         fft_phase_stats.calls[p]++; \
+         FFT_perf_accumulate(p, __phase_events); \
+      } \
+   } while (0)
+#elif FFT_PHASE_STATS
+#define FFT_PHASE_DECL unsigned long long __phase_start = 0
+#define FFT_PHASE_START \
+   do { \
+      if (FFT_PHASE_RECORD) \
+         __phase_start = FFT_cycles(); \
+   } while (0)
+#define FFT_PHASE_END(p) \
+   do { \
+      if (FFT_PHASE_RECORD) \
+      { \
+         fft_phase_stats.cycles[p] += FFT_cycles() - __phase_start; \
+         fft_phase_stats.calls[p]++; \
+      } \
+   } while (0)
+#else
+#define FFT_PHASE_DECL
+#define FFT_PHASE_START do { } while (0)
+#define FFT_PHASE_END(p) do { } while (0)
+#endif
+
+/*
+   Operation counts. When FFT_OP_COUNTS is zero FFT_COUNT_OP expands to 
+   nothing. With threads the counters are updated atomically, so they are
+   correct for the threaded multiplication too, at some cost.
+*/
+fft_op_counts_t fft_op_counts;
+
+const char * fft_op_names[FFT_OPS] = 
+{
+   "butterfly", "butterfly sqrt2", "inverse butterfly", "inverse butterfly sqrt2",
+   "twiddle", "twiddle sqrt2", "mul 2exp", "div 2exp", "normmod", "pointwise"
+};
+
+void fft_op_counts_reset(void)
+{
+   memset(&fft_op_counts, 0, sizeof(fft_op_counts_t));
+}
+
+#if FFT_OP_COUNTS && FFT_THREADS
+#define FFT_COUNT_OP(op, l) \
+   do { \
+      __atomic_fetch_add(&fft_op_counts.count[op], 1, __ATOMIC_RELAXED); \
+      __atomic_fetch_add(&fft_op_counts.limbs[op], (l), __ATOMIC_RELAXED); \
+   } while (0)
+#elif FFT_OP_COUNTS
+#define FFT_COUNT_OP(op, l) \
+   do { \
+      fft_op_counts.count[op]++; \
+      fft_op_counts.limbs[op] += (l); \
+   } while (0)
+#else
+#define FFT_COUNT_OP(op, l) do { } while (0)
+#endif
+
 const mp_limb_t revtab0[1] = { 0 };
 const mp_limb_t revtab1[2] = { 0, 1 };
 const mp_limb_t revtab2[4] = { 0, 2, 1, 3 };
@@ -169,6 +407,42 @@ mp_size_t FFT_split_bits(mp_limb_t ** poly, mp_limb_t * limbs,
    return length;
 }
 
+/*
+   Sets coeff to coefficient number i of the split that FFT_split_bits
+   would produce with the same parameters, i.e. to bits i*bits up to
+   (i+1)*bits - 1 of the mpn, zero padded to output_limbs + 1 limbs.
+   This allows the split to be merged with the top layer of the FFT
+   without storing all the coefficients first.
+*/
+
+void FFT_split_bits_coeff(mp_limb_t * coeff, mp_limb_t * limbs,
+    mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs, mp_size_t i)
+{
+   mp_bitcnt_t start = i*bits;
+   mp_size_t skip = start/GMP_LIMB_BITS;
+   mp_bitcnt_t shift_bits = start - skip*GMP_LIMB_BITS;
+   mp_size_t top = bits/GMP_LIMB_BITS;
+   mp_bitcnt_t top_bits = ((GMP_LIMB_BITS - 1) & bits);
+   mp_size_t coeff_limbs = (bits + shift_bits - 1)/GMP_LIMB_BITS + 1;
+
+   MPN_ZERO(coeff, output_limbs + 1);
+   if (skip >= total_limbs) return;
+
+   if (coeff_limbs > total_limbs - skip) coeff_limbs = total_limbs - skip;
+
+   if (shift_bits)
+      mpn_rshift(coeff, limbs + skip, coeff_limbs, shift_bits);
+   else
+      MPN_COPY(coeff, limbs + skip, coeff_limbs);
+
+   // clear anything above the top bit of the coefficient
+   if (top < coeff_limbs)
+   {
+      coeff[top] &= ((CNST_LIMB(1)<<top_bits) - 1);
+      if (top + 1 < coeff_limbs) MPN_ZERO(coeff + top + 1, coeff_limbs - top - 1);
+   }
+}
+
 /*
    Recombines coefficients after doing a convolution. Assumes each of the 
    coefficients of the poly of the given length is output_limbs long, that each 
@@ -197,18 +471,41 @@ void FFT_combine(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length,
 }
 
 /*
-   Recombines coefficients of a poly after doing a convolution. Assumes 
-   each of the coefficients of the poly of the given length is output_limbs 
-   long, that each is being shifted by a multiple of _bits_ and added
-   to an mpn which is total_limbs long. It is assumed that the mpn has been 
-   zeroed in advance.
+   Set {r, n} to {r, n} + {a, n}*2^s mod B^n, where 0 < s < GMP_LIMB_BITS,
+   using temp, of at least n limbs, for the shifted value. This is the
+   inner loop of FFT_combine_bits.
 */
+void mpn_addlsh_generic(mp_limb_t * r, mp_limb_t * a, mp_size_t n, 
+                                    mp_bitcnt_t s, mp_limb_t * temp)
+{
+   mpn_lshift(temp, a, n, s);
+   mpn_add_n(r, r, temp, n);
+}
 
-void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
-                  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs)
+/*
+   Divides the coefficient c of output_limbs + 1 limbs by 2^scale modulo
+   2^(output_limbs*GMP_LIMB_BITS) + 1 and normalises it, as the combines
+   do for each coefficient just before adding it in, when asked to.
+*/
+static void FFT_combine_scale(mp_limb_t * c, mp_size_t output_limbs, mp_bitcnt_t scale)
+{
+   if (scale)
+   {
+      mpn_div_2expmod_2expp1(c, c, output_limbs, scale);
+      mpn_normmod_2expp1(c, output_limbs);
+   }
+}
+
+/*
+   As per FFT_combine_bits, but if scale is nonzero each coefficient is
+   first scaled by FFT_combine_scale. Only the coefficients which reach 
+   the output are scaled, and each is still in cache when it is added.
+*/
+static void FFT_combine_bits_scaled(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+    mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs, mp_bitcnt_t scale)
 {
    mp_bitcnt_t top_bits = ((GMP_LIMB_BITS - 1) & bits);
-   if (top_bits == 0)
+   if (top_bits == 0 && scale == 0)
    {
       FFT_combine(res, poly, length, bits/GMP_LIMB_BITS, output_limbs, total_limbs);
       return;
@@ -226,10 +523,10 @@ void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length,
    for (i = 0; (i < length) && (limb_ptr + output_limbs < end); i++)
    { 
       //for (j = 0; j < output_limbs; j += 8) PREFETCH(poly->coeffs[i+1], j);
+      FFT_combine_scale(poly[i], output_limbs, scale);
       if (shift_bits)
       {
-         mpn_lshift(temp, poly[i], output_limbs + 1, shift_bits);
-         mpn_add_n(limb_ptr, limb_ptr, temp, output_limbs + 1);
+         fft_kernels.addlsh(limb_ptr, poly[i], output_limbs + 1, shift_bits, temp);
       } else
       {
          mpn_add(limb_ptr, limb_ptr, output_limbs + 1, poly[i], output_limbs);
@@ -245,10 +542,10 @@ void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length,
 
    while ((limb_ptr < end) && (i < length))
    {
+      FFT_combine_scale(poly[i], output_limbs, scale);
       if (shift_bits)
       {
-         mpn_lshift(temp, poly[i], output_limbs + 1, shift_bits);
-         mpn_add_n(limb_ptr, limb_ptr, temp, end - limb_ptr);
+         fft_kernels.addlsh(limb_ptr, poly[i], end - limb_ptr, shift_bits, temp);
       } else
       {
          mpn_add_n(limb_ptr, limb_ptr, poly[i], end - limb_ptr);
@@ -266,10 +563,253 @@ void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length,
    TMP_FREE;     
 }
 
+/*
+   Recombines coefficients of a poly after doing a convolution. Assumes 
+   each of the coefficients of the poly of the given length is output_limbs 
+   long, that each is being shifted by a multiple of _bits_ and added
+   to an mpn which is total_limbs long. It is assumed that the mpn has been 
+   zeroed in advance. The coefficients are added as they are; to divide 
+   each by a power of 2 on the way, use FFT_combine_bits_scaled.
+*/
+
+void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+                  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs)
+{
+   FFT_combine_bits_scaled(res, poly, length, bits, output_limbs, total_limbs, 0);
+}
+
+/*
+   Sets the bits of coeff from bit number bits up to the top of its 
+   output_limbs + 1 limbs, sign extending a coefficient of the given 
+   number of bits to twos complement.
+*/
+static void FFT_sign_extend(mp_limb_t * coeff, mp_size_t bits, mp_size_t output_limbs)
+{
+   mp_size_t q = bits/GMP_LIMB_BITS;
+   mp_bitcnt_t r = bits % GMP_LIMB_BITS;
+
+   if (r)
+   {
+      coeff[q] |= (~CNST_LIMB(0))<<r;
+      q++;
+   }
+
+   for ( ; q <= output_limbs; q++)
+      coeff[q] = ~CNST_LIMB(0);
+}
+
+/*
+   As per FFT_split_bits, but the coefficients are balanced, i.e. in the 
+   range [-2^(bits-1), 2^(bits-1)], and stored in twos complement over all
+   output_limbs + 1 limbs, so that the top limb is 0 or -1, which the 
+   transforms accept as a signed carry. Coefficient i is the unsigned one
+   sign extended from its top bit, plus the top bit of coefficient i - 1. 
+   There are (total_limbs*GMP_LIMB_BITS)/bits + 1 coefficients, the last 
+   absorbing the top bit of the one before.
+
+   The product of two balanced coefficients is at most 2^(2*bits - 2) in 
+   absolute value rather than less than 2^(2*bits), so that with products
+   read as residues in (-p/2, p/2], one bit less of headroom is needed.
+*/
+mp_size_t FFT_split_bits_signed(mp_limb_t ** poly, mp_limb_t * limbs, 
+               mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs)
+{
+   mp_size_t length = (GMP_LIMB_BITS*total_limbs)/bits + 1;
+   mp_size_t top = (bits - 1)/GMP_LIMB_BITS;
+   mp_bitcnt_t top_bit = (bits - 1) % GMP_LIMB_BITS;
+   mp_size_t i, len;
+
+   len = FFT_split_bits(poly, limbs, total_limbs, bits, output_limbs);
+   if (len < length)
+      MPN_ZERO(poly[len], output_limbs + 1);
+
+   // from the top down, so that the top bit of coefficient i - 1 is still there
+   for (i = length - 1; i >= 0; i--)
+   {
+      if ((poly[i][top]>>top_bit) & 1)
+         FFT_sign_extend(poly[i], bits, output_limbs);
+      if (i > 0 && ((poly[i - 1][top]>>top_bit) & 1))
+         mpn_add_1(poly[i], poly[i], output_limbs + 1, 1);
+   }
+
+   return length;
+}
+
+/*
+   Sets coeff to coefficient i of the split FFT_split_bits_signed would 
+   produce, as FFT_split_bits_coeff does for FFT_split_bits.
+*/
+void FFT_split_bits_coeff_signed(mp_limb_t * coeff, mp_limb_t * limbs,
+    mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs, mp_size_t i)
+{
+   mp_bitcnt_t below = i*bits - 1;
+   mp_size_t top = (bits - 1)/GMP_LIMB_BITS;
+
+   FFT_split_bits_coeff(coeff, limbs, total_limbs, bits, output_limbs, i);
+
+   if ((coeff[top]>>((bits - 1) % GMP_LIMB_BITS)) & 1)
+      FFT_sign_extend(coeff, bits, output_limbs);
+
+   if (i > 0 && below/GMP_LIMB_BITS < total_limbs 
+             && ((limbs[below/GMP_LIMB_BITS]>>(below % GMP_LIMB_BITS)) & 1))
+      mpn_add_1(coeff, coeff, output_limbs + 1, 1);
+}
+
+/*
+   As per FFT_combine_bits, for coefficients which are normalised residues
+   of signed values in [-2^(nw-1), 2^(nw-1)], as from a convolution of 
+   balanced coefficients. A negative coefficient is added in twos 
+   complement, sign extended to the top of res. As the limbs above the 
+   window of each coefficient are either all 0 or all 1 (ext), the sign 
+   extension is not written out until a later coefficient reaches them, 
+   so that each coefficient costs the same as for FFT_combine_bits. The 
+   coefficients are destroyed. Each is first scaled, as per 
+   FFT_combine_bits_scaled, if scale is nonzero.
+*/
+static void FFT_combine_bits_signed_scaled(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+    mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs, mp_bitcnt_t scale)
+{
+   mp_size_t i, j, off, wn, top = 0;
+   mp_bitcnt_t shift;
+   mp_limb_t * temp, * c, ext = 0, cy;
+   int neg;
+   TMP_DECL;
+
+   TMP_MARK;
+   temp = (mp_limb_t *) TMP_BALLOC_LIMBS(output_limbs + 2);
+
+   for (i = 0; i < length; i++)
+   {
+      off = (i*bits)/GMP_LIMB_BITS;
+      shift = (i*bits) % GMP_LIMB_BITS;
+      if (off >= total_limbs)
+         break;
+
+      // residues above 2^(nw-1) are negative
+      c = poly[i];
+      FFT_combine_scale(c, output_limbs, scale);
+      neg = (c[output_limbs] != 0);
+      if (!neg && (c[output_limbs - 1]>>(GMP_LIMB_BITS - 1)))
+      {
+         neg = (c[output_limbs - 1] != (CNST_LIMB(1)<<(GMP_LIMB_BITS - 1)));
+         for (j = 0; j < output_limbs - 1 && !neg; j++)
+            neg = (c[j] != 0);
+      }
+      if (neg) // c - p in twos complement
+      {
+         mpn_sub_1(c, c, output_limbs + 1, 1);
+         c[output_limbs] = ~CNST_LIMB(0);
+      }
+
+      if (shift)
+      {
+         temp[output_limbs + 1] = mpn_lshift(temp, c, output_limbs + 1, shift);
+         if (neg)
+            temp[output_limbs + 1] |= (~CNST_LIMB(0))<<shift;
+         c = temp;
+         wn = output_limbs + 2;
+      } else
+         wn = output_limbs + 1;
+
+      if (off + wn >= total_limbs) // nothing above the window is kept
+      {
+         if (ext)
+            for ( ; top < total_limbs; top++)
+               res[top] = ~CNST_LIMB(0);
+         top = total_limbs;
+         mpn_add_n(res + off, res + off, c, total_limbs - off);
+         continue;
+      }
+
+      if (ext)
+         for ( ; top < off + wn; top++)
+            res[top] = ~CNST_LIMB(0);
+      if (top < off + wn)
+         top = off + wn;
+
+      cy = mpn_add_n(res + off, res + off, c, wn);
+      
+      // add cy - neg to the limbs above the window, the last of which is ext
+      if (cy && !neg)
+      {
+         if (top > off + wn)
+            cy = mpn_add_1(res + off + wn, res + off + wn, top - off - wn, 1);
+         if (cy) 
+         {
+            if (ext)
+               ext = 0;
+            else if (top < total_limbs)
+               res[top++] = 1;
+         }
+      } else if (neg && !cy)
+      {
+         if (top > off + wn)
+            cy = mpn_sub_1(res + off + wn, res + off + wn, top - off - wn, 1);
+         else
+            cy = 1;
+         if (cy) 
+         {
+            if (!ext)
+               ext = ~CNST_LIMB(0);
+            else if (top < total_limbs)
+               res[top++] = ~CNST_LIMB(1);
+         }
+      }
+   }
+
+   if (ext)
+      for ( ; top < total_limbs; top++)
+         res[top] = ~CNST_LIMB(0);
+
+   TMP_FREE;
+}
+
+void FFT_combine_bits_signed(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+                  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs)
+{
+   FFT_combine_bits_signed_scaled(res, poly, length, bits, output_limbs, total_limbs, 0);
+}
+
+/*
+   The multipliers based on new_mpn_mul6 split their inputs into balanced
+   coefficients when FFT_SIGNED_SPLIT is set and this allows a larger 
+   bits1, see FFT_MUL6_BITS1. These do the split and combine for them.
+   The combine also divides each coefficient by 2^scale and normalises 
+   it on the way if scale is nonzero, so that the inverse transform need
+   not be scaled in a separate pass.
+*/
+mp_size_t FFT_mul6_split(mp_limb_t ** poly, mp_limb_t * limbs, mp_size_t total_limbs, 
+                     mp_size_t bits, mp_size_t output_limbs, mp_bitcnt_t depth)
+{
+   if (FFT_MUL6_SIGNED(depth))
+      return FFT_split_bits_signed(poly, limbs, total_limbs, bits, output_limbs);
+   else
+      return FFT_split_bits(poly, limbs, total_limbs, bits, output_limbs);
+}
+
+void FFT_mul6_split_coeff(mp_limb_t * coeff, mp_limb_t * limbs, mp_size_t total_limbs, 
+         mp_size_t bits, mp_size_t output_limbs, mp_size_t i, mp_bitcnt_t depth)
+{
+   if (FFT_MUL6_SIGNED(depth))
+      FFT_split_bits_coeff_signed(coeff, limbs, total_limbs, bits, output_limbs, i);
+   else
+      FFT_split_bits_coeff(coeff, limbs, total_limbs, bits, output_limbs, i);
+}
+
+void FFT_mul6_combine(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs, mp_bitcnt_t depth,
+  mp_bitcnt_t scale)
+{
+   if (FFT_MUL6_SIGNED(depth))
+      FFT_combine_bits_signed_scaled(res, poly, length, bits, output_limbs, total_limbs, scale);
+   else
+      FFT_combine_bits_scaled(res, poly, length, bits, output_limbs, total_limbs, scale);
+}
+
 /*
    Normalise t to be in the range [0, 2^nw]
 */
-void mpn_normmod_2expp1(mp_limb_t * t, mp_size_t l)
+void mpn_normmod_2expp1_generic(mp_limb_t * t, mp_size_t l)
 {
    mp_limb_signed_t hi = t[l];
    
@@ -293,6 +833,20 @@ void mpn_normmod_2expp1(mp_limb_t * t, mp_size_t l)
    }
 }
 
+/*
+   A zero top limb means t is already in [0, 2^nw), so this is checked 
+   before anything else, and before counting the operation.
+*/
+void mpn_normmod_2expp1(mp_limb_t * t, mp_size_t l)
+{
+   if (t[l] == 0)
+      return;
+
+   FFT_COUNT_OP(FFT_OP_NORMMOD, l + 1);
+
+   fft_kernels.normmod(t, l);
+}
+
 /*
    We are given two integers modulo 2^wn+1, i1 and i2, which are 
    not necessarily normalised and are given n and w. We compute 
@@ -300,7 +854,7 @@ void mpn_normmod_2expp1(mp_limb_t * t, mp_size_t l)
    outputs is not permitted. We require x and y to be less than the 
    number of limbs of i1 and i2.
 */
-void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+void mpn_lshB_sumdiffmod_2expp1_generic(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
                       mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y)
 {
    mp_limb_t cy, cy1, cy2;
@@ -329,7 +883,7 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       t[limbs] = cy>>1;
       cy1 = cy&1;
       cy = mpn_sumdiff_n(t, u + limbs - x, i1 + limbs - x, i2 + limbs - x, x);
-      cy2 = mpn_neg_n(t, t, x);
+      cy2 = fft_kernels.neg_n(t, t, x);
       u[limbs] = -(cy&1);
       mpn_sub_1(u + limbs - x, u + limbs - x, x + 1, cy1);
       cy1 = -(cy>>1) - cy2;
@@ -343,12 +897,12 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       t[limbs] = cy>>1;
       cy1 = cy&1;
       cy = mpn_sumdiff_n(t, u + y + limbs - x, i1 + limbs - x, i2 + limbs - x, x - y);
-      cy2 = mpn_neg_n(t, t, x - y);
+      cy2 = fft_kernels.neg_n(t, t, x - y);
       u[limbs] = -(cy&1);
       mpn_sub_1(u + y + limbs - x, u + y + limbs - x, x - y + 1, cy1);
       cy1 = (cy>>1) + cy2;
       cy = mpn_sumdiff_n(t + x - y, u, i2 + limbs - y, i1 + limbs - y, y);
-      cy2 = mpn_neg_n(t + x - y, t + x - y, y);
+      cy2 = fft_kernels.neg_n(t + x - y, t + x - y, y);
       cy1 = -(cy>>1) - mpn_sub_1(t + x - y, t + x - y, y, cy1) - cy2;
       cy1 -= (i1[limbs] + i2[limbs]);
       mpn_addmod_2expp1_1(t + x, limbs - x, cy1);
@@ -367,7 +921,7 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       cy1 = -(cy&1) - mpn_sub_1(u + y - x, u + y - x, x, cy1);
       cy1 += (i2[limbs] - i1[limbs]);
       mpn_addmod_2expp1_1(u + y, limbs - y, cy1);
-      cy2 = mpn_neg_n(t, t, x);
+      cy2 = fft_kernels.neg_n(t, t, x);
       cy1 = -(cy>>1) - (i1[limbs] + i2[limbs]) - cy2;
       mpn_addmod_2expp1_1(t + x, limbs - x, cy1);
    } else // x == y
@@ -376,7 +930,7 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       t[limbs] = cy>>1;
       u[limbs] = -(cy&1);
       cy = mpn_sumdiff_n(t, u, i2 + limbs - x, i1 + limbs - x, x);
-      cy2 = mpn_neg_n(t, t, x);
+      cy2 = fft_kernels.neg_n(t, t, x);
       cy1 = -(cy>>1) - (i1[limbs] + i2[limbs]) - cy2;
       mpn_addmod_2expp1_1(t + x, limbs - x, cy1);
       cy1 = -(cy&1) + i2[limbs] - i1[limbs];
@@ -384,6 +938,12 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
   }
 }
 
+void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y)
+{
+   fft_kernels.lshB_sumdiffmod(t, u, i1, i2, limbs, x, y);
+}
+
 /*
    We are given two integers modulo 2^wn+1, i1 and i2, which are 
    not necessarily normalised and are given n and w. We compute 
@@ -391,7 +951,7 @@ void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
    outputs is not permitted. We require x be less than the 
    number of limbs of i1 and i2.
 */
-void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+void mpn_sumdiff_rshBmod_2expp1_generic(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
                       mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y)
 {
    mp_limb_t cy, cy1, cy2, cy3;
@@ -417,7 +977,7 @@ void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       cy = mpn_sumdiff_n(t, u, i1 + x, i2, limbs - x);
       cy1 = (cy>>1);
       cy2 = -(cy&1);
-      cy3 = mpn_neg_n(i1, i1, x);
+      cy3 = fft_kernels.neg_n(i1, i1, x);
       cy = mpn_sumdiff_n(t + limbs - x, u + limbs - x, i1, i2 + limbs - x, x);
       u[limbs] = -cy3 - (cy&1) - i2[limbs];
       t[limbs] = -cy3 + i2[limbs] + (cy>>1);
@@ -429,7 +989,7 @@ void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
       cy1 = (cy>>1);
       cy2 = -(cy&1);
       cy = mpn_sumdiff_n(t + limbs - x, u + limbs - x, i2, i1, x);
-      cy3 = mpn_neg_n(t + limbs - x, t + limbs - x, x);
+      cy3 = fft_kernels.neg_n(t + limbs - x, t + limbs - x, x);
       u[limbs] = -(cy&1);
       t[limbs] = -(cy>>1) - cy3;
       mpn_addmod_2expp1_1(t + limbs - x, x, cy1 + i1[limbs] + i2[limbs]);
@@ -437,10 +997,10 @@ void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
    } else if (x > y)
    {
       cy = mpn_sumdiff_n(t + limbs - y, u + limbs - y, i2, i1 + x - y, y);
-      cy3 = mpn_neg_n(t + limbs - y, t + limbs - y, y);
+      cy3 = fft_kernels.neg_n(t + limbs - y, t + limbs - y, y);
       t[limbs] = -(cy>>1) - cy3;
       u[limbs] = -(cy&1);
-      cy3 = mpn_neg_n(i1, i1, x - y);
+      cy3 = fft_kernels.neg_n(i1, i1, x - y);
       cy = mpn_sumdiff_n(t + limbs - x, u + limbs - x, i1, i2 + limbs - x + y, x - y);
       mpn_addmod_2expp1_1(t + limbs - y, y, (cy>>1) + i2[limbs] - cy3);
       mpn_addmod_2expp1_1(u + limbs - y, y, -(cy&1) - i2[limbs] - cy3);
@@ -450,10 +1010,10 @@ void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
    } else //(x < y)
    {
       cy = mpn_sumdiff_n(t + limbs - x, u + limbs - x, i2 + y - x, i1, x);
-      cy3 = mpn_neg_n(t + limbs - x, t + limbs - x, x);
+      cy3 = fft_kernels.neg_n(t + limbs - x, t + limbs - x, x);
       t[limbs] = -(cy>>1) - cy3;
       u[limbs] = -(cy&1);
-      cy3 = mpn_neg_n(i2, i2, y - x);
+      cy3 = fft_kernels.neg_n(i2, i2, y - x);
       cy = mpn_sumdiff_n(t + limbs - y, u + limbs - y, i1 + limbs - y + x, i2, y - x);
       mpn_addmod_2expp1_1(t + limbs - x, x, (cy>>1) + i1[limbs] - cy3);
       mpn_addmod_2expp1_1(u + limbs - x, x, -(cy&1) + i1[limbs] + cy3);
@@ -463,11 +1023,17 @@ void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1,
    }
 }
 
+void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y)
+{
+   fft_kernels.sumdiff_rshBmod(t, u, i1, i2, limbs, x, y);
+}
+
 /* 
    Given an integer i1 modulo 2^wn+1, set t to 2^d*i1 modulo 2^wm+1.
    We must have GMP_LIMB_BITS > d >= 0.
 */
-void mpn_mul_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
+void mpn_mul_2expmod_2expp1_generic(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
 {
    mp_limb_signed_t hi, hi2;
    
@@ -487,11 +1053,18 @@ void mpn_mul_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_b
    }
 }
 
+void mpn_mul_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_COUNT_OP(FFT_OP_MUL_2EXP, 2*(limbs + 1));
+
+   fft_kernels.mul_2expmod(t, i1, limbs, d);
+}
+
 /* 
    Given an integer i1 modulo 2^wn+1, set t to i1/2^d modulo 2^wm+1.
    We must have GMP_LIMB_BITS > d >= 0.
 */
-void mpn_div_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
+void mpn_div_2expmod_2expp1_generic(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
 {
    mp_limb_t lo;
    mp_limb_t * ptr;
@@ -511,6 +1084,23 @@ void mpn_div_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_b
    }
 }
 
+void mpn_div_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d)
+{
+   FFT_COUNT_OP(FFT_OP_DIV_2EXP, 2*(limbs + 1));
+
+   fft_kernels.div_2expmod(t, i1, limbs, d);
+}
+
+/*
+   Set {r, n} to -{s, n} and return 1, or 0 if {s, n} is zero. This is 
+   mpn_neg_n, dispatched so that the butterflies can use a vectorised
+   negation.
+*/
+mp_limb_t mpn_neg_n_generic(mp_limb_t * r, mp_limb_t * s, mp_size_t n)
+{
+   return mpn_neg_n(r, s, n);
+}
+
 /*
    Set u = 2^{ws*tw1}*(s + t), v = 2^{w+ws*tw2}*(s - t)
 */
@@ -522,6 +1112,8 @@ void FFT_radix2_twiddle_butterfly(mp_limb_t * u, mp_limb_t * v,
    int negate = 0;
    int negate2 = 0;
    
+   FFT_COUNT_OP(FFT_OP_BUTTERFLY, 4*size);
+
    b1 %= (2*NW);
    if (b1 >= NW) 
    {
@@ -542,9 +1134,9 @@ void FFT_radix2_twiddle_butterfly(mp_limb_t * u, mp_limb_t * v,
  
    mpn_lshB_sumdiffmod_2expp1(u, v, s, t, size - 1, x, y);
    mpn_mul_2expmod_2expp1(u, u, size - 1, b1);
-   if (negate2) mpn_neg_n(u, u, size);
+   if (negate2) fft_kernels.neg_n(u, u, size);
    mpn_mul_2expmod_2expp1(v, v, size - 1, b2);
-   if (negate) mpn_neg_n(v, v, size);
+   if (negate) fft_kernels.neg_n(v, v, size);
 }
     
 /*
@@ -558,6 +1150,8 @@ void FFT_radix2_butterfly(mp_limb_t * s, mp_limb_t * t,
    mp_bitcnt_t b1;
    int negate = 0;
 
+   FFT_COUNT_OP(FFT_OP_BUTTERFLY, 4*size);
+
    x = 0;
 
    b1 = i;
@@ -572,7 +1166,7 @@ void FFT_radix2_butterfly(mp_limb_t * s, mp_limb_t * t,
  
    mpn_lshB_sumdiffmod_2expp1(s, t, i1, i2, size - 1, x, y);
    mpn_mul_2expmod_2expp1(t, t, size - 1, b1);
-   if (negate) mpn_neg_n(t, t, size);
+   if (negate) fft_kernels.neg_n(t, t, size);
 }
 
 /*
@@ -598,6 +1192,8 @@ void FFT_radix2_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t,
    mp_bitcnt_t b1;
    int negate = 0;
 
+   FFT_COUNT_OP(FFT_OP_BUTTERFLY_SQRT2, 6*(size + 1));
+
    b1 = j + wn/4 + i*k;
    while (b1 >= wn) 
    {
@@ -611,14 +1207,14 @@ void FFT_radix2_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t,
    /* sumdiff and multiply by 2^{j + wn/4 + i*k} */
    mpn_lshB_sumdiffmod_2expp1(s, t, i1, i2, size, 0, y);
    mpn_mul_2expmod_2expp1(t, t, size, b1);
-   if (negate) mpn_neg_n(t, t, size + 1);
+   if (negate) fft_kernels.neg_n(t, t, size + 1);
 
    /* multiply by 2^{wn/2} */
    y = size/2;
    
    MPN_COPY(temp + y, t, size - y);
    temp[size] = 0;
-   cy = mpn_neg_n(temp, t + size - y, y);
+   cy = fft_kernels.neg_n(temp, t + size - y, y);
    if ((mp_limb_signed_t) t[size] < 0)
        mpn_add_1(temp + y, temp + y, size - y + 1, -t[size]);
    else
@@ -643,6 +1239,8 @@ void FFT_radix2_inverse_butterfly(mp_limb_t * s, mp_limb_t * t,
    mp_size_t y;
    mp_bitcnt_t b1;
    
+   FFT_COUNT_OP(FFT_OP_INVERSE_BUTTERFLY, 4*(limbs + 1));
+
    b1 = i*w;
    y = b1/GMP_LIMB_BITS;
    b1 -= y*GMP_LIMB_BITS;
@@ -680,6 +1278,8 @@ void FFT_radix2_inverse_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t,
    mp_size_t b1;
    int negate = 0;
 
+   FFT_COUNT_OP(FFT_OP_INVERSE_BUTTERFLY_SQRT2, 6*(size + 1));
+
    b1 = 2*wn - j - i*k - 1 + wn/4;
    while (b1 >= wn) 
    {
@@ -698,7 +1298,7 @@ void FFT_radix2_inverse_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t,
     
    MPN_COPY(temp + y, i2, size - y);
    temp[size] = 0;
-   cy = mpn_neg_n(temp, i2 + size - y, y);
+   cy = fft_kernels.neg_n(temp, i2 + size - y, y);
    if ((mp_limb_signed_t) i2[size] < 0)
        mpn_add_1(temp + y, temp + y, size - y + 1, -i2[size]);
    else
@@ -726,6 +1326,8 @@ void FFT_radix2_twiddle_inverse_butterfly(mp_limb_t * s, mp_limb_t * t,
    int negate = 0;
    int negate2 = 0;
    
+   FFT_COUNT_OP(FFT_OP_INVERSE_BUTTERFLY, 4*(limbs + 1));
+
    b1 %= (2*NW);
    if (b1 >= NW)
    {
@@ -744,9 +1346,9 @@ void FFT_radix2_twiddle_inverse_butterfly(mp_limb_t * s, mp_limb_t * t,
    y = b2/GMP_LIMB_BITS;
    b2 -= y*GMP_LIMB_BITS;
 
-   if (negate) mpn_neg_n(i1, i1, limbs + 1);
+   if (negate) fft_kernels.neg_n(i1, i1, limbs + 1);
    mpn_div_2expmod_2expp1(i1, i1, limbs, b1);
-   if (negate2) mpn_neg_n(i2, i2, limbs + 1);
+   if (negate2) fft_kernels.neg_n(i2, i2, limbs + 1);
    mpn_div_2expmod_2expp1(i2, i2, limbs, b2);
    mpn_sumdiff_rshBmod_2expp1(s, t, i1, i2, limbs, x, y);
 }
@@ -898,7 +1500,7 @@ int FFT_negacyclic_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t
    mp_size_t x = b1/GMP_LIMB_BITS;
    b1 -= x*GMP_LIMB_BITS;
    //if ((!x) && (negate)) 
-   if (negate) mpn_neg_n(i1, i1, limbs + 1);
+   if (negate) fft_kernels.neg_n(i1, i1, limbs + 1);
    mpn_mul_2expmod_2expp1(i1, i1, limbs, b1);
    if (x)
    {
@@ -911,7 +1513,7 @@ int FFT_negacyclic_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t
       {*/
          MPN_COPY(r + x, i1, limbs - x);
          r[limbs] = CNST_LIMB(0);
-         cy = mpn_neg_n(r, i1 + limbs - x, x);
+         cy = fft_kernels.neg_n(r, i1 + limbs - x, x);
          mpn_addmod_2expp1_1(r + x, limbs - x, -i1[limbs]);
          mpn_sub_1(r + x, r + x, limbs - x + 1, cy); 
       //}
@@ -928,6 +1530,7 @@ void FFT_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t n, mp_bit
    mp_limb_t cy;
    mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
    int negate = 0;
+   FFT_COUNT_OP(FFT_OP_TWIDDLE, 2*(limbs + 1));
    while (i >= n)
    {
       negate = 1 - negate;
@@ -940,16 +1543,16 @@ void FFT_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t n, mp_bit
    {
       MPN_COPY(r + x, i1, limbs - x);
       r[limbs] = 0;
-      cy = mpn_neg_n(r, i1 + limbs - x, x);
+      cy = fft_kernels.neg_n(r, i1 + limbs - x, x);
       mpn_addmod_2expp1_1(r + x, limbs - x, - i1[limbs]);
       mpn_sub_1(r + x, r + x, limbs - x + 1, cy); 
-      if (negate) mpn_neg_n(r, r, limbs + 1);
+      if (negate) fft_kernels.neg_n(r, r, limbs + 1);
       mpn_mul_2expmod_2expp1(r, r, limbs, b1);
    } else
    {
       if (negate) 
       {
-         mpn_neg_n(r, i1, limbs + 1);
+         fft_kernels.neg_n(r, i1, limbs + 1);
          mpn_mul_2expmod_2expp1(r, r, limbs, b1);
       } else
          mpn_mul_2expmod_2expp1(r, i1, limbs, b1);
@@ -979,6 +1582,8 @@ void FFT_twiddle_sqrt2(mp_limb_t * r,
    mp_bitcnt_t b1;
    int negate = 0;
 
+   FFT_COUNT_OP(FFT_OP_TWIDDLE_SQRT2, 4*(size + 1));
+
    b1 = j + wn/4 + i*k;
    while (b1 >= wn) 
    {
@@ -993,23 +1598,23 @@ void FFT_twiddle_sqrt2(mp_limb_t * r,
    if (y)
    {
       mpn_copyi(temp + y, i1, size - y);
-      cy = mpn_neg_n(temp, i1 + size - y, y);
+      cy = fft_kernels.neg_n(temp, i1 + size - y, y);
       temp[size] = 0;
       mpn_addmod_2expp1_1(temp + y, size - y, -i1[size]);
       mpn_sub_1(temp + y, temp + y, size - y + 1, cy); 
       mpn_mul_2expmod_2expp1(r, temp, size, b1);
-      if (negate) mpn_neg_n(r, r, size + 1);
+      if (negate) fft_kernels.neg_n(r, r, size + 1);
    } else
    {
       mpn_mul_2expmod_2expp1(r, i1, size, b1);
-      if (negate) mpn_neg_n(r, r, size + 1);
+      if (negate) fft_kernels.neg_n(r, r, size + 1);
    }
    /* multiply by 2^{wn/2} */
    y = size/2;
    
    MPN_COPY(temp + y, r, size - y);
    temp[size] = 0;
-   cy = mpn_neg_n(temp, r + size - y, y);
+   cy = fft_kernels.neg_n(temp, r + size - y, y);
    mpn_addmod_2expp1_1(temp + y, size - y, -r[size]);
    mpn_sub_1(temp + y, temp + y, size - y + 1, cy); 
    
@@ -1088,6 +1693,13 @@ void FFT_radix2_truncate1_twiddle(mp_limb_t ** ii, mp_size_t is,
       return;
    }
 
+   if (n == 1) /* trunc = 1, output 2^{ws*r*c}*(i0 + i1) only */
+   {
+      mpn_add_n(*t1, ii[0], ii[is], size);
+      FFT_twiddle(ii[0], *t1, (r*c*ws) % (2*w), w, 1);
+      return;
+   }
+
    if (trunc <= n)
    {
       for (i = 0; i < n; i++)
@@ -1616,6 +2228,17 @@ void IFFT_radix2_truncate1_twiddle(mp_limb_t ** ii, mp_size_t is,
       return;
    }
 
+   if (n == 1) /* trunc = 1, ii[0] = 2^{ws*r*c}*(i0 + i1) and ii[is] = 2*i1 */
+   {
+      FFT_twiddle(*t1, ii[0], (2*w - (r*c*ws) % (2*w)) % (2*w), w, 1);
+      mpn_add_n(*t1, *t1, *t1, size);
+      mpn_sub_n(*t1, *t1, ii[is], size);
+      ptr = ii[0];
+      ii[0] = *t1;
+      *t1 = ptr;
+      return;
+   }
+
    if (trunc <= n)
    {
       // PASS
@@ -1667,9 +2290,114 @@ void IFFT_radix2_truncate1_twiddle(mp_limb_t ** ii, mp_size_t is,
    }
 }
 
-/* 
-   Truncate IFFT to given length. Requires trunc a multiple of 8.
-   Assumes (conceptually) zeroes from trunc to n.
+/*
+   As per IFFT_radix2_truncate1_twiddle, except that trunc may be anything
+   less than 2n, including 0, and ii[trunc*is] is also set to output trunc
+   of the forward transform, scaled by 2n like the other entries. This is
+   what the matrix Fourier algorithm needs to invert a partial last row.
+   It costs O(2^k) more than IFFT_radix2_truncate1_twiddle where 2^k is
+   the largest power of 2 dividing trunc.
+*/
+void IFFT_radix2_truncate1_twiddle_next(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc)
+{
+   mp_limb_t * ptr;
+   mp_size_t i;
+   mp_size_t size = (w*n)/GMP_LIMB_BITS + 1;
+
+   if (n == 1)
+   {
+      if (trunc == 1)
+         IFFT_radix2_truncate1_twiddle(ii, is, n, w, t1, t2, temp, ws, r, c, rs, trunc);
+
+      FFT_radix2_twiddle_butterfly(*t1, *t2, ii[0], ii[is], w, r*c*ws, (r + rs)*c*ws);
+
+      if (trunc == 0)
+      {
+         ptr = ii[0];
+         ii[0] = *t1;
+         *t1 = ptr;
+      } else
+      {
+         ptr = ii[is];
+         ii[is] = *t2;
+         *t2 = ptr;
+      }
+      return;
+   }
+
+   if (trunc < n)
+   {
+      for (i = trunc; i < n; i++)
+      {
+         mpn_add_n(ii[i*is], ii[i*is], ii[(i+n)*is], size);
+         mpn_div_2expmod_2expp1(ii[i*is], ii[i*is], size - 1, 1);
+      }
+
+      IFFT_radix2_truncate1_twiddle_next(ii, is, n/2, 2*w, t1, t2, temp, ws, r, c, 2*rs, trunc);
+
+      for (i = 0; i < trunc; i++)
+         mpn_addsub_n(ii[i*is], ii[i*is], ii[i*is], ii[(n+i)*is], size);
+
+      mpn_add_n(ii[trunc*is], ii[trunc*is], ii[trunc*is], size);
+      return;
+   }
+
+   IFFT_radix2_twiddle(ii, is, n/2, 2*w, t1, t2, temp, ws, r, c, 2*rs);
+
+   if (trunc == n)
+   {
+      // all the inputs are now known, and output n is the first output
+      // of the second half, 2^{ws*(r+rs)*c} times the sum of its inputs
+      for (i = 0; i < n; i++)
+         mpn_addsub_n(ii[i*is], ii[i*is], ii[i*is], ii[(n+i)*is], size);
+
+      mpn_sub_n(*t2, ii[0], ii[n*is], size);
+      for (i = 1; i < n; i++)
+      {
+         mpn_sub_n(*t1, ii[i*is], ii[(n+i)*is], size);
+         FFT_twiddle(*temp, *t1, i, n, w);
+         mpn_add_n(*t2, *t2, *temp, size);
+      }
+      FFT_twiddle(*t1, *t2, ((r + rs)*c*ws) % (2*n*w), n*w, 1);
+
+      ptr = ii[n*is];
+      ii[n*is] = *t1;
+      *t1 = ptr;
+      return;
+   }
+
+   for (i = trunc - n; i < n; i++)
+   {
+      mpn_sub_n(ii[(i+n)*is], ii[i*is], ii[(i+n)*is], size);
+      FFT_twiddle(*t1, ii[(i+n)*is], i, n, w);
+      mpn_add_n(ii[i*is], ii[i*is], ii[(i+n)*is], size);
+      ptr = ii[(i+n)*is];
+      ii[(i+n)*is] = *t1;
+      *t1 = ptr;
+   }
+
+   IFFT_radix2_truncate1_twiddle_next(ii + n*is, is, n/2, 2*w, t1, t2, temp, ws, r + rs, c, 2*rs, trunc - n);
+
+   for (i = 0; i < trunc - n; i++)
+   {
+      FFT_radix2_inverse_butterfly(*t1, *t2, ii[i*is], ii[(n+i)*is], i, n, w);
+
+      ptr = ii[i*is];
+      ii[i*is] = *t1;
+      *t1 = ptr;
+      ptr = ii[(n+i)*is];
+      ii[(n+i)*is] = *t2;
+      *t2 = ptr;
+   }
+
+   mpn_add_n(ii[trunc*is], ii[trunc*is], ii[trunc*is], size);
+}
+
+/* 
+   Truncate IFFT to given length. Requires trunc a multiple of 8.
+   Assumes (conceptually) zeroes from trunc to n.
 */
 void IFFT_radix2_truncate(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
       mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
@@ -2206,8 +2934,37 @@ void FFT_radix2_mfa_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
    }
 }
 
+/*
+   Swaps the coefficients of column i of an n2 x n1 matrix into bit 
+   reversed order, for the first rows rows.
+*/
+void FFT_mfa_revbin_column(mp_limb_t ** ii, mp_size_t n1, mp_size_t n2, 
+                                       mp_size_t i, mp_size_t rows)
+{
+   mp_size_t j, s;
+   mp_bitcnt_t depth = 0;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth) < n2) depth++;
+
+   for (j = 0; j < rows; j++)
+   {
+      s = mpir_revbin(j, depth);
+      if (j < s)
+      {
+         ptr = ii[i + j*n1];
+         ii[i + j*n1] = ii[i + s*n1];
+         ii[i + s*n1] = ptr;
+      }
+   }
+}
+
 /* 
-    trunc must be a multiple of 2*n1
+    trunc must be even and greater than 2n. The second half is computed 
+    for trunc2 = (trunc - 2n)/n1 whole rows and, if trunc3 = trunc - 2n - 
+    trunc2*n1 is nonzero, the first trunc3 outputs of one further row. The
+    outputs of this partial row are left in bit reversed order, in the row
+    with index revbin(trunc2).
 */
 void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
       mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc)
@@ -2215,10 +2972,12 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
    mp_size_t i, j;
    mp_size_t n2 = (2*n)/n1;
    mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t trunc3 = trunc - 2*n - trunc2*n1;
    mp_size_t s;
    mp_bitcnt_t depth = 0;
    mp_bitcnt_t depth2 = 0;
    mp_limb_t * ptr;
+   FFT_PHASE_DECL;
 
    while ((1UL<<depth) < n2) depth++;
    while ((1UL<<depth2) < n1) depth2++;
@@ -2226,6 +2985,7 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
    /* first half FFT */
    // n2 rows, n1 cols
    
+   FFT_PHASE_START;
    for (i = 0; i < n1; i++)
    {   
       /* first row of FFT */
@@ -2296,7 +3056,9 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
          }
       }
    }
+   FFT_PHASE_END(FFT_PHASE_FFT_COLUMNS);
    
+   FFT_PHASE_START;
    for (i = 0; i < n2; i++)
    {
       FFT_radix2(ii + i*n1, 1, ii + i*n1, n1/2, w*n2, t1, t2, temp);
@@ -2312,18 +3074,21 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
          }
       }
    }
+   FFT_PHASE_END(FFT_PHASE_FFT_ROWS);
    
    ii += 2*n;
 
    /* second half FFT */
    // n2 rows, n1 cols
 
+   FFT_PHASE_START;
    for (i = 0; i < n1; i++)
    {   
       // FFT of length n2 on column i, applying z^{r*i} for rows going up in steps 
       // of 1 starting at row 0, where z => w bits
       
-      FFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, trunc2);
+      FFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, 
+                                                           trunc2 + (trunc3 != 0));
       for (j = 0; j < n2; j++)
       {
          mp_size_t s = mpir_revbin(j, depth);
@@ -2335,7 +3100,9 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
          }
       }
    }
+   FFT_PHASE_END(FFT_PHASE_FFT_COLUMNS);
 
+   FFT_PHASE_START;
    for (s = 0; s < trunc2; s++)
    {
       i = mpir_revbin(s, depth);
@@ -2352,6 +3119,245 @@ void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
          }
       }
    }
+
+   if (trunc3 != 0)
+   {
+      i = mpir_revbin(trunc2, depth);
+      FFT_radix2_truncate1(ii + i*n1, 1, ii + i*n1, n1/2, w*n2, t1, t2, temp, trunc3);
+   }
+   FFT_PHASE_END(FFT_PHASE_FFT_ROWS);
+}
+
+/*
+   Computes one half of the transform FFT_radix2_mfa_truncate_sqrt2 would
+   compute on the coefficients FFT_split_bits would split the mpn {limbs,
+   total_limbs} into, extracting each coefficient as it is needed. If half
+   is 0 the outputs which would be in ii[0], ..., ii[2n-1] are written to
+   jj[0], ..., jj[2n-1], otherwise the outputs which would be in ii[2n],
+   ..., ii[4n-1] are, of which only the first trunc - 2n are computed.
+
+   Only 2n coefficients of storage are needed for jj. The price is that
+   every input coefficient is extracted once for each half.
+
+   trunc must be even and greater than 2n. As for the full transform, any
+   partial last row of the second half is left in bit reversed order.
+*/
+void FFT_radix2_mfa_truncate_sqrt2_half(mp_limb_t ** jj, mp_size_t half,
+      mp_limb_t * limbs, mp_size_t total_limbs, mp_bitcnt_t bits,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2,
+      mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc)
+{
+   mp_size_t i, j;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t trunc3 = trunc - 2*n - trunc2*n1;
+   mp_size_t size = (n*w)/GMP_LIMB_BITS + 1;
+   mp_size_t s;
+   mp_bitcnt_t depth = 0;
+   mp_bitcnt_t depth2 = 0;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth) < n2) depth++;
+   while ((1UL<<depth2) < n1) depth2++;
+
+   /*
+      first row of FFT, merged with the split: jj[j] is set to the sum
+      (half = 0) or the twiddled difference (half = 1) of coefficients
+      j and 2n + j
+   */
+   for (j = 0; j < 2*n; j++)
+   {
+      FFT_mul6_split_coeff(jj[j], limbs, total_limbs, bits, size - 1, j, depth + depth2 - 1);
+      FFT_mul6_split_coeff(*t1, limbs, total_limbs, bits, size - 1, 2*n + j, depth + depth2 - 1);
+
+      if (half == 0)
+         mpn_add_n(jj[j], jj[j], *t1, size);
+      else
+      {
+         mpn_sub_n(*t1, jj[j], *t1, size);
+         if ((w & 1) == 1)
+         {
+            if ((j & 1) == 0)
+               FFT_twiddle(jj[j], *t1, j/2, n, w);
+            else
+               FFT_twiddle_sqrt2(jj[j], *t1, j, n, w, *temp);
+         } else
+            FFT_twiddle(jj[j], *t1, j, 2*n, w/2);
+      }
+   }
+
+   // n2 rows, n1 cols
+
+   for (i = 0; i < n1; i++)
+   {
+      // FFT of length n2 on column i, applying z^{r*i} for rows going up in steps
+      // of 1 starting at row 0, where z => w bits
+
+      if (half == 0)
+         FFT_radix2_twiddle(jj + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1);
+      else
+         FFT_radix2_truncate1_twiddle(jj + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, 
+                                                              trunc2 + (trunc3 != 0));
+
+      for (j = 0; j < n2; j++)
+      {
+         s = mpir_revbin(j, depth);
+         if (j < s)
+         {
+            ptr = jj[i + j*n1];
+            jj[i + j*n1] = jj[i + s*n1];
+            jj[i + s*n1] = ptr;
+         }
+      }
+   }
+
+   for (s = 0; s < (half == 0 ? n2 : trunc2); s++)
+   {
+      i = (half == 0 ? s : mpir_revbin(s, depth));
+      FFT_radix2(jj + i*n1, 1, jj + i*n1, n1/2, w*n2, t1, t2, temp);
+
+      for (j = 0; j < n1; j++)
+      {
+         mp_size_t t = mpir_revbin(j, depth2);
+         if (j < t)
+         {
+            ptr = jj[i*n1 + j];
+            jj[i*n1 + j] = jj[i*n1 + t];
+            jj[i*n1 + t] = ptr;
+         }
+      }
+   }
+
+   if (half == 1 && trunc3 != 0)
+   {
+      i = mpir_revbin(trunc2, depth);
+      FFT_radix2_truncate1(jj + i*n1, 1, jj + i*n1, n1/2, w*n2, t1, t2, temp, trunc3);
+   }
+}
+
+/*
+   The work of FFT_radix2_mfa_truncate_sqrt2 which involves column i only,
+   namely the first row of the FFT for the coefficients in that column, 
+   then the column FFTs of the first and second halves. The columns are 
+   independent, so they can be done in any order, or concurrently if each
+   thread has its own temporaries. Unlike FFT_radix2_mfa_truncate_sqrt2, 
+   only whole rows are dealt with, so trunc must be a multiple of n1.
+*/
+void FFT_radix2_mfa_truncate_sqrt2_column(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1, mp_size_t trunc, mp_size_t i)
+{
+   mp_size_t j;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t s;
+   mp_bitcnt_t depth = 0;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth) < n2) depth++;
+
+   /* first row of FFT */
+   if ((w & 1) == 1)
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         if ((j & 1) == 0)
+            FFT_radix2_butterfly(*t1, *t2, ii[j], ii[2*n+j], j/2, n, w);
+         else
+            FFT_radix2_butterfly_sqrt2(*t1, *t2, ii[j], ii[2*n+j], j, n, w, *temp);
+
+         ptr = ii[j];
+         ii[j] = *t1;
+         *t1 = ptr;
+         ptr = ii[2*n+j];
+         ii[2*n+j] = *t2;
+         *t2 = ptr;
+      }
+
+      for ( ; j < 2*n; j+=n1)
+      {
+          if ((i & 1) == 0)
+             FFT_twiddle(ii[j + 2*n], ii[j], j/2, n, w); 
+          else
+             FFT_twiddle_sqrt2(ii[j + 2*n], ii[j], j, n, w, *temp); 
+      }
+   } else
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         FFT_radix2_butterfly(*t1, *t2, ii[j], ii[2*n+j], j, 2*n, w/2);
+
+         ptr = ii[j];
+         ii[j] = *t1;
+         *t1 = ptr;
+         ptr = ii[2*n+j];
+         ii[2*n+j] = *t2;
+         *t2 = ptr;
+      }
+
+      for ( ; j < 2*n; j+=n1)
+         FFT_twiddle(ii[j + 2*n], ii[j], j, 2*n, w/2);
+   }
+
+   /* column FFT of the first half */
+   FFT_radix2_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1);
+   for (j = 0; j < n2; j++)
+   {
+      s = mpir_revbin(j, depth);
+      if (j < s)
+      {
+         ptr = ii[i + j*n1];
+         ii[i + j*n1] = ii[i + s*n1];
+         ii[i + s*n1] = ptr;
+      }
+   }
+
+   /* column FFT of the second half */
+   ii += 2*n;
+
+   FFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, trunc2);
+   for (j = 0; j < n2; j++)
+   {
+      s = mpir_revbin(j, depth);
+      if (j < s)
+      {
+         ptr = ii[i + j*n1];
+         ii[i + j*n1] = ii[i + s*n1];
+         ii[i + s*n1] = ptr;
+      }
+   }
+}
+
+/*
+   The row FFT of FFT_radix2_mfa_truncate_sqrt2 for the row starting at 
+   coefficient ii[0]. Row i of the first half starts at coefficient i*n1
+   and row i of the second half at 2n + i*n1. Of the latter only the rows 
+   mpir_revbin(s, depth) for s < (trunc - 2n)/n1 are needed, where 2^depth
+   is the number of rows 2n/n1.
+*/
+void FFT_radix2_mfa_truncate_sqrt2_row(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1)
+{
+   mp_size_t j, t;
+   mp_size_t n2 = (2*n)/n1;
+   mp_bitcnt_t depth2 = 0;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth2) < n1) depth2++;
+
+   FFT_radix2(ii, 1, ii, n1/2, w*n2, t1, t2, temp);
+      
+   for (j = 0; j < n1; j++)
+   {
+      t = mpir_revbin(j, depth2);
+      if (j < t)
+      {
+         ptr = ii[j];
+         ii[j] = ii[t];
+         ii[t] = ptr;
+      }
+   }
 }
 
 void FFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
@@ -2359,7 +3365,6 @@ void FFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
 {
    mp_size_t i, j, s;
    mp_size_t n2 = (2*n)/n1;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
    mp_bitcnt_t depth = 0;
    mp_bitcnt_t depth2 = 0;
    mp_limb_t * ptr;
@@ -2403,7 +3408,6 @@ void FFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
             ii[i*n1 + j] = ii[i*n1 + t];
             ii[i*n1 + t] = ptr;
          }
-         mpn_normmod_2expp1(ii[i*n1 + j], limbs);
        }
    }
 }
@@ -2590,17 +3594,86 @@ void IFFT_radix2_mfa_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
    }
 }
 
+/*
+   The column IFFT of the second half of IFFT_radix2_mfa_truncate_sqrt2 for
+   column i, where ii points to the second half, followed by the final row
+   of the IFFT for the coefficients in that column. The rows of the column 
+   which hold outputs of the transform must already be in bit reversed 
+   order. If the last row is partial and column i is not in it, the input
+   of the partial row IFFT in column i is left in row trunc2, scaled by n1
+   like the outputs of the row IFFTs.
+*/
+static void IFFT_mfa_truncate_sqrt2_column2(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1, mp_size_t trunc, mp_size_t i)
+{
+   mp_size_t j, u;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t trunc3 = trunc - 2*n - trunc2*n1;
+   mp_size_t rows = trunc2 + (i < trunc3);
+   mp_bitcnt_t depth = 0;
+   mp_bitcnt_t size = (w*n)/GMP_LIMB_BITS + 1;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth) < n2) depth++;
+
+   for (j = rows; j < n2; j++)
+   {
+      u = i + j*n1;
+      if ((w & 1) == 1)
+      {
+         if ((i & 1) == 0)
+            FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u/2, n, w); 
+         else
+            FFT_twiddle_sqrt2(ii[i + j*n1], ii[u - 2*n], u, n, w, *temp); 
+      } else
+         FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u, 2*n, w/2);
+   }
+
+   if (i >= trunc3 && trunc3 != 0)
+   {
+      IFFT_radix2_truncate1_twiddle_next(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, rows);
+      mpn_div_2expmod_2expp1(ii[i + rows*n1], ii[i + rows*n1], size - 1, depth);
+   } else
+      IFFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, rows);
+      
+   /* final row of IFFT */
+   for (j = i; j < trunc - 2*n; j+=n1) 
+   {   
+      if ((w & 1) == 1)
+      {
+         if ((j & 1) == 0)
+            FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j/2, n, w);
+         else
+            FFT_radix2_inverse_butterfly_sqrt2(*t1, *t2, ii[j - 2*n], ii[j], j, n, w, *temp);
+      } else
+         FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j, 2*n, w/2);
+   
+      ptr = ii[j - 2*n];
+      ii[j - 2*n] = *t1;
+      *t1 = ptr;
+      ptr = ii[j];
+      ii[j] = *t2;
+      *t2 = ptr;
+   }
+
+   for ( ; j < 2*n; j+=n1)
+      mpn_add_n(ii[j - 2*n], ii[j - 2*n], ii[j - 2*n], size);
+}
+
 void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
       mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc)
 {
    mp_size_t i, j;
    mp_size_t n2 = (2*n)/n1;
    mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t trunc3 = trunc - 2*n - trunc2*n1;
    mp_size_t s;
    mp_bitcnt_t depth = 0;
    mp_bitcnt_t depth2 = 0;
-   mp_bitcnt_t size = (w*n)/GMP_LIMB_BITS + 1;
    mp_limb_t * ptr;
+   FFT_PHASE_DECL;
 
    while ((1UL<<depth) < n2) depth++;
    while ((1UL<<depth2) < n1) depth2++;
@@ -2608,6 +3681,7 @@ void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
    /* first half IFFT */
    // n2 rows, n1 cols
 
+   FFT_PHASE_START;
    for (i = 0; i < n2; i++)
    {
       for (j = 0; j < n1; j++)
@@ -2623,7 +3697,9 @@ void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
       
       IFFT_radix2(ii + i*n1, 1, ii + i*n1, n1/2, w*n2, t1, t2, temp);
    }
+   FFT_PHASE_END(FFT_PHASE_IFFT_ROWS);
    
+   FFT_PHASE_START;
    for (i = 0; i < n1; i++)
    {   
       for (j = 0; j < n2; j++)
@@ -2641,12 +3717,14 @@ void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
       // of 1 starting at row 0, where z => w bits
       IFFT_radix2_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1);
    }
+   FFT_PHASE_END(FFT_PHASE_IFFT_COLUMNS);
    
    ii += 2*n;
 
    /* second half IFFT */
    // n2 rows, n1 cols
 
+   FFT_PHASE_START;
    for (s = 0; s < trunc2; s++)
    {
       i = mpir_revbin(s, depth);
@@ -2663,83 +3741,160 @@ void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
       
       IFFT_radix2(ii + i*n1, 1, ii + i*n1, n1/2, w*n2, t1, t2, temp);
    }
+   FFT_PHASE_END(FFT_PHASE_IFFT_ROWS);
 
-   for (i = 0; i < n1; i++)
+   FFT_PHASE_START;
+   for (i = trunc3; i < n1; i++)
    {   
-      for (j = 0; j < trunc2; j++)
-      {
-         mp_size_t s = mpir_revbin(j, depth);
-         if (j < s)
-         {
-            ptr = ii[i + j*n1];
-            ii[i + j*n1] = ii[i + s*n1];
-            ii[i + s*n1] = ptr;
-         }
-      }
+      FFT_mfa_revbin_column(ii, n1, n2, i, trunc2);
+      IFFT_mfa_truncate_sqrt2_column2(ii, n, w, t1, t2, temp, n1, trunc, i);
+   }
 
-      for ( ; j < n2; j++)
+   if (trunc3 != 0)
+   {
+      /* 
+         the columns above have given the inputs of the partial row from
+         trunc3 on, so its IFFT can be done, then the remaining columns
+      */
+      for (i = 0; i < trunc3; i++)
+         FFT_mfa_revbin_column(ii, n1, n2, i, trunc2 + 1);
+
+      IFFT_radix2_truncate1(ii + trunc2*n1, 1, ii + trunc2*n1, n1/2, w*n2, t1, t2, temp, trunc3);
+
+      for (i = 0; i < trunc3; i++)
+         IFFT_mfa_truncate_sqrt2_column2(ii, n, w, t1, t2, temp, n1, trunc, i);
+   }
+   FFT_PHASE_END(FFT_PHASE_IFFT_COLUMNS);
+}
+
+/*
+   The row IFFT of IFFT_radix2_mfa_truncate_sqrt2 for the row starting at 
+   coefficient ii[0]. See FFT_radix2_mfa_truncate_sqrt2_row for which rows 
+   are needed.
+*/
+void IFFT_radix2_mfa_truncate_sqrt2_row(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1)
+{
+   mp_size_t j, t;
+   mp_size_t n2 = (2*n)/n1;
+   mp_bitcnt_t depth2 = 0;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth2) < n1) depth2++;
+
+   for (j = 0; j < n1; j++)
+   {
+      t = mpir_revbin(j, depth2);
+      if (j < t)
       {
-         mp_size_t u = i + j*n1;
-         if ((w & 1) == 1)
-         {
-            if ((i & 1) == 0)
-               FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u/2, n, w); 
-            else
-               FFT_twiddle_sqrt2(ii[i + j*n1], ii[u - 2*n], u, n, w, *temp); 
-         } else
-            FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u, 2*n, w/2);
+         ptr = ii[j];
+         ii[j] = ii[t];
+         ii[t] = ptr;
       }
+   }      
+      
+   IFFT_radix2(ii, 1, ii, n1/2, w*n2, t1, t2, temp);
+}
 
-      // IFFT of length n2 on column i, applying z^{r*i} for rows going up in steps 
-      // of 1 starting at row 0, where z => w bits
-      IFFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, trunc2);
+/*
+   The work of IFFT_radix2_mfa_truncate_sqrt2 which involves column i only,
+   i.e. the column IFFTs of the first and second halves, followed by the 
+   final row of the IFFT for the coefficients in that column. All the row
+   IFFTs must have been done first. As for the forward column function, 
+   trunc must be a multiple of n1.
+*/
+void IFFT_radix2_mfa_truncate_sqrt2_column(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1, mp_size_t trunc, mp_size_t i)
+{
+   mp_size_t j, u;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_size_t s;
+   mp_bitcnt_t depth = 0;
+   mp_bitcnt_t size = (w*n)/GMP_LIMB_BITS + 1;
+   mp_limb_t * ptr;
+
+   while ((1UL<<depth) < n2) depth++;
+
+   /* column IFFT of the first half */
+   for (j = 0; j < n2; j++)
+   {
+      s = mpir_revbin(j, depth);
+      if (j < s)
+      {
+         ptr = ii[i + j*n1];
+         ii[i + j*n1] = ii[i + s*n1];
+         ii[i + s*n1] = ptr;
+      }
+   }
       
-      /* final row of IFFT */
+   IFFT_radix2_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1);
+   
+   /* column IFFT of the second half */
+   ii += 2*n;
+
+   for (j = 0; j < trunc2; j++)
+   {
+      s = mpir_revbin(j, depth);
+      if (j < s)
+      {
+         ptr = ii[i + j*n1];
+         ii[i + j*n1] = ii[i + s*n1];
+         ii[i + s*n1] = ptr;
+      }
+   }
 
+   for ( ; j < n2; j++)
+   {
+      u = i + j*n1;
       if ((w & 1) == 1)
       {
-         for (j = i; j < trunc - 2*n; j+=n1) 
-         {   
-            if ((j & 1) == 0)
-            {
-               FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j/2, n, w);
-   
-               ptr = ii[j - 2*n];
-               ii[j - 2*n] = *t1;
-               *t1 = ptr;
-               ptr = ii[j];
-               ii[j] = *t2;
-               *t2 = ptr;
-            } else
-            {
-               FFT_radix2_inverse_butterfly_sqrt2(*t1, *t2, ii[j - 2*n], ii[j], j, n, w, *temp);
-   
-               ptr = ii[j - 2*n];
-               ii[j - 2*n] = *t1;
-               *t1 = ptr;
-               ptr = ii[j];
-               ii[j] = *t2;
-               *t2 = ptr;
-            }
-         }
+         if ((i & 1) == 0)
+            FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u/2, n, w); 
+         else
+            FFT_twiddle_sqrt2(ii[i + j*n1], ii[u - 2*n], u, n, w, *temp); 
       } else
-      {
-         for (j = i; j < trunc - 2*n; j+=n1) 
-         {   
-            FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j, 2*n, w/2);
+         FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u, 2*n, w/2);
+   }
+
+   IFFT_radix2_truncate1_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, trunc2);
+      
+   /* final row of IFFT */
+   if ((w & 1) == 1)
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         if ((j & 1) == 0)
+            FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j/2, n, w);
+         else
+            FFT_radix2_inverse_butterfly_sqrt2(*t1, *t2, ii[j - 2*n], ii[j], j, n, w, *temp);
    
-            ptr = ii[j - 2*n];
-            ii[j - 2*n] = *t1;
-            *t1 = ptr;
-            ptr = ii[j];
-            ii[j] = *t2;
-            *t2 = ptr;
-         }
+         ptr = ii[j - 2*n];
+         ii[j - 2*n] = *t1;
+         *t1 = ptr;
+         ptr = ii[j];
+         ii[j] = *t2;
+         *t2 = ptr;
+      }
+   } else
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         FFT_radix2_inverse_butterfly(*t1, *t2, ii[j - 2*n], ii[j], j, 2*n, w/2);
+   
+         ptr = ii[j - 2*n];
+         ii[j - 2*n] = *t1;
+         *t1 = ptr;
+         ptr = ii[j];
+         ii[j] = *t2;
+         *t2 = ptr;
       }
-
-      for (j = trunc + i - 2*n; j < 2*n; j+=n1)
-           mpn_add_n(ii[j - 2*n], ii[j - 2*n], ii[j - 2*n], size);
    }
+
+   for (j = trunc + i - 2*n; j < 2*n; j+=n1)
+        mpn_add_n(ii[j - 2*n], ii[j - 2*n], ii[j - 2*n], size);
 }
 
 void IFFT_radix2_mfa_truncate_sqrt2_combined(mp_limb_t ** ii, mp_limb_t ** jj, 
@@ -2972,8 +4127,6 @@ void IFFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w,
       // IFFT of length n2 on column i, applying z^{r*i} for rows going up in steps 
       // of 1 starting at row 0, where z => w bits
       IFFT_radix2_truncate_twiddle(ii + i, n1, n2/2, w*n1, t1, t2, temp, w, 0, i, 1, trunc);
-      for (j = 0; j < trunc; j++)
-         mpn_normmod_2expp1(ii[i + j], limbs);
    }
 
 }
@@ -3122,174 +4275,748 @@ mp_limb_t new_mpn_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2,
    return mpn_mulmod_2expp1(r, i1, i2, c, bits, tt);
 }
 
-mp_limb_t fft_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2, 
-                           mp_size_t n, mp_size_t w, mp_limb_t * tt)
+/*
+   Below this many limbs, products modulo B^k + 1 use the small 
+   negacyclic convolution of FFT_mulmod_2expp1 where k allows it, as its
+   few large pointwise products cost less than the many small butterflies
+   of the wrapped sqrt2 transform.
+*/
+#ifndef FFT_MULMOD_WRAP_LIMBS
+#define FFT_MULMOD_WRAP_LIMBS 2560
+#endif
+
+/*
+   Returns the depth of the small negacyclic convolution of 
+   FFT_mulmod_2expp1 for products modulo B^k + 1, or 0 if k is too small
+   or has too few factors of 2 for it. As for the pointwise 
+   products in fft_mulmod_2expp1, the convolution has about sqrt(bits)/8
+   coefficients, but each must be a whole number of limbs, so that 2n 
+   must divide k.
+*/
+static mp_bitcnt_t FFT_mulmod_Bexpp1_depth(mp_size_t k)
 {
-   mp_size_t bits = n*w;
-   mp_size_t limbs = bits/GMP_LIMB_BITS;
-   mp_bitcnt_t depth = 1;
+   mp_bitcnt_t depth = 0, v = 0;
 
-   mp_size_t n1, w1;
-   mp_bitcnt_t bits1;
+   if (k < 250)
+      return 0;
 
-   if (limbs < 250) 
+   while ((1UL<<(2*depth + 2)) <= k*GMP_LIMB_BITS) depth++;
+   depth = (depth > 4) ? depth - 4 : 0;
+
+   while (((k>>v) & 1) == 0) v++;
+   if (depth + 1 > v) depth = (v > 0) ? v - 1 : 0;
+
+   return (depth >= 2) ? depth : 0;
+}
+
+/*
+   Returns the smallest k' >= k for which products modulo B^k' + 1 and 
+   B^k' - 1 get the full benefit of the wrapped convolution, i.e. k 
+   rounded up to a multiple of 2^(depth - 4) for the depth 
+   FFT_mulmod_Bexp_params would like to use, so that 2^depth divides 16k'.
+*/
+mp_size_t mpn_mulmod_Bexp_fft_next_size(mp_size_t k)
+{
+   mp_bitcnt_t depth, w;
+   mp_size_t m;
+
+   if (k < 250 || FFT_mulmod_Bexp_params(&depth, &w, k, 0, 0) == 0.0)
+      return k;
+
+   m = (1L<<(depth - 4));
+
+   return ((k + m - 1)/m)*m;
+}
+
+/*
+   Set {r, k} to {a, n} modulo B^k - 1, adding the k limb chunks with 
+   end around carry.
+*/
+static void FFT_fold_Bexpm1(mp_limb_t * r, mp_limb_t * a, mp_size_t n, mp_size_t k)
+{
+   mp_limb_t cy = 0;
+
+   if (n <= k)
    {
-      mp_limb_t c = i1[limbs] + 2*i2[limbs];
-      return mpn_mulmod_2expp1(r, i1, i2, c, bits, tt);
+      MPN_COPY(r, a, n);
+      MPN_ZERO(r + n, k - n);
+      return;
    }
-   
-   while ((1UL<<(2*depth)) < bits) depth++;
-   depth--;
 
-   n1 = (1UL<<depth);
-   w1 = bits/(1UL<<(2*depth));
-
-   bits1 = (n1*w1)/2;
+   MPN_COPY(r, a, k);
+   for (a += k, n -= k; n > 0; a += k, n -= k)
+      cy += mpn_add(r, r, k, a, MIN(n, k));
    
-   depth -= 3;
-   w1 *= 64;
+   while (cy)
+      cy = mpn_add_1(r, r, k, cy);
+}
+
+/*
+   Set {r, k + 1} to {a, n} modulo B^k + 1, normalised, adding and 
+   subtracting the k limb chunks alternately.
+*/
+static void FFT_fold_Bexpp1(mp_limb_t * r, mp_limb_t * a, mp_size_t n, mp_size_t k)
+{
+   mp_limb_signed_t cy = 0;
+   mp_size_t j;
 
-   if (n > (1UL<<15) || (n == (1UL<<15) && w == 2))
+   if (n <= k)
    {
-      depth++;
-      w1/=4;
+      MPN_COPY(r, a, n);
+      MPN_ZERO(r + n, k + 1 - n);
+      return;
    }
 
-   if (n > (1UL<<17))
+   MPN_COPY(r, a, k);
+   for (j = 1, a += k, n -= k; n > 0; j++, a += k, n -= k)
    {
-      depth++;
-      w1/=4;
+      if (j & 1)
+         cy -= mpn_sub(r, r, k, a, MIN(n, k));
+      else
+         cy += mpn_add(r, r, k, a, MIN(n, k));
    }
 
-   FFT_mulmod_2expp1(r, i1, i2, bits/GMP_LIMB_BITS, depth, w1);
-
-   return 0;
+   r[k] = cy;
+   mpn_normmod_2expp1(r, k);
 }
 
 /*
-   The main integer multiplication routine. Multiplies i1 of n1 limbs by i2 of
-   n2 limbs and puts the result in r1, which must have space for n1 + n2 limbs.
-   
-   Currently there is no sqrt2 trick, thus a convolution of depth d gives a 
-   convolution length 2*n where n = 2^d with coefficients of size n*w, where 
-   w = w2^2. 
-
-   FIXME: there is no reason for w to be a square, nor for us to pass in w2. 
-   Just pass in w.
-
-   Note the *output* polynomial must fit in that convolution size. 
-   
-   The computation, bits1 = (n*w - depth)/2, gives the maximum size of input 
-   coefficients for a given n and w if you want the output to be meaningful.
-
-   The function automatically truncates the FFT, pointwise mults and IFFT, 
-   thus the inputs can be different lengths. The function will just segfault
-   if n and w2 are not sufficiently large. Except for the smallest multiplications
-   (where w2 should be 2), the value of w2 should probably always just be 1.
+   Set {r, k} to {a, k}*{b, k} modulo B^k - 1 (neg = 0), or {r, k + 1} 
+   to {a, k + 1}*{b, k + 1} modulo B^k + 1, normalised (neg = 1), where 
+   a and b are less than B^k. The integers are split into 4n coefficients
+   of bits1 = 16k/n bits, so that 2^(4n*bits1) = B^k, and a full length 
+   sqrt2 transform, which is a cyclic one of length 4n, gives the product
+   modulo B^k - 1 without computing the rest. For neg, coefficient i is 
+   first multiplied by 2^(iw/4), a 4n-th root of -1, which makes the 
+   convolution negacyclic, and the weights are removed afterwards. The 
+   depth and w are as chosen by FFT_mulmod_Bexp_params, so that 2^depth
+   divides 16k and, for neg, 4 divides w. r may be a or b.
 */
-void new_mpn_mul(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
-                 mp_bitcnt_t depth, mp_bitcnt_t w)
+static void FFT_mulmod_Bexp_wrap(mp_limb_t * r, mp_limb_t * a, mp_limb_t * b, 
+                    mp_size_t k, mp_bitcnt_t depth, mp_bitcnt_t w, int neg)
 {
    mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - depth)/2; 
    mp_size_t sqrt = (1UL<<(depth/2));
-
-   mp_size_t r_limbs = n1 + n2;
-   mp_size_t j1 = (n1*GMP_LIMB_BITS - 1)/bits1 + 1;
-   mp_size_t j2 = (n2*GMP_LIMB_BITS - 1)/bits1 + 1;
-   mp_size_t trunc = ((j1 + j2 - 2 + 2*sqrt)/(2*sqrt)) * 2*sqrt;
-   
+   mp_bitcnt_t bits1 = (16*k)/n;
    mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
    mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, t, u;
-
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
-   mp_limb_t c;
-   
+   mp_size_t ws_limbs = new_mpn_mul6_workspace(depth, w);
+   mp_size_t i, j, xn = k + size + 1; // the coefficients overhang B^k by under nw bits
+   mp_limb_t ** ii, ** jj, * ws, * ptr, * t1, * t2, * s1, * tt, * x, cy;
+   int sqr = (a == b);
    TMP_DECL;
 
    TMP_MARK;
+   x = TMP_BALLOC_LIMBS(xn);
+   ws = FFT_alloc_limbs(ws_limbs);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
-   {
+   ii = (mp_limb_t **) ws;
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
       ii[i] = ptr;
-   }
    t1 = ptr;
    t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
+   s1 = t2 + size;
    
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-   {
+   jj = (mp_limb_t **) (s1 + size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
       jj[i] = ptr;
+   tt = ptr;
+
+   j = FFT_split_bits(ii, a, k, bits1, limbs);
+   for ( ; j < 4*n; j++)
+      MPN_ZERO(ii[j], size);
+   for (j = 1; neg && j < 4*n; j++)
+   {
+      FFT_twiddle(t1, ii[j], j, 4*n, w/4);
+      ptr = ii[j];
+      ii[j] = t1;
+      t1 = ptr;
    }
-   u1 = ptr;
-   u2 = u1 + size;
-   s2 = (mp_limb_t **) u2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   j = FFT_split_bits(ii, i1, n1, bits1, limbs);
-   for ( ; j < trunc; j++)
-      MPN_ZERO(ii[j], limbs + 1);
-   FFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
-            
-   j = FFT_split_bits(jj, i2, n2, bits1, limbs);
-   for ( ; j < trunc; j++)
-      MPN_ZERO(jj[j], limbs + 1);
-   FFT_radix2_mfa_truncate(jj, n, w, &u1, &u2, s2, sqrt, trunc);
-    
-   for (s = 0; s < trunc/sqrt; s++)
+   FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, 4*n);
+
+   if (sqr)
+      jj = ii;
+   else
    {
-      u = mpir_revbin(s, (depth + 1)/2)*sqrt;
-      for (t = 0; t < sqrt; t++)
+      j = FFT_split_bits(jj, b, k, bits1, limbs);
+      for ( ; j < 4*n; j++)
+         MPN_ZERO(jj[j], size);
+      for (j = 1; neg && j < 4*n; j++)
       {
-         j = u + t; 
-         c = ii[j][limbs] + 2*jj[j][limbs];
-         ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
+         FFT_twiddle(t1, jj[j], j, 4*n, w/4);
+         ptr = jj[j];
+         jj[j] = t1;
+         t1 = ptr;
       }
+      FFT_radix2_mfa_truncate_sqrt2(jj, n, w, &t1, &t2, &s1, sqrt, 4*n);
    }
 
-   IFFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
-   for (j = 0; j < trunc; j++)
+   for (j = 0; j < 4*n; j++)
+      fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
+
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, 4*n);
+
+   // 2^(-jw/4) = 2^((8n - j)w/4), and the combine does the scaling
+   for (j = 1; neg && j < 4*n; j++)
    {
-      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
-      mpn_normmod_2expp1(ii[j], limbs);
+      FFT_twiddle(t1, ii[j], 8*n - j, 4*n, w/4);
+      ptr = ii[j];
+      ii[j] = t1;
+      t1 = ptr;
    }
-   MPN_ZERO(r1, r_limbs);
-   FFT_combine_bits(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs);
-      
-   TMP_FREE;
-}
-
-void new_mpn_mul2(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
-                 mp_bitcnt_t depth, mp_bitcnt_t w)
-{
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - (depth+1))/2; 
-   
-   mp_size_t r_limbs = n1 + n2;
-   mp_size_t j1 = (n1*GMP_LIMB_BITS - 1)/bits1 + 1;
-   mp_size_t j2 = (n2*GMP_LIMB_BITS - 1)/bits1 + 1;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, t, u;
 
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
-   mp_limb_t c;
-   
-   TMP_DECL;
+   MPN_ZERO(x, xn);
+   if (neg)
+      FFT_combine_bits_signed_scaled(x, ii, 4*n, bits1, limbs, xn, depth + 2);
+   else
+      FFT_combine_bits_scaled(x, ii, 4*n, bits1, limbs, xn, depth + 2);
 
-   TMP_MARK;
+   FFT_free_limbs(ws, ws_limbs);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   if (!neg)
    {
-      ii[i] = ptr;
+      FFT_fold_Bexpm1(r, x, xn, k);
+      TMP_FREE;
+      return;
+   }
+
+   // x = lo + B^k*hi, where hi is signed, is lo - hi modulo B^k + 1
+   MPN_COPY(r, x, k);
+   if ((mp_limb_signed_t) x[xn - 1] < 0)
+   {
+      mpn_neg_n(x + k, x + k, xn - k);
+      cy = mpn_add(r, r, k, x + k, xn - k);
+      r[k] = cy;
+   } else
+   {
+      cy = mpn_sub(r, r, k, x + k, xn - k);
+      r[k] = -cy;
+   }
+   mpn_normmod_2expp1(r, k);
+
+   TMP_FREE;
+}
+
+/*
+   Set {r, k + 1} to {a, k + 1}*{b, k + 1} modulo B^k + 1, where a and b
+   are normalised. The result is normalised. Small k use mpn_mulmod_2expp1
+   and k below FFT_MULMOD_WRAP_LIMBS the small negacyclic convolution of 
+   FFT_mulmod_2expp1 if k has enough factors of 2. Otherwise the 
+   negacyclic wrap of FFT_mulmod_Bexp_wrap is used if it is predicted to 
+   be faster than a full product, which is folded.
+*/
+static void FFT_mulmod_Bexpp1(mp_limb_t * r, mp_limb_t * a, mp_limb_t * b, mp_size_t k)
+{
+   mp_bitcnt_t depth = FFT_mulmod_Bexpp1_depth(k), w, depth2, w2;
+   mp_size_t n, m, bits1, nw;
+   mp_limb_t * tt;
+   double cycles;
+   TMP_DECL;
+
+   TMP_MARK;
+
+   if (k < 250)
+   {
+      tt = TMP_BALLOC_LIMBS(2*(k + 1));
+      r[k] = mpn_mulmod_2expp1(r, a, b, a[k] + 2*b[k], k*GMP_LIMB_BITS, tt);
+      TMP_FREE;
+      return;
+   }
+
+   if (a[k] || b[k])
+   {
+      fft_kernels.neg_n(r, a[k] ? b : a, k + 1);
+      mpn_normmod_2expp1(r, k);
+      TMP_FREE;
+      return;
+   }
+
+   if (k < FFT_MULMOD_WRAP_LIMBS && depth != 0)
+   {
+      // the coefficients of the negacyclic convolution have 2*bits1 + depth + 1
+      // bits and a sign, and the ring must be a whole number of limbs
+      n = (1L<<depth);
+      bits1 = (k*GMP_LIMB_BITS)/(2*n);
+      m = (n > GMP_LIMB_BITS) ? n : GMP_LIMB_BITS;
+      nw = ((2*bits1 + depth + 3 + m - 1)/m)*m;
+
+      FFT_mulmod_2expp1(r, a, b, k, depth, nw/n);
+      TMP_FREE;
+      return;
+   }
+
+   // below about 512 limbs the wrap is no faster than a full product
+   cycles = (k < 512) ? 0.0 : FFT_mulmod_Bexp_params(&depth, &w, k, 1, 1);
+   if (cycles != 0.0 && cycles <= FFT_mulmod_Bexp_params(&depth2, &w2, 2*k, 0, 0))
+      FFT_mulmod_Bexp_wrap(r, a, b, k, depth, w, 1);
+   else
+   {
+      tt = TMP_BALLOC_LIMBS(2*k);
+      new_mpn_mul_auto(tt, a, k, b, k);
+      FFT_fold_Bexpp1(r, tt, 2*k, k);
+   }
+
+   TMP_FREE;
+}
+
+/*
+   Set {r, limbs + 1} to {i1, limbs + 1}*{i2, limbs + 1} modulo 2^(nw) + 1,
+   where limbs = nw/GMP_LIMB_BITS, for the pointwise products of the 
+   transforms. The inputs may have signed carries in their top limbs, as
+   the transforms leave them, and are normalised in place first, while 
+   they are in cache anyway. r may be i1, and i2 may be i1. Large 
+   products use the negacyclic convolution of FFT_mulmod_Bexpp1, which 
+   chooses a convolution length that divides the number of limbs.
+*/
+mp_limb_t fft_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2, 
+                           mp_size_t n, mp_size_t w, mp_limb_t * tt)
+{
+   mp_size_t bits = n*w;
+   mp_size_t limbs = bits/GMP_LIMB_BITS;
+
+   mpn_normmod_2expp1(i1, limbs);
+   mpn_normmod_2expp1(i2, limbs);
+
+   FFT_COUNT_OP(FFT_OP_POINTWISE, 3*(limbs + 1));
+
+   if (limbs < 250) 
+   {
+      mp_limb_t c = i1[limbs] + 2*i2[limbs];
+      r[limbs] = mpn_mulmod_2expp1(r, i1, i2, c, bits, tt);
+      return r[limbs];
+   }
+   
+   FFT_mulmod_Bexpp1(r, i1, i2, limbs);
+
+   return r[limbs];
+}
+
+/*
+   Set {r, k} to {a, k}*{b, k} modulo B^k - 1, by the cyclic wrap of 
+   FFT_mulmod_Bexp_wrap if it is predicted to be faster than a full 
+   product, which is otherwise folded.
+*/
+static void FFT_mulmod_Bexpm1(mp_limb_t * r, mp_limb_t * a, mp_limb_t * b, mp_size_t k)
+{
+   mp_bitcnt_t depth, w, depth2, w2;
+   mp_limb_t * t;
+   double cycles;
+   TMP_DECL;
+
+   // below about 512 limbs the wrap is no faster than a full product
+   cycles = (k < 512) ? 0.0 : FFT_mulmod_Bexp_params(&depth, &w, k, 0, 1);
+   if (cycles != 0.0 && cycles <= FFT_mulmod_Bexp_params(&depth2, &w2, 2*k, 0, 0))
+   {
+      FFT_mulmod_Bexp_wrap(r, a, b, k, depth, w, 0);
+      return;
+   }
+
+   TMP_MARK;
+   t = TMP_BALLOC_LIMBS(2*k);
+   new_mpn_mul_auto(t, a, k, b, k);
+   FFT_fold_Bexpm1(r, t, 2*k, k);
+   TMP_FREE;
+}
+
+/*
+   Set {r, k + 1} to {i1, n1}*{i2, n2} modulo B^k + 1, normalised, i.e. 
+   r[k] is 1 only if the result is B^k. The operands may have any number 
+   of limbs, more than k being folded first, and r may not overlap them.
+*/
+void mpn_mulmod_Bexpp1_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                           mp_limb_t * i2, mp_size_t n2, mp_size_t k)
+{
+   mp_limb_t * a, * b;
+   TMP_DECL;
+
+   TMP_MARK;
+   a = TMP_BALLOC_LIMBS(k + 1);
+   b = TMP_BALLOC_LIMBS(k + 1);
+
+   FFT_fold_Bexpp1(a, i1, n1, k);
+   FFT_fold_Bexpp1(b, i2, n2, k);
+   FFT_mulmod_Bexpp1(r, a, b, k);
+
+   TMP_FREE;
+}
+
+/*
+   Set {r, k} to {i1, n1}*{i2, n2} modulo B^k - 1, in [0, B^k - 1). The 
+   operands may have any number of limbs, and r may not overlap them.
+*/
+void mpn_mulmod_Bexpm1_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                           mp_limb_t * i2, mp_size_t n2, mp_size_t k)
+{
+   mp_limb_t * a, * b;
+   mp_size_t j;
+   TMP_DECL;
+
+   TMP_MARK;
+   a = TMP_BALLOC_LIMBS(k);
+   b = TMP_BALLOC_LIMBS(k);
+
+   FFT_fold_Bexpm1(a, i1, n1, k);
+   FFT_fold_Bexpm1(b, i2, n2, k);
+   FFT_mulmod_Bexpm1(r, a, b, k);
+
+   // B^k - 1 is zero
+   for (j = 0; j < k && r[j] == ~CNST_LIMB(0); j++) ;
+   if (j == k)
+      MPN_ZERO(r, k);
+
+   TMP_FREE;
+}
+
+/*
+   Set {r, n1 - n2 + 1} to limbs n2 to n1 of {i1, n1}*{i2, n2}, for 
+   n1 >= n2 >= 1. This is the middle product needed by Newton iteration.
+   The product is taken modulo B^K - 1 for some K > n1 by the cyclic wrap
+   of FFT_mulmod_Bexp_wrap, so the top h = n1 + n2 - K limbs wrap around 
+   onto the bottom ones, which are not returned, and the transform has 
+   length about n1 rather than n1 + n2. The wrapped limbs are less than 
+   B^h, so they carry into limb n2 only if that leaves limbs h to n2 - 1 
+   of the result zero, and the result can only exceed B^K - 1 if limbs n2
+   to K - 1 are zero. In either case, or if the wrap is not predicted to 
+   be faster, the full product is used instead. r may not overlap the 
+   inputs.
+*/
+void mpn_mulmid_fft(mp_limb_t * r, mp_limb_t * i1, mp_size_t n1, 
+                                   mp_limb_t * i2, mp_size_t n2)
+{
+   mp_size_t k = mpn_mulmod_Bexp_fft_next_size(n1 + 1);
+   mp_size_t h = n1 + n2 - k, j, lo, hi;
+   mp_bitcnt_t depth, w, depth2, w2;
+   mp_limb_t * a, * b, * t;
+   double cycles;
+   TMP_DECL;
+
+   TMP_MARK;
+
+   cycles = (n1 < 512) ? 0.0 : FFT_mulmod_Bexp_params(&depth, &w, k, 0, 1);
+   if (h > 0 && cycles != 0.0 
+      && cycles <= FFT_mulmod_Bexp_params(&depth2, &w2, n1 + n2, 0, 0))
+   {
+      a = TMP_BALLOC_LIMBS(3*k);
+      b = a + k;
+      t = b + k;
+
+      MPN_COPY(a, i1, n1);
+      MPN_ZERO(a + n1, k - n1);
+      MPN_COPY(b, i2, n2);
+      MPN_ZERO(b + n2, k - n2);
+
+      FFT_mulmod_Bexp_wrap(t, a, b, k, depth, w, 0);
+
+      // B^k - 1 is also zero, so is ambiguous too
+      for (j = 0; j < k && t[j] == ~CNST_LIMB(0); j++) ;
+      for (lo = h; lo < n2 && t[lo] == 0; lo++) ;
+      for (hi = n2; hi < k && t[hi] == 0; hi++) ;
+
+      if (j != k && lo != n2 && hi != k)
+      {
+         MPN_COPY(r, t + n2, n1 - n2 + 1);
+         TMP_FREE;
+         return;
+      }
+   }
+
+   t = TMP_BALLOC_LIMBS(n1 + n2);
+   new_mpn_mul_auto(t, i1, n1, i2, n2);
+   MPN_COPY(r, t + n2, n1 - n2 + 1);
+
+   TMP_FREE;
+}
+
+#define FFT_HUGE_PAGE_BYTES (2*1024*1024)
+
+/*
+   The number of bytes FFT_alloc_limbs actually takes for a block of the
+   given number of limbs. Blocks smaller than a huge page come from malloc
+   and are not rounded up, as mapping a whole huge page for them costs 
+   more than the TLB misses it would save.
+*/
+static size_t FFT_alloc_bytes(mp_size_t limbs)
+{
+   size_t bytes = limbs*sizeof(mp_limb_t);
+
+   if (bytes < FFT_HUGE_PAGE_BYTES)
+      return bytes;
+
+   return (bytes + FFT_HUGE_PAGE_BYTES - 1) & ~((size_t) FFT_HUGE_PAGE_BYTES - 1);
+}
+
+/*
+   Returns a block of at least the given number of limbs for coefficient
+   data. Blocks of at least 2MiB are aligned to and rounded up to a whole
+   number of 2MiB huge pages. Explicit huge pages (MAP_HUGETLB) are tried 
+   first, and if none are available we fall back to ordinary pages with a
+   hint that they be merged into transparent huge pages. Either way, the 
+   column passes of the MFA, which touch a different 4KiB page for almost
+   every coefficient, cause far fewer TLB misses. Smaller blocks come from
+   malloc.
+*/
+mp_limb_t * FFT_alloc_limbs(mp_size_t limbs)
+{
+   size_t bytes = FFT_alloc_bytes(limbs);
+   size_t extra;
+   char * p = (char *) MAP_FAILED;
+   char * q;
+
+   if (bytes < FFT_HUGE_PAGE_BYTES)
+   {
+      q = (char *) malloc(bytes);
+      if (q == NULL && bytes != 0)
+      {
+         fprintf(stderr, "FFT: unable to allocate %ld limbs\n", limbs);
+         abort();
+      }
+      return (mp_limb_t *) q;
+   }
+
+#ifdef MAP_HUGETLB
+   p = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+   if (p != (char *) MAP_FAILED)
+      return (mp_limb_t *) p;
+
+   // over allocate so that we can trim to a huge page boundary
+   p = (char *) mmap(NULL, bytes + FFT_HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (p == (char *) MAP_FAILED)
+   {
+      fprintf(stderr, "FFT: unable to allocate %ld limbs\n", limbs);
+      abort();
+   }
+
+   q = (char *) (((size_t) p + FFT_HUGE_PAGE_BYTES - 1) & ~((size_t) FFT_HUGE_PAGE_BYTES - 1));
+   extra = q - p;
+   if (extra) munmap(p, extra);
+   munmap(q + bytes, FFT_HUGE_PAGE_BYTES - extra);
+
+#ifdef MADV_HUGEPAGE
+   madvise(q, bytes, MADV_HUGEPAGE);
+#endif
+
+   return (mp_limb_t *) q;
+}
+
+/*
+   As per FFT_alloc_limbs, but blocks of at least 2MiB are never backed by
+   huge pages, and are hinted not to be merged into transparent ones, so
+   that each 4KiB page is placed on the NUMA node of the thread which 
+   first touches it. A 2MiB page would put a whole run of coefficients, 
+   belonging to several threads, on a single node. Such blocks are still
+   rounded up as by FFT_alloc_limbs, so they are freed with FFT_free_limbs.
+*/
+mp_limb_t * FFT_alloc_limbs_local(mp_size_t limbs)
+{
+   size_t bytes = FFT_alloc_bytes(limbs);
+   char * p;
+
+   if (bytes < FFT_HUGE_PAGE_BYTES)
+      return FFT_alloc_limbs(limbs);
+
+   p = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (p == (char *) MAP_FAILED)
+   {
+      fprintf(stderr, "FFT: unable to allocate %ld limbs\n", limbs);
+      abort();
+   }
+
+#ifdef MADV_NOHUGEPAGE
+   madvise(p, bytes, MADV_NOHUGEPAGE);
+#endif
+
+   return (mp_limb_t *) p;
+}
+
+void FFT_free_limbs(mp_limb_t * p, mp_size_t limbs)
+{
+   size_t bytes = FFT_alloc_bytes(limbs);
+   
+   if (bytes < FFT_HUGE_PAGE_BYTES)
+      free(p);
+   else
+      munmap(p, bytes);
+}
+
+/*
+   Returns a block of the given number of limbs which is backed by an
+   unlinked temporary file in the directory dir, rather than by swap.
+   The file disappears as soon as the block is unmapped, or the process
+   exits. Aborts if the file cannot be created or mapped.
+*/
+mp_limb_t * FFT_mmap_limbs(mp_size_t limbs, const char * dir)
+{
+   size_t bytes = limbs*sizeof(mp_limb_t);
+   char * name = (char *) malloc(strlen(dir) + 16);
+   void * p = MAP_FAILED;
+   int fd;
+
+   sprintf(name, "%s/mul_fftXXXXXX", dir);
+   fd = mkstemp(name);
+   if (fd != -1)
+   {
+      unlink(name);
+      if (ftruncate(fd, bytes) == 0)
+         p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+   }
+   
+   if (p == MAP_FAILED)
+   {
+      fprintf(stderr, "FFT: unable to map %ld limbs in %s\n", limbs, dir);
+      abort();
+   }
+
+   free(name);
+   return (mp_limb_t *) p;
+}
+
+void FFT_munmap_limbs(mp_limb_t * p, mp_size_t limbs)
+{
+   munmap(p, limbs*sizeof(mp_limb_t));
+}
+
+/*
+   Gives the pages of a mapped block back to the system without writing
+   them out. The contents of the block are lost.
+*/
+void FFT_discard_limbs(mp_limb_t * p, mp_size_t limbs)
+{
+#ifdef MADV_REMOVE
+   madvise(p, limbs*sizeof(mp_limb_t), MADV_REMOVE);
+#endif
+}
+
+/*
+   The main integer multiplication routine. Multiplies i1 of n1 limbs by i2 of
+   n2 limbs and puts the result in r1, which must have space for n1 + n2 limbs.
+   
+   Currently there is no sqrt2 trick, thus a convolution of depth d gives a 
+   convolution length 2*n where n = 2^d with coefficients of size n*w, where 
+   w = w2^2. 
+
+   FIXME: there is no reason for w to be a square, nor for us to pass in w2. 
+   Just pass in w.
+
+   Note the *output* polynomial must fit in that convolution size. 
+   
+   The computation, bits1 = (n*w - depth)/2, gives the maximum size of input 
+   coefficients for a given n and w if you want the output to be meaningful.
+
+   The function automatically truncates the FFT, pointwise mults and IFFT, 
+   thus the inputs can be different lengths. The function will just segfault
+   if n and w2 are not sufficiently large. Except for the smallest multiplications
+   (where w2 should be 2), the value of w2 should probably always just be 1.
+*/
+void new_mpn_mul(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - depth)/2; 
+   mp_size_t sqrt = (1UL<<(depth/2));
+
+   mp_size_t r_limbs = n1 + n2;
+   mp_size_t j1 = (n1*GMP_LIMB_BITS - 1)/bits1 + 1;
+   mp_size_t j2 = (n2*GMP_LIMB_BITS - 1)/bits1 + 1;
+   mp_size_t trunc = ((j1 + j2 - 2 + 2*sqrt)/(2*sqrt)) * 2*sqrt;
+   
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, t, u;
+
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
+   mp_limb_t c;
+   
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+   
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+   }
+   u1 = ptr;
+   u2 = u1 + size;
+   s2 = (mp_limb_t **) u2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   j = FFT_split_bits(ii, i1, n1, bits1, limbs);
+   for ( ; j < trunc; j++)
+      MPN_ZERO(ii[j], limbs + 1);
+   FFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
+            
+   j = FFT_split_bits(jj, i2, n2, bits1, limbs);
+   for ( ; j < trunc; j++)
+      MPN_ZERO(jj[j], limbs + 1);
+   FFT_radix2_mfa_truncate(jj, n, w, &u1, &u2, s2, sqrt, trunc);
+    
+   for (s = 0; s < trunc/sqrt; s++)
+   {
+      u = mpir_revbin(s, (depth + 1)/2)*sqrt;
+      for (t = 0; t < sqrt; t++)
+      {
+         j = u + t; 
+         mpn_normmod_2expp1(ii[j], limbs);
+         mpn_normmod_2expp1(jj[j], limbs);
+         c = ii[j][limbs] + 2*jj[j][limbs];
+         ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
+      }
+   }
+
+   IFFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
+   for (j = 0; j < trunc; j++)
+   {
+      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
+      mpn_normmod_2expp1(ii[j], limbs);
+   }
+   MPN_ZERO(r1, r_limbs);
+   FFT_combine_bits(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs);
+      
+   TMP_FREE;
+}
+
+void new_mpn_mul2(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth+1))/2; 
+   
+   mp_size_t r_limbs = n1 + n2;
+   mp_size_t j1 = (n1*GMP_LIMB_BITS - 1)/bits1 + 1;
+   mp_size_t j2 = (n2*GMP_LIMB_BITS - 1)/bits1 + 1;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, t, u;
+
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
+   mp_limb_t c;
+   
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
    }
    t1 = ptr;
    t2 = t1 + size;
@@ -3535,2113 +5262,2884 @@ void new_mpn_mul5(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2,
    j1 = FFT_split_bits(ii, i1, n1, bits1, limbs);
    for (j = j1 ; j < 2*n; j++)
       MPN_ZERO(ii[j], limbs + 1);
-   
-   FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
-    
-   j2 = FFT_split_bits(jj, i2, n2, bits1, limbs);
-   for (j = j2 ; j < 2*n; j++)
-      MPN_ZERO(jj[j], limbs + 1);
-   FFT_radix2_truncate(jj, 1, jj, n, w, &t1, &t2, &s1, trunc);      
+   
+   FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
+    
+   j2 = FFT_split_bits(jj, i2, n2, bits1, limbs);
+   for (j = j2 ; j < 2*n; j++)
+      MPN_ZERO(jj[j], limbs + 1);
+   FFT_radix2_truncate(jj, 1, jj, n, w, &t1, &t2, &s1, trunc);      
+
+   {
+      int k;
+      for (k = 0; k < 20; k++)
+         if (mpn_fft_next_size (limbs, k) == limbs) break;
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_normmod_2expp1(ii[j], limbs);
+         mpn_normmod_2expp1(jj[j], limbs);
+         c = ii[j][limbs] + 2*jj[j][limbs];
+         ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
+         //ii[j][limbs] = mpn_mul_fft_aux (ii[j], limbs, ii[j], limbs, jj[j], limbs, k + 4, 1);
+      }
+   }
+
+   IFFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
+   for (j = 0; j < trunc; j++)
+   {
+      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
+      mpn_normmod_2expp1(ii[j], limbs);
+   }
+   
+   MPN_ZERO(r1, r_limbs);
+   FFT_combine_bits(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs);
+     
+   TMP_FREE;
+}
+
+/*
+   Sets depth and w to the smallest transform length 4n = 2^(depth+2) 
+   and then the smallest w for which new_mpn_mul6 can multiply integers
+   of n1 and n2 limbs, i.e. for which the number of coefficients of the 
+   product is more than 2n, so that the truncated sqrt2 transform is 
+   needed, but no more than 4n. Returns 0 if the integers are too small
+   for new_mpn_mul6 to be used at all.
+*/
+int FFT_mul6_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, 
+                                          mp_size_t n1, mp_size_t n2)
+{
+   mp_size_t n, j1, j2;
+   mp_bitcnt_t bits1;
+
+   for (*depth = 6; *depth < GMP_LIMB_BITS - 2; (*depth)++)
+   {
+      n = (1UL<<*depth);
+      for (*w = 1; *w <= GMP_LIMB_BITS; (*w)++)
+      {
+         bits1 = FFT_MUL6_BITS1(n, *w, *depth);
+         j1 = FFT_MUL6_COEFFS(n1, bits1, *depth);
+         j2 = FFT_MUL6_COEFFS(n2, bits1, *depth);
+         if (j1 + j2 - 1 <= 2*n) break;
+         if (j1 + j2 - 1 <= 4*n) return 1;
+      }
+      if (*w == 1) return 0; /* too small even with w = 1 */
+   }
+
+   return 0;
+}
+
+/*
+   Returns the number of limbs of workspace new_mpn_mul6_ws needs for the
+   given depth and w.
+*/
+mp_size_t new_mpn_mul6_workspace(mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_size_t size = (n*w)/GMP_LIMB_BITS + 1;
+
+   return 8*(n + n*size) + 5*size;
+}
+
+/*
+   As per new_mpn_mul6, but using the workspace ws of at least 
+   new_mpn_mul6_workspace(depth, w) limbs, so that it can be allocated
+   once for many multiplications. If i1 == i2 and n1 == n2 the integer
+   is squared, with only one forward transform.
+*/
+void new_mpn_mul6_ws(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w, mp_limb_t * ws)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth); 
+   
+   mp_size_t j1 = FFT_MUL6_COEFFS(n1, bits1, depth);
+   mp_size_t j2 = FFT_MUL6_COEFFS(n2, bits1, depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   
+   mp_size_t size = limbs + 1;
+   mp_size_t r_limbs = n1 + n2;
+   mp_size_t i, j, s, t, u, trunc;
+
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *s1;
+   mp_limb_t c;
+   int sqr = (i1 == i2 && n1 == n2);
+   FFT_PHASE_DECL;
+   
+   ii = (mp_limb_t **) ws;
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+   
+   jj = (mp_limb_t **) (s1 + size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+   }
+   
+   tt = ptr;
+   
+   trunc = MAX(2*((j1 + j2)/2), 2*n + 2); /* trunc must be even and exceed 2n */
+
+   FFT_PHASE_START;
+   j1 = FFT_mul6_split(ii, i1, n1, bits1, limbs, depth);
+   for (j = j1; j < 4*n; j++)
+      MPN_ZERO(ii[j], limbs + 1);
+   FFT_PHASE_END(FFT_PHASE_SPLIT);
+   
+   FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+    
+   if (sqr)
+   {
+      j2 = j1;
+      jj = ii;
+   } else
+   {
+      FFT_PHASE_START;
+      j2 = FFT_mul6_split(jj, i2, n2, bits1, limbs, depth);
+      for (j = j2; j < 4*n; j++)
+         MPN_ZERO(jj[j], limbs + 1);
+      FFT_PHASE_END(FFT_PHASE_SPLIT);
+      FFT_radix2_mfa_truncate_sqrt2(jj, n, w, &t1, &t2, &s1, sqrt, trunc);      
+   }
+
+   {
+      int k = mpn_fft_best_k(limbs, 0);
+      mp_size_t depth2 = depth - (depth/2);
+      mp_size_t t, u;
+      FFT_PHASE_START;
+      for (j = 0; j < 2*n; j++)
+      {
+         //c = ii[j][limbs] + 2*jj[j][limbs];
+         //ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
+         //ii[j][limbs] = mpn_mul_fft_aux(ii[j], limbs, ii[j], limbs, jj[j], limbs, k, 1);
+         fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
+      }
+      for (j = 0; j*sqrt < trunc - 2*n; j++)
+      {
+         mp_size_t s = mpir_revbin(j, depth2 +1);
+         for (t = 0; t < sqrt && j*sqrt + t < trunc - 2*n; t++)
+         {
+            u = 2*n + s*sqrt+t;
+            //c = ii[s][limbs] + 2*jj[s][limbs];
+            //ii[s][limbs] = new_mpn_mulmod_2expp1(ii[s], ii[s], jj[s], c, n*w, tt);
+            //ii[u][limbs] = mpn_mul_fft_aux(ii[u], limbs, ii[u], limbs, jj[u], limbs, k, 1);
+            fft_mulmod_2expp1(ii[u], ii[u], jj[u], n, w, tt);
+         }
+      }
+      FFT_PHASE_END(FFT_PHASE_POINTWISE);
+   }
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+   
+   //IFFT_radix2_mfa_truncate_sqrt2_combined(ii, jj, n, w, &t1, &t2, &s1, sqrt, trunc, tt);
+   // the scaling is done by the combine
+   FFT_PHASE_START;
+   MPN_ZERO(r1, r_limbs);
+   FFT_mul6_combine(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs, depth, depth + 2);
+   FFT_PHASE_END(FFT_PHASE_COMBINE);
+}
+
+void new_mpn_mul6(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t ws_limbs = new_mpn_mul6_workspace(depth, w);
+   mp_limb_t * ws = FFT_alloc_limbs(ws_limbs);
+
+   new_mpn_mul6_ws(r1, i1, n1, i2, n2, depth, w, ws);
+
+   FFT_free_limbs(ws, ws_limbs);
+}
+
+/*
+   Chooses the depth and w of the transforms and the chunk length m for 
+   new_mpn_mul_unbalanced, trying transforms for chunks of a few times n2
+   limbs and making each chunk as long as its transform allows. Returns 
+   the predicted cycles for the whole product, as per fft_mul_estimate, 
+   or 0 if i2 is too small for new_mpn_mul6.
+*/
+double FFT_mul_unbalanced_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, 
+                   mp_size_t * m, mp_size_t n1, mp_size_t n2)
+{
+   fft_mul_plan_t plan;
+   mp_size_t n, j2, mc, r;
+   mp_bitcnt_t bits1;
+   double cycles, best = 0.0;
+
+   for (r = 1; r <= 16; r *= 2)
+   {
+      if (!fft_mul_estimate(r*n2, n2, &plan))
+         continue;
+
+      // the longest chunk whose product with i2 has at most 4n coefficients
+      n = (1UL<<plan.depth);
+      bits1 = FFT_MUL6_BITS1(n, plan.w, plan.depth);
+      j2 = FFT_MUL6_COEFFS(n2, bits1, plan.depth);
+      mc = ((4*n - j2 + !FFT_MUL6_SIGNED(plan.depth))*bits1)/GMP_LIMB_BITS;
+      
+      // the chunks fill the transform, and one of the three transforms 
+      // is shared by all of them
+      cycles = (2.0/3.0)*plan.cycles*((4.0*n)/plan.trunc)*((n1 + mc - 1)/mc + 0.5);
+      if (best == 0.0 || cycles < best)
+      {
+         best = cycles;
+         *depth = plan.depth;
+         *w = plan.w;
+         *m = mc;
+      }
+   }
+
+   return best;
+}
+
+/*
+   Prepares pre for multiplying integers of at most m limbs by {i2, n2},
+   with transforms of the given depth and w, which must allow a product 
+   of m by n2 limbs: i2 is split and transformed once, into the second 
+   half of a workspace of new_mpn_mul6_workspace(depth, w) limbs, the 
+   first half being used for the other operand of each product.
+*/
+void FFT_mul_precomp_init_params(fft_mul_precomp_t * pre, mp_limb_t * i2, 
+         mp_size_t n2, mp_size_t m, mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, j1;
+   mp_limb_t * ptr;
+   FFT_PHASE_DECL;
+
+   pre->i2 = i2;
+   pre->n2 = n2;
+   pre->m = m;
+   pre->depth = depth;
+   pre->w = w;
+
+   j1 = FFT_MUL6_COEFFS(m, bits1, depth);
+   pre->j2 = FFT_MUL6_COEFFS(n2, bits1, depth);
+   pre->trunc = MAX(2*((j1 + pre->j2)/2), 2*n + 2);
+
+   pre->ws_limbs = new_mpn_mul6_workspace(depth, w);
+   pre->ws = FFT_alloc_limbs(pre->ws_limbs);
+
+   pre->ii = (mp_limb_t **) pre->ws;
+   for (i = 0, ptr = (mp_limb_t *) pre->ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      pre->ii[i] = ptr;
+   }
+   pre->t1 = ptr;
+   pre->t2 = pre->t1 + size;
+   pre->s1 = pre->t2 + size;
+   
+   pre->jj = (mp_limb_t **) (pre->s1 + size);
+   for (i = 0, ptr = (mp_limb_t *) pre->jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      pre->jj[i] = ptr;
+   }
+   pre->tt = ptr;
+
+   FFT_PHASE_START;
+   pre->j2 = FFT_mul6_split(pre->jj, i2, n2, bits1, limbs, depth);
+   for (j = pre->j2; j < 4*n; j++)
+      MPN_ZERO(pre->jj[j], limbs + 1);
+   FFT_PHASE_END(FFT_PHASE_SPLIT);
+   FFT_radix2_mfa_truncate_sqrt2(pre->jj, n, w, &pre->t1, &pre->t2, &pre->s1, sqrt, pre->trunc);
+}
+
+/*
+   Prepares pre for multiplying integers of at most m limbs by {i2, n2}, 
+   with the parameters fft_mul_estimate chooses for an m by n2 product.
+   i2 must not be changed or freed while pre is in use, as it is still 
+   used directly if the integers are too small for the FFT. The same 
+   value can then be multiplied by many others, as in a subproduct tree,
+   for two transforms per product instead of three.
+*/
+void fft_mul_precomp_init(fft_mul_precomp_t * pre, mp_limb_t * i2, 
+                                        mp_size_t n2, mp_size_t m)
+{
+   fft_mul_plan_t plan;
+   
+   if (fft_mul_estimate(MAX(m, n2), MIN(m, n2), &plan))
+      FFT_mul_precomp_init_params(pre, i2, n2, m, plan.depth, plan.w);
+   else
+   {
+      pre->i2 = i2;
+      pre->n2 = n2;
+      pre->m = m;
+      pre->ws = NULL;
+      pre->ws_limbs = 0;
+   }
+}
+
+void fft_mul_precomp_clear(fft_mul_precomp_t * pre)
+{
+   if (pre->ws != NULL)
+      FFT_free_limbs(pre->ws, pre->ws_limbs);
+}
+
+/*
+   Sets {r1, n1 + n2} to the product of {i1, n1}, where n1 <= m, and the 
+   integer pre was prepared with. Only i1 is transformed. As the first 
+   half of the workspace in pre is overwritten, one pre can only be used
+   by one thread at a time. r1 may not overlap i1.
+*/
+void fft_mul_precomp(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                        fft_mul_precomp_t * pre)
+{
+   mp_bitcnt_t depth = pre->depth, w = pre->w;
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t trunc = pre->trunc;
+   mp_size_t depth2 = depth - (depth/2);
+   mp_size_t j, j1, s, t, u;
+   mp_limb_t ** ii = pre->ii, ** jj = pre->jj;
+   FFT_PHASE_DECL;
+
+   if (pre->ws == NULL)
+   {
+      if (n1 >= pre->n2)
+         mpn_mul(r1, i1, n1, pre->i2, pre->n2);
+      else
+         mpn_mul(r1, pre->i2, pre->n2, i1, n1);
+      return;
+   }
+
+   FFT_PHASE_START;
+   j1 = FFT_mul6_split(ii, i1, n1, bits1, limbs, depth);
+   for (j = j1; j < 4*n; j++)
+      MPN_ZERO(ii[j], limbs + 1);
+   FFT_PHASE_END(FFT_PHASE_SPLIT);
+   FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &pre->t1, &pre->t2, &pre->s1, sqrt, trunc);
+
+   // the transform of i2 is only normalised in place the first time
+   FFT_PHASE_START;
+   for (j = 0; j < 2*n; j++)
+   {
+      fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, pre->tt);
+   }
+   for (j = 0; j*sqrt < trunc - 2*n; j++)
+   {
+      s = mpir_revbin(j, depth2 + 1);
+      for (t = 0; t < sqrt && j*sqrt + t < trunc - 2*n; t++)
+      {
+         u = 2*n + s*sqrt + t;
+         fft_mulmod_2expp1(ii[u], ii[u], jj[u], n, w, pre->tt);
+      }
+   }
+   FFT_PHASE_END(FFT_PHASE_POINTWISE);
+
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &pre->t1, &pre->t2, &pre->s1, sqrt, trunc);
+
+   FFT_PHASE_START;
+   MPN_ZERO(r1, n1 + pre->n2);
+   FFT_mul6_combine(r1, ii, j1 + pre->j2 - 1, bits1, limbs, n1 + pre->n2, depth, depth + 2);
+   FFT_PHASE_END(FFT_PHASE_COMBINE);
+}
+
+/*
+   Sets {r1, n1 + n2} to the product of {i1, n1} and {i2, n2}, where n1 
+   may be many times n2. Rather than padding both operands to a transform
+   of length j1 + j2, i2 is transformed once, with fft_mul_precomp, and 
+   i1 is multiplied by it in chunks of m limbs, with the parameters 
+   chosen by FFT_mul_unbalanced_params. Each chunk's product is added 
+   into r1 at its offset, overlapping the last n2 limbs of the previous 
+   one. r1 may not overlap the inputs.
+*/
+void new_mpn_mul_unbalanced(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                          mp_limb_t * i2, mp_size_t n2)
+{
+   fft_mul_precomp_t pre;
+   mp_bitcnt_t depth, w;
+   mp_size_t m, mc, off;
+   mp_limb_t * pr, cy;
+   TMP_DECL;
+
+   if (FFT_mul_unbalanced_params(&depth, &w, &m, n1, n2) == 0.0 || n1 <= m)
+   {
+      new_mpn_mul_auto(r1, i1, n1, i2, n2);
+      return;
+   }
+
+   FFT_mul_precomp_init_params(&pre, i2, n2, m, depth, w);
+
+   TMP_MARK;
+   pr = TMP_BALLOC_LIMBS(m + n2);
+
+   for (off = 0; off < n1; off += m)
+   {
+      mc = MIN(m, n1 - off);
+
+      fft_mul_precomp(pr, i1 + off, mc, &pre);
+      
+      if (off == 0)
+         MPN_COPY(r1, pr, mc + n2);
+      else
+      {
+         cy = mpn_add_n(r1 + off, r1 + off, pr, n2);
+         MPN_COPY(r1 + off + n2, pr + n2, mc);
+         if (cy)
+            mpn_add_1(r1 + off + n2, r1 + off + n2, mc, cy);
+      }
+   }
+
+   TMP_FREE;
+   fft_mul_precomp_clear(&pre);
+}
+
+/*
+   As per new_mpn_mul6, but the second operand is transformed one half
+   at a time into an array of only 2n coefficients, the coefficients
+   being extracted from i2 as they are needed. The pointwise products
+   for each half are done as soon as it has been transformed. This uses
+   roughly 3/4 of the memory of new_mpn_mul6 at the cost of extracting
+   each coefficient of i2 twice.
+*/
+void new_mpn_mul6_lowmem(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1,
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth);
+
+   mp_size_t r_limbs = n1 + n2;
+   mp_size_t j1 = FFT_MUL6_COEFFS(n1, bits1, depth);
+   mp_size_t j2 = FFT_MUL6_COEFFS(n2, bits1, depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, t, u, trunc;
+   mp_size_t depth2 = depth - (depth/2);
+
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *s1;
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) FFT_alloc_limbs(4*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size)
+   {
+      ii[i] = ptr;
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   jj = (mp_limb_t **) FFT_alloc_limbs(2*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size)
+   {
+      jj[i] = ptr;
+   }
+
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+
+   trunc = MAX(2*((j1 + j2)/2), 2*n + 2); /* trunc must be even and exceed 2n */
+
+   j1 = FFT_mul6_split(ii, i1, n1, bits1, limbs, depth);
+   for (j = j1; j < 4*n; j++)
+      MPN_ZERO(ii[j], limbs + 1);
 
+   FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+
+   /* first half of the transform of i2 and the pointwise products */
+   FFT_radix2_mfa_truncate_sqrt2_half(jj, 0, i2, n2, bits1, n, w, &t1, &t2, &s1, sqrt, trunc);
+   for (j = 0; j < 2*n; j++)
    {
-      int k;
-      for (k = 0; k < 20; k++)
-         if (mpn_fft_next_size (limbs, k) == limbs) break;
-      for (j = 0; j < trunc; j++)
-      {
-         mpn_normmod_2expp1(ii[j], limbs);
-         mpn_normmod_2expp1(jj[j], limbs);
-         c = ii[j][limbs] + 2*jj[j][limbs];
-         ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
-         //ii[j][limbs] = mpn_mul_fft_aux (ii[j], limbs, ii[j], limbs, jj[j], limbs, k + 4, 1);
-      }
+      fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
    }
 
-   IFFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
-   for (j = 0; j < trunc; j++)
+   /* second half, overwriting the first */
+   FFT_radix2_mfa_truncate_sqrt2_half(jj, 1, i2, n2, bits1, n, w, &t1, &t2, &s1, sqrt, trunc);
+   for (j = 0; j*sqrt < trunc - 2*n; j++)
    {
-      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
-      mpn_normmod_2expp1(ii[j], limbs);
+      s = mpir_revbin(j, depth2 + 1);
+      for (t = 0; t < sqrt && j*sqrt + t < trunc - 2*n; t++)
+      {
+         u = s*sqrt + t;
+         fft_mulmod_2expp1(ii[2*n + u], ii[2*n + u], jj[u], n, w, tt);
+      }
    }
-   
+
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+
    MPN_ZERO(r1, r_limbs);
-   FFT_combine_bits(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs);
-     
+   FFT_mul6_combine(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs, depth, depth + 2);
+
+   FFT_free_limbs((mp_limb_t *) jj, 2*(n + n*size));
+   FFT_free_limbs((mp_limb_t *) ii, 4*(n + n*size) + 3*size);
+
    TMP_FREE;
 }
 
-void new_mpn_mul6(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
-                 mp_bitcnt_t depth, mp_bitcnt_t w)
+
+/*
+   As per new_mpn_mul6, but the coefficients of both operands are stored
+   in files in the directory dir which are mapped into memory, so that 
+   the only limit on the size of the product is disk space. Only the 
+   pointer arrays and the temporaries are kept in RAM.
+
+   Every column pass and every row pass of the matrix Fourier algorithm 
+   touches each coefficient once, and between them the passes only touch 
+   one column or one row at a time. So long as a column of 4n/sqrt 
+   coefficients fits in RAM, each pass reads and writes the file once.
+   The pointwise products stream through both files in the order the row
+   passes left them and the second file is discarded before the inverse
+   transform, so that its pages do not compete with those of the first.
+*/
+void new_mpn_mul6_mmap(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, 
+                 const char * dir)
 {
    mp_size_t n = (1UL<<depth);
    mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t bits1 = (n*w - (depth+1))/2; 
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth); 
    
    mp_size_t r_limbs = n1 + n2;
-   mp_size_t j1 = (n1*GMP_LIMB_BITS - 1)/bits1 + 1;
-   mp_size_t j2 = (n2*GMP_LIMB_BITS - 1)/bits1 + 1;
+   mp_size_t j1 = FFT_MUL6_COEFFS(n1, bits1, depth);
+   mp_size_t j2 = FFT_MUL6_COEFFS(n2, bits1, depth);
    mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
    
    mp_size_t size = limbs + 1;
    mp_size_t i, j, s, t, u, trunc;
+   mp_size_t depth2 = depth - (depth/2);
 
-   mp_limb_t * ptr;
+   mp_limb_t * ptr, * idata, * jdata;
    mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *s1;
-   mp_limb_t c;
    
    TMP_DECL;
 
    TMP_MARK;
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   idata = FFT_mmap_limbs(4*n*size, dir);
+   jdata = FFT_mmap_limbs(4*n*size, dir);
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 3*size);
+   for (i = 0, ptr = idata; i < 4*n; i++, ptr += size) 
    {
       ii[i] = ptr;
    }
-   t1 = ptr;
+   t1 = (mp_limb_t *) ii + 4*n;
    t2 = t1 + size;
    s1 = t2 + size;
    
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n);
+   for (i = 0, ptr = jdata; i < 4*n; i++, ptr += size) 
    {
       jj[i] = ptr;
    }
    
    tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
    
-   trunc = 2*sqrt*((j1 + j2 + 2*sqrt - 2)/(2*sqrt)); /* trunc must be divisible by sqrt */
+   trunc = MAX(2*((j1 + j2)/2), 2*n + 2); /* trunc must be even and exceed 2n */
 
-   j1 = FFT_split_bits(ii, i1, n1, bits1, limbs);
+   j1 = FFT_mul6_split(ii, i1, n1, bits1, limbs, depth);
    for (j = j1; j < 4*n; j++)
       MPN_ZERO(ii[j], limbs + 1);
    
    FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
     
-   j2 = FFT_split_bits(jj, i2, n2, bits1, limbs);
+   j2 = FFT_mul6_split(jj, i2, n2, bits1, limbs, depth);
    for (j = j2; j < 4*n; j++)
       MPN_ZERO(jj[j], limbs + 1);
+   
    FFT_radix2_mfa_truncate_sqrt2(jj, n, w, &t1, &t2, &s1, sqrt, trunc);      
 
+   for (j = 0; j < 2*n; j++)
    {
-      int k = mpn_fft_best_k(limbs, 0);
-      mp_size_t trunc2 = (trunc - 2*n)/sqrt;
-      mp_size_t depth2 = depth - (depth/2);
-      mp_size_t t, u;
-      for (j = 0; j < 2*n; j++)
-      {
-         mpn_normmod_2expp1(ii[j], limbs);
-         mpn_normmod_2expp1(jj[j], limbs);
-         //c = ii[j][limbs] + 2*jj[j][limbs];
-         //ii[j][limbs] = new_mpn_mulmod_2expp1(ii[j], ii[j], jj[j], c, n*w, tt);
-         //ii[j][limbs] = mpn_mul_fft_aux(ii[j], limbs, ii[j], limbs, jj[j], limbs, k, 1);
-         fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
-      }
-      for (j = 0; j < trunc2; j++)
+      fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
+   }
+   for (j = 0; j*sqrt < trunc - 2*n; j++)
+   {
+      s = mpir_revbin(j, depth2 + 1);
+      for (t = 0; t < sqrt && j*sqrt + t < trunc - 2*n; t++)
       {
-         mp_size_t s = mpir_revbin(j, depth2 +1);
-         for (t = 0; t < sqrt; t++)
-         {
-            u = 2*n + s*sqrt+t;
-            mpn_normmod_2expp1(ii[u], limbs);
-            mpn_normmod_2expp1(jj[u], limbs);
-            //c = ii[s][limbs] + 2*jj[s][limbs];
-            //ii[s][limbs] = new_mpn_mulmod_2expp1(ii[s], ii[s], jj[s], c, n*w, tt);
-            //ii[u][limbs] = mpn_mul_fft_aux(ii[u], limbs, ii[u], limbs, jj[u], limbs, k, 1);
-            fft_mulmod_2expp1(ii[u], ii[u], jj[u], n, w, tt);
-         }
+         u = 2*n + s*sqrt + t;
+         fft_mulmod_2expp1(ii[u], ii[u], jj[u], n, w, tt);
       }
    }
-   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
    
-   //IFFT_radix2_mfa_truncate_sqrt2_combined(ii, jj, n, w, &t1, &t2, &s1, sqrt, trunc, tt);
-   for (j = 0; j < trunc; j++)
-   {
-      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 2);
-      mpn_normmod_2expp1(ii[j], limbs);
-   }
+   /* 
+      the contents of jj are no longer needed, though the temporaries may 
+      now point into it, so it must stay mapped until the end
+   */
+   FFT_discard_limbs(jdata, 4*n*size);
+
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
    
    MPN_ZERO(r1, r_limbs);
-   FFT_combine_bits(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs);
+   FFT_mul6_combine(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs, depth, depth + 2);
      
+   FFT_munmap_limbs(jdata, 4*n*size);
+   FFT_munmap_limbs(idata, 4*n*size);
+
    TMP_FREE;
 }
 
+#if FFT_THREADS
 
-/************************************************************************************
+#define FFT_DEQUE_SIZE 4096 /* must be a power of 2 */
 
-   Test code
+#ifndef FFT_TASK_LIMBS
+#define FFT_TASK_LIMBS 32768 /* transforms on fewer limbs are not split */
+#endif
 
-************************************************************************************/
+typedef struct fft_task_s fft_task_t;
+typedef struct fft_worker_s fft_worker_t;
 
-void mpn_to_mpz(mpz_t m, mp_limb_t * i, mp_size_t limbs)
+/*
+   A task for the work stealing scheduler. The fields after pending are 
+   the arguments of the transform being spawned, or for tasks of the 
+   multiplication, c is the row or column to work on.
+*/
+struct fft_task_s
 {
-   mp_limb_signed_t hi;
-   
-   mpz_realloc(m, limbs + 1);
-   MPN_COPY(m->_mp_d, i, limbs + 1);
-   hi = i[limbs];
-   if (hi < 0L)
-   {
-      mpn_neg_n(m->_mp_d, m->_mp_d, limbs + 1);
-      m->_mp_size = limbs + 1;
-      while ((m->_mp_size) && (!m->_mp_d[m->_mp_size - 1])) 
-         m->_mp_size--;
-      m->_mp_size = -m->_mp_size;
-   } else
-   {
-      m->_mp_size = limbs + 1;
-      while ((m->_mp_size) && (!m->_mp_d[m->_mp_size - 1])) 
-         m->_mp_size--;
-   }
-}
+   void (*fn)(fft_worker_t *, fft_task_t *);
+   long * pending; /* decremented when the task has been run */
+   mp_limb_t ** ii;
+   mp_size_t is, n, ws, r, c, rs;
+   mp_bitcnt_t w;
+};
 
-void ref_norm(mpz_t m, mpz_t p)
+/*
+   Each worker has its own deque of tasks, which it pushes and takes from
+   at the bottom, and which other workers steal from at the top (the 
+   Chase-Lev deque). There are no locks. Each worker also has its own 
+   temporaries, which are swapped into the coefficients by the 
+   butterflies of any task it runs.
+*/
+struct fft_worker_s
 {
-   mpz_mod(m, m, p);
-}
+   fft_worker_t * workers; /* all the workers, to steal from */
+   int thread, threads;
+   unsigned long seed;
+   mp_limb_t * t1, * t2, * temp, * tt;
+   void * data;
+   long top, bottom;
+   fft_task_t * deque[FFT_DEQUE_SIZE];
+};
 
-void ref_submod_i(mpz_t m, mpz_t i1, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w)
+/*
+   Pushes the task onto the bottom of the deque of the given worker, 
+   which must be the calling thread's. Returns 0 if the deque is full.
+*/
+int FFT_task_push(fft_worker_t * wk, fft_task_t * task)
 {
-   mpz_sub(m, i1, i2);
-   mpz_mul_2exp(m, m, (n*w)/2);
-   mpz_mod(m, m, p);
-}
+   long b = __atomic_load_n(&wk->bottom, __ATOMIC_RELAXED);
+   long t = __atomic_load_n(&wk->top, __ATOMIC_ACQUIRE);
 
-void ref_mul_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d)
-{
-   mpz_mul_2exp(m, i2, d);
-   mpz_mod(m, m, p);
-}
+   if (b - t >= FFT_DEQUE_SIZE) return 0;
 
-void ref_div_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d)
-{
-   mpz_t temp;
-   mpz_init(temp);
-   mpz_set_ui(temp, 1);
-   mpz_mul_2exp(temp, temp, d);
-   mpz_invert(temp, temp, p);
-   mpz_mul(m, i2, temp);
-   mpz_mod(m, m, p);
-   mpz_clear(temp);
+   __atomic_store_n(&wk->deque[b & (FFT_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED);
+   __atomic_store_n(&wk->bottom, b + 1, __ATOMIC_RELEASE);
+
+   return 1;
 }
 
-void ref_lshB_sumdiffmod(mpz_t t, mpz_t u, mpz_t i1, 
-                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y)
+/*
+   Takes the most recently pushed task from the bottom of the deque of 
+   the calling thread's worker, or returns NULL if it is empty.
+*/
+fft_task_t * FFT_task_take(fft_worker_t * wk)
 {
-   mpz_add(t, i1, i2);
-   mpz_sub(u, i1, i2);
-   mpz_mul_2exp(t, t, x*GMP_LIMB_BITS);
-   mpz_mul_2exp(u, u, y*GMP_LIMB_BITS);
-   mpz_mod(t, t, p);
-   mpz_mod(u, u, p);
+   long b = __atomic_load_n(&wk->bottom, __ATOMIC_RELAXED) - 1;
+   long t;
+   fft_task_t * task = NULL;
+
+   __atomic_store_n(&wk->bottom, b, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   t = __atomic_load_n(&wk->top, __ATOMIC_RELAXED);
+
+   if (t <= b)
+   {
+      task = __atomic_load_n(&wk->deque[b & (FFT_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+      if (t == b) // last task, race against thieves for it
+      {
+         if (!__atomic_compare_exchange_n(&wk->top, &t, t + 1, 0, 
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+         __atomic_store_n(&wk->bottom, b + 1, __ATOMIC_RELAXED);
+      }
+   } else
+      __atomic_store_n(&wk->bottom, b + 1, __ATOMIC_RELAXED);
+
+   return task;
 }
 
-void ref_sumdiff_rshBmod(mpz_t t, mpz_t u, mpz_t i1, 
-                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y)
+/*
+   Steals the oldest task from the top of the deque of another worker. 
+   Returns NULL if the deque is empty or another thread got there first.
+*/
+fft_task_t * FFT_task_steal(fft_worker_t * wk)
 {
-   mpz_t mult1, mult2;
-   mpz_init(mult1);
-   mpz_init(mult2);
-   mpz_set_ui(mult1, 1);
-   mpz_mul_2exp(mult1, mult1, x*GMP_LIMB_BITS);
-   mpz_invert(mult1, mult1, p);
-   mpz_set_ui(mult2, 1);
-   mpz_mul_2exp(mult2, mult2, y*GMP_LIMB_BITS);
-   mpz_invert(mult2, mult2, p);
-   mpz_mul(mult1, mult1, i1);
-   mpz_mul(mult2, mult2, i2);
-   mpz_add(t, mult1, mult2);
-   mpz_sub(u, mult1, mult2);
-   mpz_mod(t, t, p);
-   mpz_mod(u, u, p);
-   mpz_clear(mult1);
-   mpz_clear(mult2);
+   long t = __atomic_load_n(&wk->top, __ATOMIC_ACQUIRE);
+   long b;
+   fft_task_t * task = NULL;
+
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   b = __atomic_load_n(&wk->bottom, __ATOMIC_ACQUIRE);
+
+   if (t < b)
+   {
+      task = __atomic_load_n(&wk->deque[t & (FFT_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+      if (!__atomic_compare_exchange_n(&wk->top, &t, t + 1, 0, 
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+         return NULL;
+   }
+
+   return task;
 }
 
-/* set p = 2^wn + 1 */
-void set_p(mpz_t p, mp_size_t n, mp_bitcnt_t w)
+void FFT_task_run(fft_worker_t * wk, fft_task_t * task)
 {
-   mpz_set_ui(p, 1);
-   mpz_mul_2exp(p, p, n*w);
-   mpz_add_ui(p, p, 1);
+   task->fn(wk, task);
+   __atomic_sub_fetch(task->pending, 1, __ATOMIC_RELEASE);
 }
 
-void rand_n(mp_limb_t * n, gmp_randstate_t state, mp_size_t limbs)
+/*
+   Makes the task available to be run by any worker. The counter pending
+   must already include the task. If the deque is full the task is 
+   simply run straight away.
+*/
+void FFT_task_spawn(fft_worker_t * wk, fft_task_t * task, long * pending)
 {
-   mpn_rrandom(n, state, limbs);
-   n[limbs] = gmp_urandomm_ui(state, 10);
-   if (gmp_urandomm_ui(state, 2)) n[limbs] = -n[limbs];
+   task->pending = pending;
+   if (!FFT_task_push(wk, task))
+      FFT_task_run(wk, task);
 }
 
-void test_norm()
+/*
+   Waits until pending reaches zero, running tasks from our own deque 
+   and, once that is empty, tasks stolen from other workers chosen at 
+   random.
+*/
+void FFT_task_sync(fft_worker_t * wk, long * pending)
 {
-   mp_size_t i, j, k, l, n, w, limbs;
-   mpz_t p, m, m2;
-   mpz_init(p);
-   mpz_init(m);
-   mpz_init(m2);
-   mp_limb_t * nn;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
+   fft_task_t * task;
+   int victim;
 
-   for (i = GMP_LIMB_BITS; i < 32*GMP_LIMB_BITS; i += GMP_LIMB_BITS)
+   while (__atomic_load_n(pending, __ATOMIC_ACQUIRE) > 0)
    {
-      for (j = 1; j < 32; j++)
+      task = FFT_task_take(wk);
+      if (task == NULL && wk->threads > 1)
       {
-         for (k = 1; k <= GMP_NUMB_BITS; k <<= 1)
-         {
-            n = i/k;
-            w = j*k;
-            limbs = (n*w)/GMP_LIMB_BITS;
-            TMP_MARK;
-            nn = TMP_BALLOC_LIMBS(limbs + 1);
-            mpn_rrandom(nn, state, limbs + 1);
-            mpn_to_mpz(m, nn, limbs);
-            set_p(p, n, w);
-            
-            mpn_normmod_2expp1(nn, limbs);
-            mpn_to_mpz(m2, nn, limbs);
-            ref_norm(m, p);
-
-            if (mpz_cmp(m, m2) != 0)
-            {
-               printf("mpn_normmod_2expp1 error\n");
-               gmp_printf("want %Zx\n\n", m);
-               gmp_printf("got  %Zx\n", m2);
-               abort();
-            }
-            TMP_FREE;
-         }
+         wk->seed = wk->seed*1103515245UL + 12345UL;
+         victim = (wk->seed>>16) % (wk->threads - 1);
+         if (victim >= wk->thread) victim++;
+         task = FFT_task_steal(wk->workers + victim);
       }
+      
+      if (task != NULL)
+         FFT_task_run(wk, task);
+      else
+         sched_yield();
    }
-   mpz_clear(p);
-   mpz_clear(m);
-   mpz_clear(m2);
-   gmp_randclear(state);
 }
 
-void test_mul_2expmod()
-{
-   mp_size_t i, j, k, l, n, w, limbs, d;
-   mpz_t p, m, m2, mn1, mn2;
-   mpz_init(p);
-   mpz_init(m);
-   mpz_init(m2);
-   mpz_init(mn1);
-   mp_limb_t * nn1, * r;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
+/*
+   As per FFT_radix2_twiddle, but the two half length transforms are 
+   done as separate tasks, and the temporaries are those of the worker.
+*/
+void FFT_radix2_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs);
 
-   for (i = 2*GMP_LIMB_BITS; i < 64*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
-   {
-      for (j = 1; j < 32; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            for (d = 0; d < GMP_LIMB_BITS; d++)
-            {
-               n = i/k;
-               w = j*k;
-               limbs = (n*w)/GMP_LIMB_BITS;
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-               mpn_to_mpz(mn1, nn1, limbs);
-               set_p(p, n, w);
-               
-               mpn_mul_2expmod_2expp1(r, nn1, limbs, d);
-               mpn_to_mpz(m2, r, limbs);
-               ref_norm(m2, p);
-               ref_mul_2expmod(m, mn1, p, n, w, d);
-               
-               if (mpz_cmp(m, m2) != 0)
-               {
-                  printf("mpn_mul_2expmod_2expp1 error\n");
-                  gmp_printf("want %Zx\n\n", m);
-                  gmp_printf("got  %Zx\n", m2);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
-   }
-   mpz_clear(p);
-   mpz_clear(m);
-   mpz_clear(m2);
-   mpz_clear(mn1);
-   gmp_randclear(state);
+void FFT_radix2_twiddle_task(fft_worker_t * wk, fft_task_t * task)
+{
+   FFT_radix2_twiddle_par(wk, task->ii, task->is, task->n, task->w, 
+                          task->ws, task->r, task->c, task->rs);
 }
 
-void test_FFT_negacyclic_twiddle()
+void FFT_radix2_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs)
 {
-   mp_size_t i, j, k, l, n, w, limbs, d;
-   mpz_t p, m, m2, mn1, mn2;
-   mpz_init(p);
-   mpz_init(m);
-   mpz_init(m2);
-   mpz_init(mn1);
-   mp_limb_t * nn1, * r;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
-
-   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   mp_limb_t * ptr;
+   mp_size_t i;
+   mp_size_t size = (w*n)/GMP_LIMB_BITS + 1;
+   fft_task_t task;
+   long pending = 1;
+   
+   if (n == 1 || 2*n*size < FFT_TASK_LIMBS)
    {
-      for (j = 1; j < 10; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            n = i/k;
-            w = 2*j*k;
-            for (d = 0; d < 2*n; d++)
-            {
-               limbs = (n*w)/GMP_LIMB_BITS;
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-               mpn_to_mpz(mn1, nn1, limbs);
-               set_p(p, n, w);
-               
-               if (!FFT_negacyclic_twiddle(r, nn1, d, n, w))
-                  MPN_COPY(r, nn1, limbs + 1);
-               mpn_to_mpz(m2, r, limbs);
-               ref_norm(m2, p);
-               ref_mul_2expmod(m, mn1, p, n, w, d*w/2);
-               
-               if (mpz_cmp(m, m2) != 0)
-               {
-                  printf("FFT_negacyclic_twiddle error\n");
-                  gmp_printf("want %Zx\n\n", m);
-                  gmp_printf("got  %Zx\n", m2);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
+      FFT_radix2_twiddle(ii, is, n, w, &wk->t1, &wk->t2, &wk->temp, ws, r, c, rs);
+      return;
    }
 
-   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
-   {
-      for (j = 1; j < 10; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            n = i/k;
-            w = 2*j*k;
-            for (d = 0; d < 2*n; d++)
-            {
-               limbs = (n*w)/GMP_LIMB_BITS;
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-               mpn_to_mpz(mn1, nn1, limbs);
-               set_p(p, n, w);
-               
-               if (!FFT_negacyclic_twiddle(r, nn1, 4*n - d, n, w))
-                  MPN_COPY(r, nn1, limbs + 1);
-               mpn_to_mpz(m2, r, limbs);
-               ref_norm(m2, p);
-               ref_div_2expmod(m, mn1, p, n, w, d*w/2);
-               
-               if (mpz_cmp(m, m2) != 0)
-               {
-                  printf("FFT_negacyclic_twiddle error\n");
-                  gmp_printf("want %Zx\n\n", m);
-                  gmp_printf("got  %Zx\n", m2);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
+   for (i = 0; i < n; i++) 
+   {   
+      FFT_radix2_butterfly(wk->t1, wk->t2, ii[i*is], ii[(n+i)*is], i, n, w);
+   
+      ptr = ii[i*is];
+      ii[i*is] = wk->t1;
+      wk->t1 = ptr;
+      ptr = ii[(n+i)*is];
+      ii[(n+i)*is] = wk->t2;
+      wk->t2 = ptr;
    }
-   mpz_clear(p);
-   mpz_clear(m);
-   mpz_clear(m2);
-   mpz_clear(mn1);
-   gmp_randclear(state);
+
+   task.fn = FFT_radix2_twiddle_task;
+   task.ii = ii;
+   task.is = is;
+   task.n = n/2;
+   task.w = 2*w;
+   task.ws = ws;
+   task.r = r;
+   task.c = c;
+   task.rs = 2*rs;
+   FFT_task_spawn(wk, &task, &pending);
+   
+   FFT_radix2_twiddle_par(wk, ii + n*is, is, n/2, 2*w, ws, r + rs, c, 2*rs);
+
+   FFT_task_sync(wk, &pending);
 }
 
-void test_div_2expmod()
+/*
+   As per FFT_radix2_truncate1_twiddle, but with the untruncated half of
+   the transform done as a separate task, so that whichever worker is 
+   free picks it up, however unequal the halves are.
+*/
+void FFT_radix2_truncate1_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, 
+      mp_size_t trunc)
 {
-   mp_size_t i, j, k, l, n, w, limbs, d;
-   mpz_t p, m, m2, mn1, mn2;
-   mpz_init(p);
-   mpz_init(m);
-   mpz_init(m2);
-   mpz_init(mn1);
-   mp_limb_t * nn1, * r;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
-
-   for (i = 2*GMP_LIMB_BITS; i < 64*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   mp_limb_t * ptr;
+   mp_size_t i;
+   mp_size_t size = (w*n)/GMP_LIMB_BITS + 1;
+   fft_task_t task;
+   long pending = 1;
+   
+   if (trunc == 2*n)
    {
-      for (j = 1; j < 32; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            for (d = 0; d < GMP_LIMB_BITS; d++)
-            {
-               n = i/k;
-               w = j*k;
-               limbs = (n*w)/GMP_LIMB_BITS;
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-            
-               mpn_to_mpz(mn1, nn1, limbs);
-               set_p(p, n, w);
-            
-               mpn_div_2expmod_2expp1(r, nn1, limbs, d);
-               mpn_to_mpz(m2, r, limbs);
-               ref_norm(m2, p);
-               ref_norm(mn1, p);
-               ref_mul_2expmod(m, m2, p, n, w, d);
-
-               if (mpz_cmp(m, mn1) != 0)
-               {
-                  printf("mpn_div_2expmod_2expp1 error\n");
-                  gmp_printf("want %Zx\n\n", mn1);
-                  gmp_printf("got  %Zx\n", m);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
+      FFT_radix2_twiddle_par(wk, ii, is, n, w, ws, r, c, rs);
+      return;
    }
-   mpz_clear(p);
-   mpz_clear(m);
-   mpz_clear(m2);
-   mpz_clear(mn1);
-   gmp_randclear(state);
-}
-
-void test_lshB_sumdiffmod()
-{
-   mp_size_t c, i, j, k, l, x, y, n, w, limbs;
-   mpz_t p, ma, mb, m2a, m2b, mn1, mn2;
-   mpz_init(p);
-   mpz_init(ma);
-   mpz_init(mb);
-   mpz_init(m2a);
-   mpz_init(m2b);
-   mpz_init(mn1);
-   mpz_init(mn2);
-   mp_limb_t * nn1, * nn2, * r1, * r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
 
-   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   if (n == 1 || 2*n*size < FFT_TASK_LIMBS)
    {
-      for (j = 1; j < 10; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            n = i/k;
-            w = j*k;
-            limbs = (n*w)/GMP_LIMB_BITS;
-            for (c = 0; c < limbs; c++)
-            {
-               x = gmp_urandomm_ui(state, limbs + 1);
-               y = gmp_urandomm_ui(state, limbs + 1);
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               nn2 = TMP_BALLOC_LIMBS(limbs + 1);
-               r1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r2 = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-               rand_n(nn2, state, limbs);
-            
-               mpn_to_mpz(mn1, nn1, limbs);
-               mpn_to_mpz(mn2, nn2, limbs);
-               set_p(p, n, w);
-            
-               mpn_lshB_sumdiffmod_2expp1(r1, r2, nn1, nn2, limbs, x, y);
-               mpn_to_mpz(m2a, r1, limbs);
-               mpn_to_mpz(m2b, r2, limbs);
-               ref_norm(m2a, p);
-               ref_norm(m2b, p);
-               ref_lshB_sumdiffmod(ma, mb, mn1, mn2, p, n, w, x, y);
-
-               if (mpz_cmp(ma, m2a) != 0)
-               {
-                  printf("mpn_lshB_sumdiffmod_2expp1 error a\n");
-                  printf("x = %ld, y = %ld\n", x, y);
-                  gmp_printf("want %Zx\n\n", ma);
-                  gmp_printf("got  %Zx\n", m2a);
-                  abort();
-               }
-               if (mpz_cmp(mb, m2b) != 0)
-               {
-                  printf("mpn_lshB_sumdiffmod_2expp1 error b\n");
-                  printf("x = %ld, y = %ld\n", x, y);
-                  gmp_printf("want %Zx\n\n", mb);
-                  gmp_printf("got  %Zx\n", m2b);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
+      FFT_radix2_truncate1_twiddle(ii, is, n, w, &wk->t1, &wk->t2, &wk->temp, 
+                                                         ws, r, c, rs, trunc);
+      return;
    }
-   mpz_clear(p);
-   mpz_clear(ma);
-   mpz_clear(mb);
-   mpz_clear(m2a);
-   mpz_clear(m2b);
-   mpz_clear(mn1);
-   mpz_clear(mn2);
-   gmp_randclear(state);
-}
-
-void test_sumdiff_rshBmod()
-{
-   mp_size_t c, i, j, k, l, x, y, n, w, limbs;
-   mpz_t p, ma, mb, m2a, m2b, mn1, mn2;
-   mpz_init(p);
-   mpz_init(ma);
-   mpz_init(mb);
-   mpz_init(m2a);
-   mpz_init(m2b);
-   mpz_init(mn1);
-   mpz_init(mn2);
-   mp_limb_t * nn1, * nn2, * r1, * r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-   TMP_DECL;
 
-   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   if (trunc <= n)
    {
-      for (j = 1; j < 10; j++)
-      {
-         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
-         {
-            n = i/k;
-            w = j*k;
-            limbs = (n*w)/GMP_LIMB_BITS;
-            for (c = 0; c < limbs; c++)
-            {
-               x = gmp_urandomm_ui(state, limbs);
-               y = gmp_urandomm_ui(state, limbs);
-               TMP_MARK;
-               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
-               nn2 = TMP_BALLOC_LIMBS(limbs + 1);
-               r1 = TMP_BALLOC_LIMBS(limbs + 1);
-               r2 = TMP_BALLOC_LIMBS(limbs + 1);
-               rand_n(nn1, state, limbs);
-               rand_n(nn2, state, limbs);
-            
-               mpn_to_mpz(mn1, nn1, limbs);
-               mpn_to_mpz(mn2, nn2, limbs);
-               set_p(p, n, w);
-            
-               mpn_sumdiff_rshBmod_2expp1(r1, r2, nn1, nn2, limbs, x, y);
-               mpn_to_mpz(m2a, r1, limbs);
-               mpn_to_mpz(m2b, r2, limbs);
-               ref_norm(m2a, p);
-               ref_norm(m2b, p);
-               ref_sumdiff_rshBmod(ma, mb, mn1, mn2, p, n, w, x, y);
-
-               if (mpz_cmp(ma, m2a) != 0)
-               {
-                  printf("mpn_sumdiff_rshBmod_2expp1 error a\n");
-                  printf("x = %ld, y = %ld, limbs = %ld\n", x, y, limbs);
-                  gmp_printf("want %Zx\n\n", ma);
-                  gmp_printf("got  %Zx\n", m2a);
-                  abort();
-               }
-               if (mpz_cmp(mb, m2b) != 0)
-               {
-                  printf("mpn_sumdiff_rshBmod_2expp1 error b\n");
-                  printf("x = %ld, y = %ld, limbs = %ld\n", x, y, limbs);
-                  gmp_printf("want %Zx\n\n", mb);
-                  gmp_printf("got  %Zx\n", m2b);
-                  abort();
-               }
-               TMP_FREE;
-            }
-         }
-      }
+      for (i = 0; i < n; i++)
+         mpn_add_n(ii[i*is], ii[i*is], ii[(i+n)*is], size);
+      
+      FFT_radix2_truncate1_twiddle_par(wk, ii, is, n/2, 2*w, ws, r, c, 2*rs, trunc);
+      return;
+   }
+
+   for (i = 0; i < n; i++) 
+   {   
+      FFT_radix2_butterfly(wk->t1, wk->t2, ii[i*is], ii[(n+i)*is], i, n, w);
+   
+      ptr = ii[i*is];
+      ii[i*is] = wk->t1;
+      wk->t1 = ptr;
+      ptr = ii[(n+i)*is];
+      ii[(n+i)*is] = wk->t2;
+      wk->t2 = ptr;
    }
-   mpz_clear(p);
-   mpz_clear(ma);
-   mpz_clear(mb);
-   mpz_clear(m2a);
-   mpz_clear(m2b);
-   mpz_clear(mn1);
-   mpz_clear(mn2);
-   gmp_randclear(state);
+
+   task.fn = FFT_radix2_twiddle_task;
+   task.ii = ii;
+   task.is = is;
+   task.n = n/2;
+   task.w = 2*w;
+   task.ws = ws;
+   task.r = r;
+   task.c = c;
+   task.rs = 2*rs;
+   FFT_task_spawn(wk, &task, &pending);
+   
+   FFT_radix2_truncate1_twiddle_par(wk, ii + n*is, is, n/2, 2*w, ws, r + rs, c, 2*rs, trunc - n);
+
+   FFT_task_sync(wk, &pending);
 }
 
-void time_mul_with_negacyclic()
+/*
+   As per IFFT_radix2_twiddle, but the two half length transforms are 
+   done as separate tasks, and the temporaries are those of the worker.
+*/
+void IFFT_radix2_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs);
+
+void IFFT_radix2_twiddle_task(fft_worker_t * wk, fft_task_t * task)
 {
-   mp_bitcnt_t depth = 17UL;
-   mp_bitcnt_t w = 1UL;
-   mp_size_t iters = 1;
+   IFFT_radix2_twiddle_par(wk, task->ii, task->is, task->n, task->w, 
+                           task->ws, task->r, task->c, task->rs);
+}
 
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - depth)/2; 
-   mp_bitcnt_t bits = n*bits1;
-   mp_size_t int_limbs = (bits - 1UL)/GMP_LIMB_BITS + 1;
+void IFFT_radix2_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs)
+{
+   mp_limb_t * ptr;
+   mp_size_t i;
+   mp_size_t size = (w*n)/GMP_LIMB_BITS + 1;
+   fft_task_t task;
+   long pending = 1;
    
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   if (n == 1 || 2*n*size < FFT_TASK_LIMBS)
+   {
+      IFFT_radix2_twiddle(ii, is, n, w, &wk->t1, &wk->t2, &wk->temp, ws, r, c, rs);
+      return;
+   }
 
-   TMP_DECL;
+   task.fn = IFFT_radix2_twiddle_task;
+   task.ii = ii;
+   task.is = is;
+   task.n = n/2;
+   task.w = 2*w;
+   task.ws = ws;
+   task.r = r;
+   task.c = c;
+   task.rs = 2*rs;
+   FFT_task_spawn(wk, &task, &pending);
+   
+   IFFT_radix2_twiddle_par(wk, ii + n*is, is, n/2, 2*w, ws, r + rs, c, 2*rs);
 
-   TMP_MARK;
+   FFT_task_sync(wk, &pending);
 
-   i1 = TMP_BALLOC_LIMBS(4*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
+   for (i = 0; i < n; i++) 
+   {   
+      FFT_radix2_inverse_butterfly(wk->t1, wk->t2, ii[i*is], ii[(n+i)*is], i, n, w);
    
-   mpn_urandomb(i1, state, bits);
-   mpn_urandomb(i2, state, bits);
-  
-   for (i = 0; i < iters; i++)
-   {
-      new_mpn_mul(r1, i1, int_limbs, i2, int_limbs, depth, w);
+      ptr = ii[i*is];
+      ii[i*is] = wk->t1;
+      wk->t1 = ptr;
+      ptr = ii[(n+i)*is];
+      ii[(n+i)*is] = wk->t2;
+      wk->t2 = ptr;
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
 }
 
-void test_mulmod()
+/*
+   As per IFFT_radix2_truncate1_twiddle, but using the task based 
+   IFFT_radix2_twiddle_par for the untruncated half. Here the halves 
+   cannot be done at the same time, as the second depends on the first.
+*/
+void IFFT_radix2_truncate1_twiddle_par(fft_worker_t * wk, mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, 
+      mp_size_t trunc)
 {
-   mp_bitcnt_t depth = 15UL; //should be at least 6 
-   mp_bitcnt_t w = 1UL; /* should be 1 or a power of 2 */
-   mp_size_t iters = 10000;
-
-   mp_size_t n = (1UL<<depth);
-   
-   mp_bitcnt_t bits = n*w;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_limb_t * ptr;
+   mp_size_t i;
+   mp_size_t size = (w*n)/GMP_LIMB_BITS + 1;
    
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2, *tt;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-
-   TMP_DECL;
+   if (trunc == 2*n)
+   {
+      IFFT_radix2_twiddle_par(wk, ii, is, n, w, ws, r, c, rs);
+      return;
+   }
 
-   TMP_MARK;
+   if (n == 1 || 2*n*size < FFT_TASK_LIMBS)
+   {
+      IFFT_radix2_truncate1_twiddle(ii, is, n, w, &wk->t1, &wk->t2, &wk->temp, 
+                                                          ws, r, c, rs, trunc);
+      return;
+   }
 
-   i1 = TMP_BALLOC_LIMBS(6*(int_limbs+1));
-   i2 = i1 + int_limbs + 1;
-   r1 = i2 + int_limbs + 1;
-   r2 = r1 + int_limbs + 1;
-   tt = r2 + int_limbs + 1;
-   
-   for (i = 0; i < iters; i++)
+   if (trunc <= n)
    {
-      mpn_rrandom(i1, state, int_limbs);
-      i1[int_limbs] = CNST_LIMB(0);
-      mpn_rrandom(i2, state, int_limbs);
-      i2[int_limbs] = CNST_LIMB(0);
-      mpn_mulmod_2expp1(r2, i1, i2, 0, bits, tt);
-      fft_mulmod_2expp1(r1, i1, i2, n, w, tt);
-      
-      mp_size_t wrong = 0;
-      for (j = 0; j < int_limbs; j++)
+      for (i = trunc; i < n; i++)
       {
-         if (r1[j] != r2[j]) 
-         {
-            if (wrong < 10) 
-               printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
-            wrong++;
-         } 
+         mpn_add_n(ii[i*is], ii[i*is], ii[(i+n)*is], size);
+         mpn_div_2expmod_2expp1(ii[i*is], ii[i*is], size - 1, 1);
       }
-      if (wrong) printf("%ld limbs wrong\n", wrong);
-   }
       
-   TMP_FREE;
-   gmp_randclear(state);
-}
+      IFFT_radix2_truncate1_twiddle_par(wk, ii, is, n/2, 2*w, ws, r, c, 2*rs, trunc);
 
-void test_fft_ifft()
-{
-   mp_bitcnt_t depth = 10UL;
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 1;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+      for (i = 0; i < trunc; i++)
+         mpn_addsub_n(ii[i*is], ii[i*is], ii[i*is], ii[(n+i)*is], size);
 
-   TMP_DECL;
+      return;
+   }
 
-   TMP_MARK;
+   IFFT_radix2_twiddle_par(wk, ii, is, n/2, 2*w, ws, r, c, 2*rs);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   for (i = trunc - n; i < n; i++)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
+      mpn_sub_n(ii[(i+n)*is], ii[i*is], ii[(i+n)*is], size);
+      FFT_twiddle(wk->t1, ii[(i+n)*is], i, n, w);
+      mpn_add_n(ii[i*is], ii[i*is], ii[(i+n)*is], size);
+      ptr = ii[(i+n)*is];
+      ii[(i+n)*is] = wk->t1;
+      wk->t1 = ptr;
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = t2 + size;
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+   IFFT_radix2_truncate1_twiddle_par(wk, ii + n*is, is, n/2, 2*w, ws, r + rs, c, 2*rs, trunc - n);
 
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   for (i = 0; i < trunc - n; i++) 
+   {   
+      FFT_radix2_inverse_butterfly(wk->t1, wk->t2, ii[i*is], ii[(n+i)*is], i, n, w);
    
-   for (i = 0; i < 1; i++)
+      ptr = ii[i*is];
+      ii[i*is] = wk->t1;
+      wk->t1 = ptr;
+      ptr = ii[(n+i)*is];
+      ii[(n+i)*is] = wk->t2;
+      wk->t2 = ptr;
+   }
+}
+
+/*
+   As per FFT_radix2_mfa_truncate_sqrt2_column, but the column FFTs of the
+   two halves are done as tasks.
+*/
+void FFT_radix2_mfa_truncate_sqrt2_column_par(fft_worker_t * wk, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_size_t n1, mp_size_t trunc, mp_size_t i)
+{
+   mp_size_t j;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_limb_t * ptr;
+   fft_task_t task;
+   long pending = 1;
+
+   /* first row of FFT */
+   if ((w & 1) == 1)
    {
-      FFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
-      
-      IFFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
-      for (j = 0; j < 2*n; j++)
-      {
-         mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
-         mpn_normmod_2expp1(ii[j], limbs);
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         if ((j & 1) == 0)
+            FFT_radix2_butterfly(wk->t1, wk->t2, ii[j], ii[2*n+j], j/2, n, w);
+         else
+            FFT_radix2_butterfly_sqrt2(wk->t1, wk->t2, ii[j], ii[2*n+j], j, n, w, wk->temp);
+
+         ptr = ii[j];
+         ii[j] = wk->t1;
+         wk->t1 = ptr;
+         ptr = ii[2*n+j];
+         ii[2*n+j] = wk->t2;
+         wk->t2 = ptr;
       }
 
-      for (j = 0; j < 2*n; j++)
+      for ( ; j < 2*n; j+=n1)
       {
-         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
-         {
-            printf("Error in entry %ld\n", j);
-            abort();
-         }
+          if ((i & 1) == 0)
+             FFT_twiddle(ii[j + 2*n], ii[j], j/2, n, w); 
+          else
+             FFT_twiddle_sqrt2(ii[j + 2*n], ii[j], j, n, w, wk->temp); 
       }
+   } else
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         FFT_radix2_butterfly(wk->t1, wk->t2, ii[j], ii[2*n+j], j, 2*n, w/2);
+
+         ptr = ii[j];
+         ii[j] = wk->t1;
+         wk->t1 = ptr;
+         ptr = ii[2*n+j];
+         ii[2*n+j] = wk->t2;
+         wk->t2 = ptr;
+      }
+
+      for ( ; j < 2*n; j+=n1)
+         FFT_twiddle(ii[j + 2*n], ii[j], j, 2*n, w/2);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   /* column FFT of the first half as a task, the second half here */
+   task.fn = FFT_radix2_twiddle_task;
+   task.ii = ii + i;
+   task.is = n1;
+   task.n = n2/2;
+   task.w = w*n1;
+   task.ws = w;
+   task.r = 0;
+   task.c = i;
+   task.rs = 1;
+   FFT_task_spawn(wk, &task, &pending);
+
+   FFT_radix2_truncate1_twiddle_par(wk, ii + 2*n + i, n1, n2/2, w*n1, w, 0, i, 1, trunc2);
+   FFT_mfa_revbin_column(ii + 2*n, n1, n2, i, n2);
+
+   FFT_task_sync(wk, &pending);
+   FFT_mfa_revbin_column(ii, n1, n2, i, n2);
 }
 
-void test_fft_ifft_negacyclic()
+/*
+   As per IFFT_radix2_mfa_truncate_sqrt2_column, but with the column IFFTs
+   done with the task based transforms.
+*/
+void IFFT_radix2_mfa_truncate_sqrt2_column_par(fft_worker_t * wk, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_size_t n1, mp_size_t trunc, mp_size_t i)
 {
-   mp_bitcnt_t depth = 11UL;
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 1;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
+   mp_size_t j, u;
+   mp_size_t n2 = (2*n)/n1;
+   mp_size_t trunc2 = (trunc - 2*n)/n1;
+   mp_bitcnt_t size = (w*n)/GMP_LIMB_BITS + 1;
    mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
 
-   TMP_DECL;
+   /* column IFFT of the first half */
+   FFT_mfa_revbin_column(ii, n1, n2, i, n2);
+   IFFT_radix2_twiddle_par(wk, ii + i, n1, n2/2, w*n1, w, 0, i, 1);
+   
+   /* column IFFT of the second half */
+   ii += 2*n;
 
-   TMP_MARK;
+   FFT_mfa_revbin_column(ii, n1, n2, i, trunc2);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   for (j = trunc2; j < n2; j++)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
+      u = i + j*n1;
+      if ((w & 1) == 1)
+      {
+         if ((i & 1) == 0)
+            FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u/2, n, w); 
+         else
+            FFT_twiddle_sqrt2(ii[i + j*n1], ii[u - 2*n], u, n, w, wk->temp); 
+      } else
+         FFT_twiddle(ii[i + j*n1], ii[u - 2*n], u, 2*n, w/2);
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = t2 + size;
-
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
 
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < 1; i++)
-   {
-      FFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, &s1);
+   IFFT_radix2_truncate1_twiddle_par(wk, ii + i, n1, n2/2, w*n1, w, 0, i, 1, trunc2);
       
-      IFFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, &s1);
-      for (j = 0; j < 2*n; j++)
-      {
-         mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth+1);
-         mpn_normmod_2expp1(ii[j], limbs);
+   /* final row of IFFT */
+   if ((w & 1) == 1)
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         if ((j & 1) == 0)
+            FFT_radix2_inverse_butterfly(wk->t1, wk->t2, ii[j - 2*n], ii[j], j/2, n, w);
+         else
+            FFT_radix2_inverse_butterfly_sqrt2(wk->t1, wk->t2, ii[j - 2*n], ii[j], j, n, w, wk->temp);
+   
+         ptr = ii[j - 2*n];
+         ii[j - 2*n] = wk->t1;
+         wk->t1 = ptr;
+         ptr = ii[j];
+         ii[j] = wk->t2;
+         wk->t2 = ptr;
       }
-
-      for (j = 0; j < 2*n; j++)
-      {
-         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
-         {
-            printf("Error in entry %ld\n", j);
-            abort();
-         }
+   } else
+   {
+      for (j = i; j < trunc - 2*n; j+=n1) 
+      {   
+         FFT_radix2_inverse_butterfly(wk->t1, wk->t2, ii[j - 2*n], ii[j], j, 2*n, w/2);
+   
+         ptr = ii[j - 2*n];
+         ii[j - 2*n] = wk->t1;
+         wk->t1 = ptr;
+         ptr = ii[j];
+         ii[j] = wk->t2;
+         wk->t2 = ptr;
       }
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   for (j = trunc + i - 2*n; j < 2*n; j+=n1)
+        mpn_add_n(ii[j - 2*n], ii[j - 2*n], ii[j - 2*n], size);
 }
 
-void test_fft_ifft_sqrt2()
+/*
+   Pins the calling thread, which is thread number t of the given number 
+   of threads, to a NUMA node, so that threads with consecutive numbers
+   share a node. If libnuma is not available or the machine is not NUMA,
+   the thread is pinned to the (t mod c)-th of the c cpus it is allowed 
+   to run on, so that the affinity mask it inherited is respected.
+*/
+void FFT_bind_thread(int t, int threads)
 {
-   mp_bitcnt_t depth = 6UL;
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 1;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *t1, *t2, *s1;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-
-   TMP_DECL;
-
-   TMP_MARK;
+   cpu_set_t allowed, set;
+   int cpu, count, i;
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+#if HAVE_LIBNUMA
+   if (numa_available() != -1 && numa_max_node() > 0)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
+      numa_run_on_node((t*(numa_max_node() + 1))/threads);
+      numa_set_localalloc();
+      return;
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = t2 + size;
+#endif
 
-   for (j = 0; j < 4*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-  
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], size);
-   }
-   
-   FFT_radix2_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1);
-   
-   for (j = 0; j < 4*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+   if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+      return;
 
-   IFFT_radix2_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1);
+   count = CPU_COUNT(&allowed);
+   if (count < 1) return;
    
-   for (j = 0; j < 4*n; j++)
+   i = t % count;
+   for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
    {
-      mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
-      mpn_normmod_2expp1(jj[j], limbs);
-      mpn_normmod_2expp1(ii[j], limbs);
+      if (CPU_ISSET(cpu, &allowed) && i-- == 0)
+         break;
    }
 
-   for (j = 0; j < 4*n; j++)
-   {
-      if (mpn_cmp(ii[j], jj[j], size) != 0)
-      {
-         printf("Error in entry %ld\n", j);
-         gmp_printf("%Nx != \n%Nx\n", ii[j], size, jj[j], size);
-         abort();
-      }
-   }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
 }
 
-void test_fft_ifft_truncate()
+/*
+   Data shared by the threads of new_mpn_mul6_threaded.
+*/
+typedef struct
 {
-   mp_bitcnt_t depth = 10UL;
-   mp_size_t n = (1UL<<depth);            
-   mp_bitcnt_t w = 1;
-   mp_size_t iter = 1000;
-
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, count;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   mp_limb_t ** ii;
+   mp_limb_t ** jj;
+   mp_limb_t * i1;
+   mp_limb_t * i2;
+   mp_size_t n1, n2; /* operand lengths */
+   mp_size_t n, sqrt, trunc;
+   mp_bitcnt_t depth, w, bits1;
+   fft_task_t * tasks[3]; /* the tasks of each of the three passes */
+   long pending[3]; /* how many tasks of each pass are yet to finish */
+} fft_mul_shared_t;
 
-   TMP_DECL;
- 
-   TMP_MARK;
-
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+/*
+   Column task of the forward pass: split the inputs straight into 
+   column c, thereby first touching it, then transform it.
+*/
+void FFT_mul_column_task(fft_worker_t * wk, fft_task_t * task)
+{
+   fft_mul_shared_t * sh = (fft_mul_shared_t *) wk->data;
+   mp_size_t limbs = (sh->n*sh->w)/GMP_LIMB_BITS;
+   mp_size_t j;
+   
+   for (j = task->c; j < 4*sh->n; j += sh->sqrt)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
+      FFT_mul6_split_coeff(sh->ii[j], sh->i1, sh->n1, sh->bits1, limbs, j, sh->depth);
+      FFT_mul6_split_coeff(sh->jj[j], sh->i2, sh->n2, sh->bits1, limbs, j, sh->depth);
    }
-   t1 = (mp_limb_t *) ii + 2*n + 2*n*size;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+   FFT_radix2_mfa_truncate_sqrt2_column_par(wk, sh->ii, sh->n, sh->w, sh->sqrt, sh->trunc, task->c);
+   FFT_radix2_mfa_truncate_sqrt2_column_par(wk, sh->jj, sh->n, sh->w, sh->sqrt, sh->trunc, task->c);
+}
 
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   u1 = (mp_limb_t *) jj + 2*n + 2*n*size;
-   u2 = u1 + size;
-   s2 = (mp_limb_t **) u2 + size;
+/*
+   Row task: the forward FFTs of the row of both operands which starts at
+   coefficient c, the pointwise products and the inverse FFT, all while 
+   the row is in cache.
+*/
+void FFT_mul_row_task(fft_worker_t * wk, fft_task_t * task)
+{
+   fft_mul_shared_t * sh = (fft_mul_shared_t *) wk->data;
+   mp_size_t n = sh->n, sqrt = sh->sqrt;
+   mp_bitcnt_t w = sh->w;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_limb_t ** ii = sh->ii + task->c, ** jj = sh->jj + task->c;
+   mp_size_t k;
+
+   FFT_radix2_mfa_truncate_sqrt2_row(ii, n, w, &wk->t1, &wk->t2, &wk->temp, sqrt);
+   FFT_radix2_mfa_truncate_sqrt2_row(jj, n, w, &wk->t1, &wk->t2, &wk->temp, sqrt);
    
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
-   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
+   for (k = 0; k < sqrt; k++)
    {
-      kk[i] = ptr;
+      fft_mulmod_2expp1(ii[k], ii[k], jj[k], n, w, wk->tt);
    }
-   v1 = (mp_limb_t *) kk + 2*n + 2*n*size;
-   v2 = v1 + size;
-   s3 = (mp_limb_t **) v2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (count = 0; count < iter; count++)
-   {
-      for (i = 0; i < 2*n; i++) 
-      {
-         rand_n(ii[i], state, limbs);
-      }
-   
-      for (j = 0; j < 2*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
 
-      for (i = 0; i < 2*n; i++) 
-      {
-         MPN_COPY(jj[i], ii[i], limbs + 1);
-      }
-      
-      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 1;
-      trunc = ((trunc + 1)/2)*2;
-   
-      FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, s1, trunc);
-      for (j = 0; j < trunc; j++)
-      {
-         mpn_normmod_2expp1(ii[j], limbs);
-         MPN_COPY(kk[j], ii[j], limbs + 1);
-      }
-      
-      IFFT_radix2_truncate(kk, 1, kk, n, w, &v1, &v2, s3, trunc);
-      for (j = 0; j < trunc; j++)
-      {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(kk[j], limbs);
-         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
-         {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
-         }
-      }
-   }
+   IFFT_radix2_mfa_truncate_sqrt2_row(ii, n, w, &wk->t1, &wk->t2, &wk->temp, sqrt);
+}
+
+/*
+   Column task of the inverse pass: transform column c back and scale it.
+*/
+void IFFT_mul_column_task(fft_worker_t * wk, fft_task_t * task)
+{
+   fft_mul_shared_t * sh = (fft_mul_shared_t *) wk->data;
+   mp_size_t limbs = (sh->n*sh->w)/GMP_LIMB_BITS;
+   mp_size_t j;
 
-   TMP_FREE;
+   IFFT_radix2_mfa_truncate_sqrt2_column_par(wk, sh->ii, sh->n, sh->w, sh->sqrt, sh->trunc, task->c);
 
-   gmp_randclear(state);
+   for (j = task->c; j < sh->trunc; j += sh->sqrt)
+   {
+      mpn_div_2expmod_2expp1(sh->ii[j], sh->ii[j], limbs, sh->depth + 2);
+      mpn_normmod_2expp1(sh->ii[j], limbs);
+   }
 }
 
-void test_fft_ifft_truncate_sqrt2()
+/*
+   Each worker starts each pass by spawning its share of the tasks of 
+   the pass, then runs tasks until every task of the pass, wherever it 
+   ran, has finished. Within a task the halves of the column transforms
+   are spawned as further tasks, so idle workers steal whatever is left
+   of the unequal halves of the truncated transforms.
+
+   Coefficient blocks are exchanged with temporaries by the butterflies, 
+   so they move around within whichever column or row is being 
+   transformed. Only column ownership survives the column pass, so each
+   worker is initially given a strip of consecutive columns, which it 
+   first touches by splitting the inputs straight into them. Unless the 
+   load is unbalanced and tasks are stolen, it also does their column 
+   FFTs and IFFTs, with its own node local temporaries.
+*/
+void * FFT_mul_worker(void * arg)
 {
-   mp_bitcnt_t depth = 15UL;
-   mp_size_t n = (1UL<<depth);            
-   mp_bitcnt_t w = 1;
-   mp_size_t iter = 1;
+   fft_worker_t * wk = (fft_worker_t *) arg;
+   fft_mul_shared_t * sh = (fft_mul_shared_t *) wk->data;
+   mp_size_t count[3];
+   mp_size_t p, i, start, end;
+
+   FFT_PHASE_WORKER;
+   FFT_bind_thread(wk->thread, wk->threads);
+
+   count[0] = sh->sqrt;
+   count[1] = (2*sh->n)/sh->sqrt + (sh->trunc - 2*sh->n)/sh->sqrt;
+   count[2] = sh->sqrt;
+
+   for (p = 0; p < 3; p++)
+   {
+      start = (wk->thread*count[p])/wk->threads;
+      end = ((wk->thread + 1)*count[p])/wk->threads;
+      
+      for (i = end - 1; i >= start; i--) /* so that we take them in order */
+         FFT_task_spawn(wk, sh->tasks[p] + i, sh->pending + p);
+
+      FFT_task_sync(wk, sh->pending + p);
+   }
 
+   return NULL;
+}
+
+/*
+   As per new_mpn_mul6, but using the given number of threads, each 
+   pinned to a NUMA node. The work is divided into tasks which are 
+   scheduled by work stealing (see FFT_mul_worker).
+*/
+void new_mpn_mul6_threaded(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, 
+                 int threads)
+{
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, w, depth); 
+   
+   mp_size_t r_limbs = n1 + n2;
+   mp_size_t j1 = FFT_MUL6_COEFFS(n1, bits1, depth);
+   mp_size_t j2 = FFT_MUL6_COEFFS(n2, bits1, depth);
    mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   
    mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, count;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, *s1, *s2, *s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   mp_size_t rows = (2*n)/sqrt;
+   mp_size_t i, trunc2;
+   mp_bitcnt_t depth2 = 0;
+   int t;
 
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, * temps;
+   fft_worker_t * wk;
+   pthread_t * pt;
+   fft_mul_shared_t sh;
+   
    TMP_DECL;
- 
+
    TMP_MARK;
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   /* 
+      not touched here, so that the pages are placed by the workers, and
+      without huge pages, which would be placed whole by the first worker
+   */
+   ii = (mp_limb_t **) FFT_alloc_limbs_local(4*(n + n*size));
    for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
    {
       ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
    }
-   t1 = (mp_limb_t *) ii + 4*n + 4*n*size;
-   t2 = t1 + size;
-   s1 = t2 + size;
-
-   for (j = 0; j < 4*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   
+   jj = (mp_limb_t **) FFT_alloc_limbs_local(4*(n + n*size));
    for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
    {
       jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   u1 = (mp_limb_t *) jj + 4*n + 4*n*size;
-   u2 = u1 + size;
-   s2 = u2 + size;
-   
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
-   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
-   {
-      kk[i] = ptr;
    }
-   v1 = (mp_limb_t *) kk + 4*n + 4*n*size;
-   v2 = v1 + size;
-   s3 = v2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (count = 0; count < iter; count++)
-   {
-      for (i = 0; i < 4*n; i++) 
-      {
-         rand_n(ii[i], state, limbs);
-      }
-   
-      for (j = 0; j < 4*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
 
-      for (i = 0; i < 4*n; i++) 
-      {
-         MPN_COPY(jj[i], ii[i], limbs + 1);
-      }
-      
-      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 2*n + 1;
-      trunc = ((trunc + 7)/8)*8;
-   
-      FFT_radix2_truncate_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
-      for (j = 0; j < trunc; j++)
-      {
-         mpn_normmod_2expp1(ii[j], limbs);
-         MPN_COPY(kk[j], ii[j], limbs + 1);
-      }
-      
-      IFFT_radix2_truncate_sqrt2(kk, 1, kk, n, w, &v1, &v2, &s3, trunc);
-      for (j = 0; j < trunc; j++)
+   /* 
+      the temporaries may end up in ii or jj, so they must outlive the 
+      workers, but they are first touched by them
+   */
+   temps = FFT_alloc_limbs_local(5*size*threads);
+
+   sh.ii = ii;
+   sh.jj = jj;
+   sh.i1 = i1;
+   sh.i2 = i2;
+   sh.n1 = n1;
+   sh.n2 = n2;
+   sh.n = n;
+   sh.sqrt = sqrt;
+   /* the tasks only deal with whole rows, so trunc must be divisible by sqrt */
+   sh.trunc = MAX(sqrt*((j1 + j2 + sqrt - 2)/sqrt), 2*n + sqrt);
+   sh.depth = depth;
+   sh.w = w;
+   sh.bits1 = bits1;
+   
+   trunc2 = (sh.trunc - 2*n)/sqrt;
+   while ((1UL<<depth2) < rows) depth2++;
+
+   sh.tasks[0] = (fft_task_t *) TMP_ALLOC((2*sqrt + rows + trunc2)*sizeof(fft_task_t));
+   sh.tasks[1] = sh.tasks[0] + sqrt;
+   sh.tasks[2] = sh.tasks[1] + rows + trunc2;
+   sh.pending[0] = sqrt;
+   sh.pending[1] = rows + trunc2;
+   sh.pending[2] = sqrt;
+
+   for (i = 0; i < sqrt; i++)
+   {
+      sh.tasks[0][i].fn = FFT_mul_column_task;
+      sh.tasks[0][i].c = i;
+      sh.tasks[2][i].fn = IFFT_mul_column_task;
+      sh.tasks[2][i].c = i;
+   }
+
+   /* the rows of the first half, then those of the second half we need */
+   for (i = 0; i < rows + trunc2; i++)
+   {
+      sh.tasks[1][i].fn = FFT_mul_row_task;
+      if (i < rows) sh.tasks[1][i].c = i*sqrt;
+      else sh.tasks[1][i].c = 2*n + mpir_revbin(i - rows, depth2)*sqrt;
+   }
+
+   wk = (fft_worker_t *) TMP_ALLOC(threads*sizeof(fft_worker_t));
+   pt = (pthread_t *) TMP_ALLOC(threads*sizeof(pthread_t));
+
+   for (t = 0; t < threads; t++)
+   {
+      wk[t].workers = wk;
+      wk[t].thread = t;
+      wk[t].threads = threads;
+      wk[t].seed = t + 1;
+      wk[t].t1 = temps + 5*size*t;
+      wk[t].t2 = wk[t].t1 + size;
+      wk[t].temp = wk[t].t2 + size;
+      wk[t].tt = wk[t].temp + size;
+      wk[t].data = &sh;
+      wk[t].top = 0;
+      wk[t].bottom = 0;
+   }
+
+   // every worker owns tasks the others wait for, so all must be started
+   for (t = 0; t < threads; t++)
+   {
+      if (pthread_create(pt + t, NULL, FFT_mul_worker, wk + t) != 0)
       {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(kk[j], limbs);
-         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
-         {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
-         }
+         fprintf(stderr, "FFT: unable to create thread %d of %d\n", t, threads);
+         abort();
       }
    }
 
-   TMP_FREE;
+   for (t = 0; t < threads; t++)
+      pthread_join(pt[t], NULL);
+
+   MPN_ZERO(r1, r_limbs);
+   FFT_mul6_combine(r1, ii, j1 + j2 - 1, bits1, limbs, r_limbs, depth, 0);
+     
+   FFT_free_limbs(temps, 5*size*threads);
+   FFT_free_limbs((mp_limb_t *) jj, 4*(n + n*size));
+   FFT_free_limbs((mp_limb_t *) ii, 4*(n + n*size));
 
-   gmp_randclear(state);
+   TMP_FREE;
 }
 
-void test_fft_ifft_mfa_truncate_sqrt2()
+
+#else
+
+void new_mpn_mul6_threaded(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1,
+                 mp_limb_t * i2, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, int threads)
 {
-   mp_bitcnt_t depth = 15UL;
-   mp_size_t n = (1UL<<depth);            
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t w = 1;
-   mp_size_t iter = 1;
+   new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+}
 
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, count;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, *s1, *s2, *s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+#endif
 
-   TMP_DECL;
- 
-   TMP_MARK;
+/************************************************************************************
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
-   {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
-   }
-   t1 = (mp_limb_t *) ii + 4*n + 4*n*size;
-   t2 = t1 + size;
-   s1 = t2 + size;
+   Cost model and planner
 
-   for (j = 0; j < 4*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+************************************************************************************/
 
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   u1 = (mp_limb_t *) jj + 4*n + 4*n*size;
-   u2 = u1 + size;
-   s2 = u2 + size;
-   
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
-   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
+/*
+   Constants of the cost model, in cycles per limb of coefficient. The 
+   defaults are rough figures for a modern x86_64; they can be refitted by 
+   comparing the counts and timings the bench driver prints when built with
+   FFT_OP_COUNTS and FFT_PHASE_STATS against the predictions of bench -P.
+*/
+#ifndef FFT_COST_BUTTERFLY
+#define FFT_COST_BUTTERFLY 5.0 /* butterfly, per limb of one coefficient */
+#endif
+#ifndef FFT_COST_TWIDDLE
+#define FFT_COST_TWIDDLE 3.0 /* twiddle, per limb */
+#endif
+#ifndef FFT_COST_NORM
+#define FFT_COST_NORM 1.0 /* normalisation or scaling, per limb */
+#endif
+#ifndef FFT_COST_SPLIT
+#define FFT_COST_SPLIT 2.0 /* split or combine, per limb of coefficient */
+#endif
+#ifndef FFT_COST_MUL
+#define FFT_COST_MUL 8.0 /* pointwise product of l limbs costs FFT_COST_MUL*l^1.5 */
+#endif
+#ifndef FFT_COST_PAGE
+#define FFT_COST_PAGE 2.0 /* paging a limb in or out, for the mmap variant */
+#endif
+
+const char * fft_mul_variant_names[] = { "mul6", "lowmem", "mmap", "threaded" };
+
+/*
+   Square root by Newton iteration, to avoid needing libm.
+*/
+static double FFT_sqrt_d(double x)
+{
+   double r = x > 1.0 ? x : 1.0;
+   int i;
+
+   for (i = 0; i < 64; i++) 
    {
-      kk[i] = ptr;
+      double s = (r + x/r)/2;
+      if (s >= r) break;
+      r = s;
    }
-   v1 = (mp_limb_t *) kk + 4*n + 4*n*size;
-   v2 = v1 + size;
-   s3 = v2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (count = 0; count < iter; count++)
-   {
-      for (i = 0; i < 4*n; i++) 
-      {
-         rand_n(ii[i], state, limbs);
-      }
-   
-      for (j = 0; j < 4*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
 
-      for (i = 0; i < 4*n; i++) 
-      {
-         MPN_COPY(jj[i], ii[i], limbs + 1);
-      }
-      
-      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 2*n + 1;
-      trunc = ((trunc + sqrt - 1)/sqrt)*sqrt;
-   
-      FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
-      for (j = 0; j < 4*n; j++)
-      {
-         mpn_normmod_2expp1(ii[j], limbs);
-         MPN_COPY(kk[j], ii[j], limbs + 1);
-      }
-      
-      IFFT_radix2_mfa_truncate_sqrt2(kk, n, w, &v1, &v2, &s3, sqrt, trunc);
-      for (j = 0; j < trunc; j++)
-      {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(kk[j], limbs);
-         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
-         {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
-         }
-      }
-   }
+   return r;
+}
 
-   TMP_FREE;
+/*
+   Predicted cycles for a pointwise multiplication modulo 2^(64*limbs) + 1.
+   Large ones are done by FFT_mulmod_Bexpp1, which above 
+   FFT_MULMOD_WRAP_LIMBS uses the negacyclic wrap or a full product, 
+   whichever is predicted to be faster.
+*/
+double FFT_mulmod_cost(mp_size_t limbs)
+{
+   mp_bitcnt_t depth, w;
+   double wrap, full;
+
+   if (limbs < 250)
+      return FFT_COST_MUL*limbs*FFT_sqrt_d(limbs);
+
+   // the small negacyclic convolution costs about as much as a full 
+   // product of half the length
+   if (limbs < FFT_MULMOD_WRAP_LIMBS)
+      return FFT_mulmod_Bexp_params(&depth, &w, limbs, 0, 0);
 
-   gmp_randclear(state);
+   wrap = FFT_mulmod_Bexp_params(&depth, &w, limbs, 1, 1);
+   full = FFT_mulmod_Bexp_params(&depth, &w, 2*limbs, 0, 0);
+   
+   return (wrap != 0.0 && wrap < full) ? wrap : full;
 }
 
-void test_fft_ifft_mfa()
+/*
+   Predicted cycles for a cyclic (neg = 0) or negacyclic (neg = 1) 
+   convolution of 4n coefficients with full length sqrt2 transforms of 
+   the given depth and w, as per FFT_mul_plan_cost with trunc = 4n, plus
+   the weights for neg.
+*/
+static double FFT_wrap_cost(mp_bitcnt_t depth, mp_bitcnt_t w, int neg)
 {
-   mp_bitcnt_t depth = 12UL;
    mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 1;
-   mp_size_t sqrt = (1UL<<(depth/2));
    mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
    mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   double butterflies = 3.0*(2*n + 2.0*n*(depth + 1));
+   double cycles;
 
-   TMP_DECL;
+   cycles = butterflies*size*FFT_COST_BUTTERFLY + 4.0*n*FFT_mulmod_cost(limbs)
+          + 3.0*4*n*size*FFT_COST_NORM + 3.0*4*n*size*FFT_COST_SPLIT;
+   if (neg)
+      cycles += 3.0*4*n*size*FFT_COST_TWIDDLE;
 
-   TMP_MARK;
+   return cycles;
+}
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+/*
+   Chooses the depth and w with which FFT_mulmod_Bexp_wrap is predicted 
+   to be fastest for products modulo B^k - 1 (neg = 0) or B^k + 1 
+   (neg = 1), returning the predicted cycles, or 0 if there are none. The 
+   4n coefficients have 16k/n bits, so 2^depth must divide 16k, and their
+   products, of which the convolution adds up to 4n, need a sign bit for
+   neg. For neg w must also be divisible by 4. If exact is 0, 2^depth need
+   not divide 16k, the coefficients being rounded up, which predicts the 
+   cost of a product of about 64k bits for any k, e.g. a full product 
+   when k is twice the length of the operands.
+*/
+double FFT_mulmod_Bexp_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, 
+                                       mp_size_t k, int neg, int exact)
+{
+   mp_bitcnt_t d, ww, bits1;
+   mp_size_t n;
+   double cycles, best = 0.0;
+
+   for (d = 6; d < GMP_LIMB_BITS - 2; d++)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
-   }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
+      n = (1UL<<d);
+      if (n > 16*k || (exact && (16*k) % n != 0))
+         break;
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+      bits1 = (16*k + n - 1)/n;
+      ww = (2*bits1 + d + 2 + neg + n - 1)/n;
+      if (neg) 
+         ww = ((ww + 3)/4)*4;
+      if (ww > GMP_LIMB_BITS)
+         continue;
 
-   
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   u1 = ptr;
-   u2 = u1 + size;
-   s2 = (mp_limb_t **) u2 + size;
-   
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      kk[i] = ptr;
-   }
-   v1 = ptr;
-   v2 = v1 + size;
-   s3 = (mp_limb_t **) v2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < 10; i++)
-   {
-      for (j = 0; j < 2*n; j++) 
+      cycles = FFT_wrap_cost(d, ww, neg);
+      if (best == 0.0 || cycles < best)
       {
-          rand_n(ii[j], state, limbs);
-          mpn_normmod_2expp1(ii[j], limbs);
-          MPN_COPY(jj[j], ii[j], limbs + 1);
+         best = cycles;
+         *depth = d;
+         *w = ww;
       }
 
-      FFT_radix2_mfa(ii, n, w, &t1, &t2, s1, sqrt);
-      for (j = 0; j < 2*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
-      for (j = 0; j < 2*n; j++)
-      {
-         MPN_COPY(kk[j], ii[j], limbs + 1);
-      }
-      IFFT_radix2_mfa(kk, n, w, &v1, &v2, s3, sqrt);
-      for (j = 0; j < 2*n; j++)
-      {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(kk[j], limbs);
-      }
+      if (ww == (neg ? 4 : 1)) // deeper transforms only have more coefficients
+         break;
+   }
 
-      for (j = 0; j < 2*n; j++)
+   return best;
+}
+
+/*
+   As per FFT_mul_plan_cost, but for operands already split into j1 and 
+   j2 coefficients.
+*/
+static int FFT_mul_plan_cost_coeffs(fft_mul_plan_t * plan, mp_size_t j1, mp_size_t j2)
+{
+   mp_size_t n = (1UL<<plan->depth);
+   mp_size_t sqrt = (1UL<<(plan->depth/2));
+   mp_size_t limbs = (n*plan->w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t trunc = (plan->variant == FFT_MUL6_THREADED) ? 
+                 sqrt*((j1 + j2 + sqrt - 2)/sqrt) : 2*((j1 + j2)/2);
+   mp_size_t words;
+   double twiddles, arith, other;
+
+   if (j1 + j2 - 1 <= 2*n || trunc > 4*n)
+      return 0;
+
+   plan->n1 = sqrt;
+   plan->trunc = trunc;
+
+   // two forward transforms and one inverse transform
+   plan->butterflies = 3.0*((trunc - 2*n) + (trunc/2.0)*(plan->depth + 1));
+   twiddles = 3.0*(4*n - trunc);
+   plan->pointwise = trunc;
+
+   arith = plan->butterflies*size*FFT_COST_BUTTERFLY + twiddles*size*FFT_COST_TWIDDLE
+         + plan->pointwise*FFT_mulmod_cost(limbs) 
+         + 3.0*trunc*size*FFT_COST_NORM; // normalise both inputs, scale the output
+   
+   other = (j1 + j2 + (j1 + j2 - 1))*size*FFT_COST_SPLIT; // split both, combine
+
+   // coefficient arrays of 4n coefficients plus pointers, and temporaries,
+   // the large blocks being rounded up as FFT_alloc_limbs rounds them
+   words = 4*(n + n*size);
+   plan->disk = 0;
+
+   switch (plan->variant)
+   {
+   case FFT_MUL6:
+      plan->memory = FFT_alloc_bytes(2*words + 5*size);
+      break;
+   case FFT_MUL6_LOWMEM:
+      plan->memory = FFT_alloc_bytes(words + 3*size) 
+                   + FFT_alloc_bytes(2*(n + n*size)) + 2*size*sizeof(mp_limb_t);
+      other += j2*size*FFT_COST_SPLIT; // i2 is split once for each half
+      break;
+   case FFT_MUL6_MMAP:
+      plan->disk = 8*n*size*sizeof(mp_limb_t);
+      plan->memory = (8*n + 5*size)*sizeof(mp_limb_t); // only the pointers are in RAM
+      other += 6.0*4*n*size*FFT_COST_PAGE; // column and row passes of 3 transforms
+      break;
+   case FFT_MUL6_THREADED:
+      plan->memory = 2*FFT_alloc_bytes(words) + FFT_alloc_bytes(5*size*plan->threads) 
+                   + 2*size*sizeof(mp_limb_t);
+      arith /= plan->threads;
+      break;
+   }
+
+   plan->cycles = arith + other;
+
+   return 1;
+}
+
+/*
+   Fills in the predicted operation counts, cycles and memory for the 
+   given plan, whose variant, depth, w and threads must be set, for 
+   integers of an and bn limbs. Returns 0 if the parameters cannot be 
+   used for integers of this size.
+
+   Each truncated sqrt2 transform does trunc - 2n butterflies and 
+   4n - trunc twiddles in its first layer, then about trunc/2 butterflies
+   in each of its remaining depth + 1 layers. The pointwise products are
+   done for trunc coefficients. trunc is the number of coefficients of the
+   product rounded up to an even number, or for the threaded variant, 
+   whose tasks only deal with whole rows, to a multiple of sqrt.
+*/
+int FFT_mul_plan_cost(fft_mul_plan_t * plan, mp_size_t an, mp_size_t bn)
+{
+   mp_size_t n = (1UL<<plan->depth);
+   mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, plan->w, plan->depth);
+
+   return FFT_mul_plan_cost_coeffs(plan, FFT_MUL6_COEFFS(an, bits1, plan->depth),
+                                         FFT_MUL6_COEFFS(bn, bits1, plan->depth));
+}
+
+/*
+   Goes through the candidate plans for multiplying integers of an and bn
+   limbs, one for each valid depth and w and each variant, writing the 
+   first max of them to plans, and returns the number of candidates. If 
+   best is not NULL it is set to the candidate with the lowest predicted 
+   time which keeps the coefficients in RAM, if there is one. The threaded
+   candidates (only with FFT_THREADS) use one thread per online cpu. The
+   FFT_MUL6_MMAP candidates are only offered if the environment variable
+   FFT_MMAP_DIR names a directory for their files, which should be on a 
+   disk, as the usual temporary directories are often in RAM anyway.
+*/
+static mp_size_t FFT_mul_plans_scan(fft_mul_plan_t * plans, mp_size_t max, 
+                  fft_mul_plan_t * best, mp_size_t an, mp_size_t bn)
+{
+   fft_mul_variant_t v, last = FFT_MUL6_MMAP;
+   mp_bitcnt_t depth, w;
+   mp_size_t count = 0;
+   int threads = 1, found = 0;
+   fft_mul_plan_t plan;
+   const char * dir = getenv("FFT_MMAP_DIR");
+
+   if (dir != NULL && *dir == '\0')
+      dir = NULL;
+
+#if FFT_THREADS
+   threads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (threads < 1) threads = 1;
+   last = FFT_MUL6_THREADED;
+#endif
+
+   for (depth = 6; depth < GMP_LIMB_BITS - 2; depth++)
+   {
+      mp_size_t n = (1UL<<depth);
+      mp_bitcnt_t bits1 = FFT_MUL6_BITS1(n, 1, depth);
+      
+      // with w = 1 there must be more than 2n coefficients
+      if (FFT_MUL6_COEFFS(an, bits1, depth) + FFT_MUL6_COEFFS(bn, bits1, depth) - 1 <= 2*n)
+         break;
+
+      for (w = 1; w <= GMP_LIMB_BITS; w++)
       {
-         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         for (v = FFT_MUL6; v <= last; v++)
          {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
+            if (v == FFT_MUL6_MMAP && dir == NULL)
+               continue;
+
+            plan.variant = v;
+            plan.depth = depth;
+            plan.w = w;
+            plan.threads = (v == FFT_MUL6_THREADED ? threads : 1);
+            plan.dir = (v == FFT_MUL6_MMAP ? dir : NULL);
+
+            if (!FFT_mul_plan_cost(&plan, an, bn))
+               continue;
+
+            if (count < max)
+               plans[count] = plan;
+            count++;
+
+            if (best != NULL && v != FFT_MUL6_MMAP 
+             && (!found || plan.cycles < best->cycles))
+            {
+               *best = plan;
+               found = 1;
+            }
          }
       }
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   return count;
+}
+
+/*
+   Writes up to max candidate plans for multiplying integers of an and bn
+   limbs to plans, one for each valid depth and w and each variant, and 
+   returns the number written. No multiplication is done. The threaded 
+   candidates (only with FFT_THREADS) use one thread per online cpu, and
+   the FFT_MUL6_MMAP ones are only listed if FFT_MMAP_DIR is set to the
+   directory for their files.
+*/
+mp_size_t fft_mul_plans(fft_mul_plan_t * plans, mp_size_t max, mp_size_t an, mp_size_t bn)
+{
+   mp_size_t count = FFT_mul_plans_scan(plans, max, NULL, an, bn);
+
+   return MIN(count, max);
+}
+
+/*
+   Sets plan to the candidate with the lowest predicted time which keeps
+   the coefficients in RAM, without doing any multiplication. Every 
+   candidate is considered, but none are stored. Returns 0 if the 
+   integers are too small for new_mpn_mul6.
+*/
+int fft_mul_estimate(mp_size_t an, mp_size_t bn, fft_mul_plan_t * plan)
+{
+   fft_mul_plan_t best;
+
+   best.variant = FFT_MUL6_MMAP; // only set if there is a candidate in RAM
+   FFT_mul_plans_scan(NULL, 0, &best, an, bn);
+
+   if (best.variant == FFT_MUL6_MMAP)
+      return 0;
+
+   *plan = best;
+
+   return 1;
+}
+
+/*
+   Sets {r1, n1 + n2} to the product of {i1, n1} and {i2, n2} using the
+   given plan, which must have been made for integers of these sizes.
+*/
+void fft_mul_plan_run(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                 mp_limb_t * i2, mp_size_t n2, const fft_mul_plan_t * plan)
+{
+   switch (plan->variant)
+   {
+   case FFT_MUL6_LOWMEM:
+      new_mpn_mul6_lowmem(r1, i1, n1, i2, n2, plan->depth, plan->w);
+      break;
+   case FFT_MUL6_MMAP:
+      new_mpn_mul6_mmap(r1, i1, n1, i2, n2, plan->depth, plan->w, plan->dir);
+      break;
+#if FFT_THREADS
+   case FFT_MUL6_THREADED:
+      new_mpn_mul6_threaded(r1, i1, n1, i2, n2, plan->depth, plan->w, plan->threads);
+      break;
+#endif
+   default:
+      new_mpn_mul6(r1, i1, n1, i2, n2, plan->depth, plan->w);
+   }
+}
+
+/*
+   Sets {r1, n1 + n2} to the product of {i1, n1} and {i2, n2}, where 
+   n1 >= n2, using the plan fft_mul_estimate predicts to be fastest, or 
+   mpn_mul if the integers are too small for new_mpn_mul6. If n1 is much
+   larger than n2, new_mpn_mul_unbalanced is used if it is predicted to 
+   be faster still.
+*/
+void new_mpn_mul_auto(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, 
+                                    mp_limb_t * i2, mp_size_t n2)
+{
+   fft_mul_plan_t plan;
+   mp_bitcnt_t depth, w;
+   mp_size_t m;
+   double cycles;
+
+   if (fft_mul_estimate(n1, n2, &plan))
+   {
+      if (n1 >= 4*n2 
+       && (cycles = FFT_mul_unbalanced_params(&depth, &w, &m, n1, n2)) != 0.0
+       && n1 > m && cycles < plan.cycles)
+         new_mpn_mul_unbalanced(r1, i1, n1, i2, n2);
+      else
+         fft_mul_plan_run(r1, i1, n1, i2, n2, &plan);
+   } else
+      mpn_mul(r1, i1, n1, i2, n2);
 }
 
-void test_fft_ifft_mfa_sqrt2()
+/*
+   Sets {r1, 2*n1} to the square of {i1, n1}.
+*/
+void new_mpn_sqr_auto(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1)
 {
-   mp_bitcnt_t depth = 13UL;
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 4;
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *s1;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-
-   TMP_DECL;
+   new_mpn_mul_auto(r1, i1, n1, i1, n1);
+}
 
-   TMP_MARK;
+/*
+   Sets r to a*b. Signs are handled, and r may be the same as a or b or 
+   both, without the inputs being copied: new_mpn_mul6_ws has finished 
+   with the inputs, having split them into coefficients, before anything
+   is written to the product. If r is an input, new_mpn_mul6 is used with
+   the parameters fft_mul_estimate chooses, otherwise new_mpn_mul_auto. 
+   Integers too small for the FFT are multiplied with mpz_mul.
+*/
+void mpz_mul_fft(mpz_ptr r, mpz_srcptr a, mpz_srcptr b)
+{
+   fft_mul_plan_t plan;
+   mp_size_t an = ABSIZ(a), bn = ABSIZ(b), rn, ws_limbs;
+   mp_limb_t * rp, * ws;
+   int neg = ((SIZ(a) ^ SIZ(b)) < 0);
+   int alias = (r == a || r == b);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   if (an < bn)
    {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
+      mpz_srcptr t = a;
+      a = b;
+      b = t;
+      rn = an;
+      an = bn;
+      bn = rn;
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = t2 + size;
-   
-   for (j = 0; j < 4*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
 
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
-   {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
-   }
-   
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
-   for (i = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
+   if (bn == 0 || !fft_mul_estimate(an, bn, &plan))
    {
-      kk[i] = ptr;
+      mpz_mul(r, a, b);
+      return;
    }
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < 1; i++)
+
+   // if r is an input its limbs, and so the input's, are kept
+   rn = an + bn;
+   rp = MPZ_REALLOC(r, rn);
+
+   if (alias)
    {
-      FFT_radix2_mfa_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt);
+      ws_limbs = new_mpn_mul6_workspace(plan.depth, plan.w);
+      ws = FFT_alloc_limbs(ws_limbs);
+      new_mpn_mul6_ws(rp, PTR(a), an, PTR(b), bn, plan.depth, plan.w, ws);
+      FFT_free_limbs(ws, ws_limbs);
+   } else
+      new_mpn_mul_auto(rp, PTR(a), an, PTR(b), bn);
 
-      for (j = 0; j < 4*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
-      
-      for (j = 0; j < 4*n; j++)
-         MPN_COPY(kk[j], ii[j], limbs + 1);
+   rn -= (rp[rn - 1] == 0);
+   SIZ(r) = neg ? -rn : rn;
+}
 
-      IFFT_radix2_mfa_sqrt2(kk, n, w, &t1, &t2, &s1, sqrt);
-      for (j = 0; j < 4*n; j++)
-      {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(kk[j], limbs);
-      }
+/*
+   Sets r to a^2, with only one forward transform. r may be a.
+*/
+void mpz_sqr_fft(mpz_ptr r, mpz_srcptr a)
+{
+   mpz_mul_fft(r, a, a);
+}
 
-      for (j = 0; j < 4*n; j++)
+/************************************************************************************
+
+   Product trees
+
+************************************************************************************/
+
+/*
+   Workspace for new_mpn_mul6_ws, grown as needed, which is kept for all 
+   the products of a tree that one thread computes.
+*/
+typedef struct
+{
+   mp_limb_t * ws;
+   mp_size_t limbs;
+} fft_prod_ws_t;
+
+/*
+   Sets {r, an + bn} to the product of {a, an} and {b, bn}, using and if 
+   necessary enlarging the workspace ws, and returns the number of limbs
+   of the product, which is at least 1. 
+*/
+static mp_size_t FFT_prod_mul(mp_limb_t * r, mp_limb_t * a, mp_size_t an, 
+               mp_limb_t * b, mp_size_t bn, fft_prod_ws_t * ws, int threads)
+{
+   fft_mul_plan_t plan;
+   mp_size_t need, rn = an + bn;
+   mp_limb_t * t;
+
+   if (an < bn)
+   {
+      t = a;
+      a = b;
+      b = t;
+      bn = an;
+      an = rn - bn;
+   }
+
+   if (!fft_mul_estimate(an, bn, &plan))
+      mpn_mul(r, a, an, b, bn);
+#if FFT_THREADS
+   else if (threads > 1)
+      new_mpn_mul6_threaded(r, a, an, b, bn, plan.depth, plan.w, threads);
+#endif
+   else
+   {
+      need = new_mpn_mul6_workspace(plan.depth, plan.w);
+      if (need > ws->limbs)
       {
-         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
-         {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
-         }
+         if (ws->limbs != 0)
+            FFT_free_limbs(ws->ws, ws->limbs);
+         ws->ws = FFT_alloc_limbs(need);
+         ws->limbs = need;
       }
+      new_mpn_mul6_ws(r, a, an, b, bn, plan.depth, plan.w, ws->ws);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   while (rn > 1 && r[rn - 1] == 0) rn--;
+
+   return rn;
 }
 
-void test_fft_ifft_mfa_truncate()
+#if FFT_THREADS
+
+typedef struct
 {
-   mp_bitcnt_t depth = 12UL;
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t w = 1;
-   mp_size_t iters = 100;
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, count, trunc;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   mp_limb_t * out, * tmp, ** x;
+   mp_size_t * xn, * off;
+   mp_size_t lo, hi, rn;
+   fft_prod_ws_t * ws;
+   int threads;
+} fft_prod_arg_t;
 
-   TMP_DECL;
+static void * FFT_prod_worker(void * arg);
 
-   TMP_MARK;
+static void * FFT_prod_thread(void * arg);
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      ii[i] = ptr;
-      rand_n(ii[i], state, limbs);
-   }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
+#endif
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
+/*
+   Sets out to the product of x[lo], ..., x[hi - 1], returning its number
+   of limbs. The integers are split where the limbs, given by the prefix 
+   sums off, are most nearly halved, and the two halves multiplied in 
+   tmp, using the corresponding parts of out as their own temporary space,
+   so that the halves, which touch disjoint memory, can be computed by 
+   different threads. Each thread has its own workspace.
+*/
+static mp_size_t FFT_prod_tree(mp_limb_t * out, mp_limb_t * tmp, mp_limb_t ** x, 
+                 mp_size_t * xn, mp_size_t * off, mp_size_t lo, mp_size_t hi, 
+                 fft_prod_ws_t * ws, int threads)
+{
+   mp_size_t mid, a, b, ln, rn, left;
 
-   
-   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   if (hi - lo == 1)
    {
-      jj[i] = ptr;
-      MPN_COPY(jj[i], ii[i], limbs + 1);
+      rn = xn[lo];
+      MPN_COPY(out, x[lo], rn);
+      while (rn > 1 && out[rn - 1] == 0) rn--;
+      return rn;
    }
-   u1 = ptr;
-   u2 = u1 + size;
-   s2 = (mp_limb_t **) u2 + size;
-   
-   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
+
+   // the first mid for which x[lo], ..., x[mid - 1] have half the limbs
+   a = lo + 1;
+   b = hi - 1;
+   while (a < b)
    {
-      kk[i] = ptr;
+      mid = (a + b)/2;
+      if (2*(off[mid] - off[lo]) < off[hi] - off[lo])
+         a = mid + 1;
+      else
+         b = mid;
    }
-   v1 = ptr;
-   v2 = v1 + size;
-   s3 = (mp_limb_t **) v2 + size;
-   
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (count = 0; count < iters; count++)
+   mid = a;
+   left = off[mid] - off[lo];
+
+#if FFT_THREADS
+   if (threads > 1)
    {
-      mp_size_t trunc = (gmp_urandomm_ui(state, n/sqrt) + 1)*sqrt*2;
-      for (i = 0; i < 2*n; i++) 
-      {
-         rand_n(ii[i], state, limbs);
-         mpn_normmod_2expp1(ii[i], limbs);
-         MPN_COPY(jj[i], ii[i], limbs + 1);
-      }
+      fft_prod_arg_t arg;
+      fft_prod_ws_t ws2 = { NULL, 0 };
+      pthread_t pt;
 
-      FFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
-      
-      for (j = 0; j < 2*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
-      
-      IFFT_radix2_mfa_truncate(ii, n, w, &v1, &v2, s3, sqrt, trunc);
-      
-      for (j = 0; j < 2*n; j++)
-      {
-         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
-         mpn_normmod_2expp1(jj[j], limbs);
-         mpn_normmod_2expp1(ii[j], limbs);
-      }
+      arg.out = tmp;
+      arg.tmp = out;
+      arg.x = x;
+      arg.xn = xn;
+      arg.off = off;
+      arg.lo = lo;
+      arg.hi = mid;
+      arg.ws = &ws2;
+      arg.threads = threads/2;
 
-      for (j = 0; j < trunc; j++)
+      if (pthread_create(&pt, NULL, FFT_prod_thread, &arg) == 0)
       {
-         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
-         {
-            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
-            abort();
-         }
+         rn = FFT_prod_tree(tmp + left, out + left, x, xn, off, mid, hi, ws, threads - threads/2);
+         pthread_join(pt, NULL);
+      } else // no thread, so do both halves here
+      {
+         FFT_prod_worker(&arg);
+         rn = FFT_prod_tree(tmp + left, out + left, x, xn, off, mid, hi, ws, threads - threads/2);
       }
+      ln = arg.rn;
+
+      if (ws2.limbs != 0)
+         FFT_free_limbs(ws2.ws, ws2.limbs);
+   } else
+#endif
+   {
+      ln = FFT_prod_tree(tmp, out, x, xn, off, lo, mid, ws, 1);
+      rn = FFT_prod_tree(tmp + left, out + left, x, xn, off, mid, hi, ws, 1);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   return FFT_prod_mul(out, tmp, ln, tmp + left, rn, ws, threads);
 }
 
-void test_fft_truncate()
+#if FFT_THREADS
+
+static void * FFT_prod_worker(void * arg)
 {
-   mp_bitcnt_t depth = 10UL;
-   mp_size_t n = (1UL<<depth);            
-   mp_bitcnt_t w = 1;
-   mp_size_t iter = 1000;
+   fft_prod_arg_t * a = (fft_prod_arg_t *) arg;
 
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s, count;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   a->rn = FFT_prod_tree(a->out, a->tmp, a->x, a->xn, a->off, 
+                                   a->lo, a->hi, a->ws, a->threads);
 
-   TMP_DECL;
- 
-   for (count = 0; count < iter; count++)
-   {
-      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 1;
-      trunc = ((trunc + 7)/8)*8;
-   
-      TMP_MARK;
+   return NULL;
+}
 
-      ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
-      for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
-      {
-         ii[i] = ptr;
-         if (i < trunc) rand_n(ii[i], state, limbs);
-         else MPN_ZERO(ii[i], limbs + 1);
-      }
-      t1 = (mp_limb_t *) ii + 2*n + 2*n*size;
-      t2 = t1 + size;
-      s1 = (mp_limb_t **) t2 + size;
+/*
+   Start routine of the thread which computes the left subtree.
+*/
+static void * FFT_prod_thread(void * arg)
+{
+   FFT_PHASE_WORKER;
 
-      for (j = 0; j < 2*n; j++)
-         mpn_normmod_2expp1(ii[j], limbs);
+   return FFT_prod_worker(arg);
+}
 
-      jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
-      for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
-      {
-         jj[i] = ptr;
-         MPN_COPY(jj[i], ii[i], limbs + 1);
-      }
-      u1 = (mp_limb_t *) jj + 2*n + 2*n*size;
-      u2 = u1 + size;
-      s2 = (mp_limb_t **) u2 + size;
-   
-      tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+#endif
+
+/*
+   Sets r to the product of the count >= 1 integers {x[i], xn[i]}, where 
+   r has room for xn[0] + ... + xn[count - 1] limbs, and returns the 
+   number of limbs of the product. The integers are multiplied in a 
+   binary tree balanced by size, with one workspace for the transforms 
+   of the whole tree and one temporary array of the size of r, and with 
+   the given number of threads working on independent subtrees, then 
+   together on the products at the top of the tree. r may not overlap 
+   the integers.
+*/
+mp_size_t mpn_prod_tree_threaded(mp_limb_t * r, mp_limb_t ** x, mp_size_t * xn, 
+                                              mp_size_t count, int threads)
+{
+   fft_prod_ws_t ws = { NULL, 0 };
+   mp_size_t * off, i, rn;
+   mp_limb_t * tmp;
+
+   off = (mp_size_t *) malloc((count + 1)*sizeof(mp_size_t));
+   for (i = 0, off[0] = 0; i < count; i++)
+      off[i + 1] = off[i] + xn[i];
    
-      for (i = 0; i < 1; i++)
-      {
-         FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, s1, trunc);
-         FFT_radix2(jj, 1, jj, n, w, &u1, &u2, s2);
-         
-         for (j = 0; j < trunc; j++)
-         {
-            mpn_normmod_2expp1(jj[j], limbs);
-            mpn_normmod_2expp1(ii[j], limbs);
-            if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
-            {
-               gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, ii[j], limbs + 1, jj[j], limbs + 1);
-               abort();
-            }
-         }
-      }
-      
-      TMP_FREE;
-   }
+   tmp = FFT_alloc_limbs(off[count]);
+
+   rn = FFT_prod_tree(r, tmp, x, xn, off, 0, count, &ws, threads);
+
+   if (ws.limbs != 0)
+      FFT_free_limbs(ws.ws, ws.limbs);
+   FFT_free_limbs(tmp, off[count]);
+   free(off);
 
-   gmp_randclear(state);
+   return rn;
 }
 
-void time_mfa()
+mp_size_t mpn_prod_tree(mp_limb_t * r, mp_limb_t ** x, mp_size_t * xn, mp_size_t count)
 {
-   mp_bitcnt_t depth = 12L;
-   mp_size_t iters = 1000;
-   mp_bitcnt_t w2 = 1;
+   return mpn_prod_tree_threaded(r, x, xn, count, 1);
+}
 
-   mp_size_t n = (1UL<<depth)/w2;
-   mp_bitcnt_t w = w2*w2;
-   
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+/************************************************************************************
 
-   TMP_DECL;
+   Polynomial multiplication
 
-   TMP_MARK;
+************************************************************************************/
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
-   {
-      ii[i] = ptr;
-      if (i < n) rand_n(ii[i], state, limbs);
-      else MPN_ZERO(ii[i], limbs + 1);
-   }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
-   
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-     
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < iters; i++)
-   {
-      FFT_radix2_mfa(ii, n, w, &t1, &t2, s1, (1UL<<(depth/2))/w2);
-   }
-     
-   TMP_FREE;
-   gmp_randclear(state);
+/*
+   Returns ceil(log2(x)).
+*/
+static mp_bitcnt_t FFT_clog2(mp_size_t x)
+{
+   mp_bitcnt_t lg;
+
+   for (lg = 0; (1UL<<lg) < x; lg++) ;
+
+   return lg;
 }
 
-void time_ifft()
+/*
+   Chooses depth and w for multiplying polynomials of alen and blen 
+   coefficients over Z of at most abits and bbits bits, with the product 
+   having lg bits of growth, and how the coefficients are laid out. 
+
+   When the coefficients are small compared to the transform coefficients,
+   each transform coefficient holds k consecutive polynomial coefficients,
+   s = abits + bbits + lg + 1 bits apart, so each product needs (2k - 1)s 
+   bits plus a sign bit, and b is set to 0. Otherwise k is 1 and b is set
+   to the number of bits of each polynomial coefficient put in each of 
+   ma = ceil(abits/b) or mb = ceil(bbits/b) transform coefficients, which
+   is b*(ma + mb - 1) bits per coefficient of the product, where each 
+   transform coefficient needs 2b bits plus the growth and a sign bit.
+
+   Each layout is costed by FFT_mul_plan_cost_coeffs, as for new_mpn_mul6 
+   with the same numbers of coefficients, and so is Kronecker substitution,
+   i.e. the integer product of the coefficients packed s bits apart, by 
+   fft_mul_estimate. Returns 1 if the cheapest layout is cheaper than 
+   Kronecker substitution, otherwise 0 with the outputs set to 0.
+*/
+static int FFT_poly_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, mp_size_t * k, 
+          mp_bitcnt_t * b, mp_size_t alen, mp_size_t blen, mp_bitcnt_t abits, 
+                                           mp_bitcnt_t bbits, mp_bitcnt_t lg)
 {
-   mp_bitcnt_t depth = 16L;
-   mp_size_t iters = 1;
-   mp_bitcnt_t w = 1;
-   
-   mp_size_t n = (1UL<<depth);
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   mp_bitcnt_t d, dw, db, s = abits + bbits + lg + 1, bits;
+   mp_size_t n, dk, len, len1, len2, an, bn, ma, mb;
+   mp_size_t rlen = alen + blen - 1;
+   fft_mul_plan_t plan;
+   double best;
+   int found = 0, done;
+
+   *depth = 0;
+   *w = 0;
+   *k = 0;
+   *b = 0;
+
+   // Kronecker substitution, which if too small for the FFT is cheaper still
+   an = (alen*s - 1)/GMP_LIMB_BITS + 1;
+   bn = (blen*s - 1)/GMP_LIMB_BITS + 1;
+   if (!fft_mul_estimate(MAX(an, bn), MIN(an, bn), &plan))
+      return 0;
+   best = plan.cycles + 3.0*(an + bn)*FFT_COST_SPLIT; // pack both, read off the product
+
+   plan.variant = FFT_MUL6;
+   plan.threads = 1;
+
+   // the split coefficients are whole numbers of limbs
+   abits = GMP_LIMB_BITS*((abits + GMP_LIMB_BITS - 1)/GMP_LIMB_BITS);
+   bbits = GMP_LIMB_BITS*((bbits + GMP_LIMB_BITS - 1)/GMP_LIMB_BITS);
+
+   for (d = 6; d < GMP_LIMB_BITS/2; d++)
+   {
+      n = (1UL<<d);
+
+      // k coefficients per transform coefficient
+      dk = MAX((alen + blen)/(4*n), 1);
+      while ((alen + dk - 1)/dk + (blen + dk - 1)/dk - 1 > 4*n)
+         dk++;
+      len1 = (alen + dk - 1)/dk;
+      len2 = (blen + dk - 1)/dk;
+
+      plan.depth = d;
+      plan.w = ((2*dk - 1)*s + n)/n;
+      if (FFT_mul_plan_cost_coeffs(&plan, len1, len2) && plan.cycles < best)
+      {
+         best = plan.cycles;
+         *depth = d;
+         *w = plan.w;
+         *k = dk;
+         *b = 0;
+         found = 1;
+      }
 
-   TMP_DECL;
+      done = (dk == 1 && len1 + len2 - 1 <= 2*n); // larger transforms only add padding
 
-   TMP_MARK;
+      // each coefficient split into b bit pieces
+      len = (4*n)/rlen;
+      if (len >= 2)
+      {
+         db = (abits + bbits + len - 2)/(len - 1);
+         ma = (abits + db - 1)/db;
+         mb = (bbits + db - 1)/db;
+         len = ma + mb - 1;
+         bits = 2*db + lg + FFT_clog2(MIN(ma, mb)) + 1;
+         
+         // coefficient i of each starts at transform coefficient i*len
+         dw = (bits + n)/n;
+         plan.w = dw;
+         if (len >= 2 && FFT_mul_plan_cost_coeffs(&plan, (alen - 1)*len + ma, 
+                                          (blen - 1)*len + mb) && plan.cycles < best)
+         {
+            best = plan.cycles;
+            *depth = d;
+            *w = dw;
+            *k = 1;
+            *b = db;
+            found = 1;
+         }
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+         done &= (n > bits);
+      }
+
+      if (done)
+         break;
+   }
+
+   return found;
+}
+
+/*
+   Replaces the normalised coefficient c by its absolute value as a 
+   residue in (-2^(nw-1), 2^(nw-1)], returning 1 if it was negative. 
+*/
+static int FFT_poly_abs(mp_limb_t * c, mp_size_t limbs)
+{
+   if (c[limbs])
    {
-      ii[i] = ptr;
-      if (i < n) rand_n(ii[i], state, limbs);
-      else MPN_ZERO(ii[i], limbs + 1);
+      c[limbs] = 0;
+      MPN_ZERO(c, limbs);
+      c[0] = 1;
+      return 1;
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
-   
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-     
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < iters; i++)
+
+   if (c[limbs - 1]>>(GMP_LIMB_BITS - 1))
    {
-      IFFT_radix2(ii, 1, ii, n, w, &t1, &t2, s1);
+      mpn_neg_n(c, c, limbs);
+      mpn_add_1(c, c, limbs, 1);
+      return 1;
    }
-     
-   TMP_FREE;
-   gmp_randclear(state);
+
+   return 0;
 }
 
-void time_negacyclic_fft()
+/*
+   Negates the length coefficients of ii mod p.
+*/
+static void FFT_poly_neg(mp_limb_t ** ii, mp_size_t length, mp_size_t limbs)
 {
-   mp_bitcnt_t depth = 10L;
-   mp_size_t iters = 10000;
-   mp_bitcnt_t w = 4;
-   
-   mp_size_t n = 512;//(1UL<<depth);
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   mp_size_t j;
 
-   TMP_DECL;
+   for (j = 0; j < length; j++)
+   {
+      fft_kernels.neg_n(ii[j], ii[j], limbs + 1);
+      mpn_normmod_2expp1(ii[j], limbs);
+   }
+}
 
-   TMP_MARK;
+/*
+   Packs k coefficients of {a, alen} at a time, s bits apart, into the 
+   transform coefficients ii[j]. Returns the number of transform 
+   coefficients written.
+*/
+static mp_size_t FFT_poly_pack(mp_limb_t ** ii, mpz_t * a, mp_size_t alen, 
+                     mp_size_t k, mp_bitcnt_t s, mp_size_t limbs, mpz_t c)
+{
+   mp_size_t j, t, len = (alen + k - 1)/k;
+   size_t count;
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   for (j = 0; j < len; j++)
    {
-      ii[i] = ptr;
-      if (i < n) rand_n(ii[i], state, limbs);
-      else MPN_ZERO(ii[i], limbs + 1);
+      mpz_set_ui(c, 0);
+      for (t = MIN(k, alen - j*k) - 1; t >= 0; t--)
+      {
+         mpz_mul_2exp(c, c, s);
+         mpz_add(c, c, a[j*k + t]);
+      }
+
+      MPN_ZERO(ii[j], limbs + 1);
+      mpz_export(ii[j], &count, -1, sizeof(mp_limb_t), 0, 0, c);
+      if (mpz_sgn(c) < 0)
+         FFT_poly_neg(ii + j, 1, limbs);
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-     
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < iters; i++)
+   return len;
+}
+
+/*
+   Splits each coefficient of {a, alen} into b bit pieces with FFT_split_bits,
+   coefficient i starting at transform coefficient i*stride, after zeroing 
+   the first len transform coefficients. The stride must allow for the 
+   pieces of whole limbs. Returns the number of transform coefficients used.
+*/
+static mp_size_t FFT_poly_split(mp_limb_t ** ii, mpz_t * a, mp_size_t alen, 
+                mp_size_t stride, mp_bitcnt_t b, mp_size_t limbs, mp_size_t len)
+{
+   mp_size_t i, j, m;
+
+   for (j = 0; j < len; j++)
+      MPN_ZERO(ii[j], limbs + 1);
+
+   for (i = 0; i < alen; i++)
    {
-      FFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, s1);
+      if (mpz_sgn(a[i]) == 0)
+         continue;
+
+      m = FFT_split_bits(ii + i*stride, PTR(a[i]), ABSIZ(a[i]), b, limbs);
+      if (mpz_sgn(a[i]) < 0)
+         FFT_poly_neg(ii + i*stride, m, limbs);
    }
-     
-   TMP_FREE;
-   gmp_randclear(state);
+
+   return (alen - 1)*stride + 1;
 }
 
-void time_imfa()
+/*
+   Sets d to bits pos to pos + s - 1 of {x, xn}.
+*/
+static void FFT_poly_bits(mpz_t d, mp_srcptr x, mp_size_t xn, 
+                                      mp_bitcnt_t pos, mp_bitcnt_t s)
 {
-   mp_bitcnt_t depth = 16L;
-   mp_size_t iters = 1;
-   mp_bitcnt_t w2 = 1;
+   mp_size_t q = pos/GMP_LIMB_BITS;
 
-   mp_bitcnt_t w = w2*w2;
-   mp_size_t n = (1UL<<depth)/w2;
-   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
-   mp_size_t size = limbs + 1;
-   mp_size_t i, j, s;
-   mp_limb_t * ptr;
-   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
-   mp_limb_t c;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   if (q >= xn)
+   {
+      mpz_set_ui(d, 0);
+      return;
+   }
 
-   TMP_DECL;
+   mpz_import(d, MIN(xn - q, s/GMP_LIMB_BITS + 2), -1, sizeof(mp_limb_t), 0, 0, x + q);
+   mpz_tdiv_q_2exp(d, d, pos % GMP_LIMB_BITS);
+   mpz_tdiv_r_2exp(d, d, s);
+}
 
-   TMP_MARK;
+/*
+   Adds the 2k - 1 polynomial coefficients held s bits apart in c, which 
+   is the absolute value of a product coefficient and is negated if neg 
+   is set, to {r + o, rlen - o}. As they are signed they are read off as 
+   balanced digits, which is exact as each is less than 2^(s-1) in 
+   absolute value. h is 2^s.
+*/
+static void FFT_poly_unpack(mpz_t * r, mp_size_t o, mp_size_t rlen, mpz_t c, 
+                       mp_size_t k, mp_bitcnt_t s, mpz_t d, mpz_t h, int neg)
+{
+   mp_srcptr x = PTR(c);
+   mp_size_t t, xn = ABSIZ(c);
+   int carry = 0;
 
-   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
-   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   if (k == 1)
    {
-      ii[i] = ptr;
-      if (i < n) rand_n(ii[i], state, limbs);
-      else MPN_ZERO(ii[i], limbs + 1);
+      if (neg)
+         mpz_sub(r[o], r[o], c);
+      else
+         mpz_add(r[o], r[o], c);
+      return;
    }
-   t1 = ptr;
-   t2 = t1 + size;
-   s1 = (mp_limb_t **) t2 + size;
 
-   for (j = 0; j < 2*n; j++)
-      mpn_normmod_2expp1(ii[j], limbs);
-     
-   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
-   
-   for (i = 0; i < iters; i++)
+   for (t = 0; t < 2*k - 1 && o + t < rlen; t++)
    {
-      IFFT_radix2_mfa(ii, n, w, &t1, &t2, s1, (1UL<<(depth/2))/w2);
+      FFT_poly_bits(d, x, xn, t*s, s);
+      if (carry)
+         mpz_add_ui(d, d, 1);
+      carry = 0;
+      if (t < 2*k - 2 && mpz_sizeinbase(d, 2) >= s)
+      {
+         mpz_sub(d, d, h);
+         carry = 1;
+      }
+
+      if (neg)
+         mpz_sub(r[o + t], r[o + t], d);
+      else
+         mpz_add(r[o + t], r[o + t], d);
    }
-     
-   TMP_FREE;
-   gmp_randclear(state);
 }
 
-void time_mul()
+/*
+   Sets c to the sum of the len signed product coefficients ii[j] shifted
+   by j*b bits, using FFT_combine_bits once for the positive and once for
+   the negative ones. pp and nn have room for len pointers and z is a 
+   zero coefficient.
+*/
+static void FFT_poly_combine(mpz_t c, mpz_t d, mp_limb_t ** ii, mp_size_t len, 
+               mp_bitcnt_t b, mp_size_t limbs, mp_limb_t ** pp, mp_limb_t ** nn,
+                                           mp_limb_t * z, mp_limb_t * acc)
 {
-   mp_bitcnt_t depth = 10UL;
-   mp_bitcnt_t w = 3UL;
-   mp_size_t iters = 100;
+   mp_size_t j, total = ((len - 1)*b)/GMP_LIMB_BITS + limbs + 2;
 
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - depth)/2; 
-   mp_bitcnt_t bits = (8364032*8)/8; //n*bits1;
-   printf("bits = %ld\n", bits);
-   mp_size_t int_limbs = (bits - 1UL)/GMP_LIMB_BITS + 1;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   for (j = 0; j < len; j++)
+   {
+      if (FFT_poly_abs(ii[j], limbs))
+      {
+         pp[j] = z;
+         nn[j] = ii[j];
+      } else
+      {
+         pp[j] = ii[j];
+         nn[j] = z;
+      }
+   }
 
-   TMP_DECL;
+   MPN_ZERO(acc, total);
+   FFT_combine_bits(acc, pp, len, b, limbs, total);
+   mpz_import(c, total, -1, sizeof(mp_limb_t), 0, 0, acc);
 
-   TMP_MARK;
+   MPN_ZERO(acc, total);
+   FFT_combine_bits(acc, nn, len, b, limbs, total);
+   mpz_import(d, total, -1, sizeof(mp_limb_t), 0, 0, acc);
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   mpn_urandomb(i1, state, bits);
-   mpn_urandomb(i2, state, bits);
-  
-   for (i = 0; i < iters; i++)
-   {
-      new_mpn_mul(r1, i1, int_limbs, i2, int_limbs, depth, w);
-   }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+   mpz_sub(c, c, d);
 }
 
-void time_mul2()
+/*
+   Sets c to {a, alen} evaluated at 2^s, s being more than the bits of any
+   coefficient, packing the positive and the negative coefficients into 
+   p and q separately, each of (alen*s)/GMP_LIMB_BITS + 2 limbs, so that 
+   no carries arise. t has room for the limbs of any coefficient plus 1.
+*/
+static void FFT_poly_ks_pack(mpz_t c, mpz_t d, mpz_t * a, mp_size_t alen, 
+                  mp_bitcnt_t s, mp_limb_t * p, mp_limb_t * q, mp_limb_t * t)
 {
-   mp_bitcnt_t depth = 17UL;
-   mp_bitcnt_t w = 1UL;
-   mp_size_t iters = 1;
+   mp_size_t i, m, total = (alen*s)/GMP_LIMB_BITS + 2;
+   mp_bitcnt_t pos;
+   mp_limb_t * x;
 
-   mp_size_t n = (1UL<<depth);
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = 2*n*bits1;
-   printf("bits = %ld\n", bits);
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   MPN_ZERO(p, total);
+   MPN_ZERO(q, total);
 
-   TMP_DECL;
+   for (i = 0; i < alen; i++)
+   {
+      m = ABSIZ(a[i]);
+      if (m == 0)
+         continue;
 
-   TMP_MARK;
+      pos = i*s;
+      x = (mpz_sgn(a[i]) > 0 ? p : q) + pos/GMP_LIMB_BITS;
+      if (pos % GMP_LIMB_BITS)
+         t[m] = mpn_lshift(t, PTR(a[i]), m, pos % GMP_LIMB_BITS);
+      else
+      {
+         MPN_COPY(t, PTR(a[i]), m);
+         t[m] = 0;
+      }
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   mpn_urandomb(i1, state, bits);
-   mpn_urandomb(i2, state, bits);
-  
-   for (i = 0; i < iters; i++)
-   {
-      new_mpn_mul3(r1, i1, int_limbs, i2, int_limbs, depth, w, sqrt);
-      //mpn_mul(r1, i1, int_limbs, i2, int_limbs);
+      // the bits of x are zero where t is nonzero
+      mpn_add_n(x, x, t, m + 1);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   mpz_import(c, total, -1, sizeof(mp_limb_t), 0, 0, p);
+   mpz_import(d, total, -1, sizeof(mp_limb_t), 0, 0, q);
+   mpz_sub(c, c, d);
 }
 
-void time_mul4()
+/*
+   Sets {r, alen + blen - 1} to the product of {a, alen} and {b, blen} by
+   Kronecker substitution, packing their coefficients s bits apart into 
+   integers, multiplying them with mpz_mul_fft, i.e. new_mpn_mul_auto, and 
+   reading off the product coefficients as balanced digits with 
+   FFT_poly_unpack. abits and bbits are the bits of the largest 
+   coefficients and s is as for FFT_poly_params.
+*/
+static void FFT_poly_ks(mpz_t * r, mpz_t * a, mp_size_t alen, mpz_t * b, 
+            mp_size_t blen, mp_bitcnt_t abits, mp_bitcnt_t bbits, mp_bitcnt_t s)
 {
-   mp_bitcnt_t depth = 13UL;
-   mp_bitcnt_t w = 1UL;
-   mp_size_t iters = 1;
-
-   mp_size_t n = (1UL<<depth);
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = 2*n*bits1;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   //mp_size_t n1 = (3*int_limbs)/4;
-   //mp_size_t n2 = (3*int_limbs)/4;
-   mp_size_t n1 = int_limbs;
-   mp_size_t n2 = int_limbs;
-   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
-   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
-
+   mp_size_t i, rlen = alen + blen - 1, len = MAX(alen, blen);
+   mp_bitcnt_t bits = MAX(abits, bbits);
+   mp_limb_t * p, * q, * t;
+   mpz_t x, y, d, h;
+   int sqr = (a == b && alen == blen), neg;
    TMP_DECL;
 
    TMP_MARK;
-
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   mpn_urandomb(i1, state, b1);
-   mpn_urandomb(i2, state, b2);
-  
-   printf("b1 = %ld, b2 = %ld\n", b1, b2);
-
-   for (i = 0; i < iters; i++)
+   p = TMP_BALLOC_LIMBS(2*((len*s)/GMP_LIMB_BITS + 2) + bits/GMP_LIMB_BITS + 2);
+   q = p + (len*s)/GMP_LIMB_BITS + 2;
+   t = q + (len*s)/GMP_LIMB_BITS + 2;
+
+   mpz_init(x);
+   mpz_init(y);
+   mpz_init(d);
+   mpz_init(h);
+   mpz_setbit(h, s);
+
+   FFT_poly_ks_pack(x, d, a, alen, s, p, q, t);
+   if (sqr)
+      mpz_mul_fft(x, x, x);
+   else
    {
-      new_mpn_mul4(r1, i1, n1, i2, n2, depth, w);
-      //mpn_mul(r1, i1, n1, i2, n2);
+      FFT_poly_ks_pack(y, d, b, blen, s, p, q, t);
+      mpz_mul_fft(x, x, y);
    }
-      
+
+   neg = (mpz_sgn(x) < 0);
+   mpz_abs(x, x);
+
+   for (i = 0; i < rlen; i++)
+      mpz_set_ui(r[i], 0);
+   FFT_poly_unpack(r, 0, rlen, x, rlen/2 + 1, s, d, h, neg);
+
+   mpz_clear(x);
+   mpz_clear(y);
+   mpz_clear(d);
+   mpz_clear(h);
    TMP_FREE;
-   gmp_randclear(state);
 }
 
-void time_mul6()
+/*
+   Sets {r, alen + blen - 1} to the product of the polynomials {a, alen}
+   and {b, blen} with integer coefficients, which may be negative. The 
+   coefficients are mapped directly to transform coefficients: several 
+   per transform coefficient when they are small, with only the guard bits
+   for the growth of the product between them, and split over several 
+   when they are large, see FFT_poly_params. If no such layout is 
+   predicted to be cheaper, Kronecker substitution is used instead. The 
+   entries of r must be initialised 
+   and distinct from those of a and b. Squaring is detected if a == b and
+   alen == blen.
+*/
+void fft_poly_mul(mpz_t * r, mpz_t * a, mp_size_t alen, mpz_t * b, mp_size_t blen)
 {
-   mp_bitcnt_t depth = 13UL;
-   mp_bitcnt_t w = 2UL;
-   mp_size_t iters = 1;
+   mp_bitcnt_t abits = 1, bbits = 1, lg, s, depth, w, pb;
+   mp_size_t n, sqrt, limbs, size, k, rlen, len1, len2, len, stride;
+   mp_size_t trunc, depth2, i, j, t, u, ws_limbs;
+   mp_limb_t * ws, * ptr, ** ii, ** jj, * t1, * t2, * s1, * tt;
+   int sqr = (a == b && alen == blen);
+   mpz_t c, d, h;
+   FFT_PHASE_DECL;
+
+   if (alen == 0 || blen == 0)
+      return;
 
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = 2*n*bits1;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   mp_size_t n1 = (3*int_limbs)/4;
-   mp_size_t n2 = (3*int_limbs)/4;
-   //mp_size_t n1 = int_limbs;
-   //mp_size_t n2 = int_limbs;
-   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
-   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   rlen = alen + blen - 1;
 
-   TMP_DECL;
+   for (i = 0; i < alen; i++)
+      abits = MAX(abits, mpz_sizeinbase(a[i], 2));
+   for (i = 0; i < blen; i++)
+      bbits = MAX(bbits, mpz_sizeinbase(b[i], 2));
+   lg = FFT_clog2(MIN(alen, blen));
+   s = abits + bbits + lg + 1;
 
-   TMP_MARK;
+   if (!FFT_poly_params(&depth, &w, &k, &pb, alen, blen, abits, bbits, lg))
+   {
+      FFT_poly_ks(r, a, alen, b, blen, abits, bbits, s);
+      return;
+   }
+
+   n = (1UL<<depth);
+   sqrt = (1UL<<(depth/2));
+   limbs = (n*w)/GMP_LIMB_BITS;
+   size = limbs + 1;
+   depth2 = depth - (depth/2);
+
+   ws_limbs = new_mpn_mul6_workspace(depth, w);
+   ws = FFT_alloc_limbs(ws_limbs);
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
+   ii = (mp_limb_t **) ws;
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
    
-   mpn_urandomb(i1, state, b1);
-   mpn_urandomb(i2, state, b2);
-  
-   printf("b1 = %ld, b2 = %ld\n", b1, b2);
+   jj = (mp_limb_t **) (s1 + size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+   }
+   tt = ptr;
+
+   mpz_init(c);
+   mpz_init(d);
+   mpz_init(h);
+   mpz_setbit(h, s);
 
-   for (i = 0; i < iters; i++)
+   if (pb != 0)
+      stride = (GMP_LIMB_BITS*((abits + GMP_LIMB_BITS - 1)/GMP_LIMB_BITS) + pb - 1)/pb
+             + (GMP_LIMB_BITS*((bbits + GMP_LIMB_BITS - 1)/GMP_LIMB_BITS) + pb - 1)/pb - 1;
+
+   FFT_PHASE_START;
+   if (pb == 0)
+   {
+      len1 = FFT_poly_pack(ii, a, alen, k, s, limbs, c);
+      len2 = sqr ? len1 : FFT_poly_pack(jj, b, blen, k, s, limbs, c);
+      len = len1 + len2 - 1;
+      for (j = len1; j < 4*n; j++)
+         MPN_ZERO(ii[j], limbs + 1);
+      if (!sqr)
+         for (j = len2; j < 4*n; j++)
+            MPN_ZERO(jj[j], limbs + 1);
+   } else
    {
-      new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
-      //mpn_mul(r1, i1, n1, i2, n2);
+      len = rlen*stride;
+      FFT_poly_split(ii, a, alen, stride, pb, limbs, 4*n);
+      if (!sqr)
+         FFT_poly_split(jj, b, blen, stride, pb, limbs, 4*n);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
-}
+   FFT_PHASE_END(FFT_PHASE_SPLIT);
 
-void test_mul()
-{
-   mp_bitcnt_t depth = 15UL;
-   mp_bitcnt_t w = 2UL;
-   mp_size_t iters = 1;
+   trunc = MAX(2*((len + 1)/2), 2*n + 2);
 
-   mp_size_t n = (1UL<<depth);
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = 2*n*bits1;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+   if (sqr)
+      jj = ii;
+   else
+      FFT_radix2_mfa_truncate_sqrt2(jj, n, w, &t1, &t2, &s1, sqrt, trunc);
 
-   TMP_DECL;
+   FFT_PHASE_START;
+   for (j = 0; j < 2*n; j++)
+   {
+      fft_mulmod_2expp1(ii[j], ii[j], jj[j], n, w, tt);
+   }
+   for (j = 0; j*sqrt < trunc - 2*n; j++)
+   {
+      mp_size_t v = mpir_revbin(j, depth2 + 1);
+      for (t = 0; t < sqrt && j*sqrt + t < trunc - 2*n; t++)
+      {
+         u = 2*n + v*sqrt + t;
+         fft_mulmod_2expp1(ii[u], ii[u], jj[u], n, w, tt);
+      }
+   }
+   FFT_PHASE_END(FFT_PHASE_POINTWISE);
 
-   TMP_MARK;
+   IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   for (i = 0; i < iters; i++)
+   FFT_PHASE_START;
+   for (j = 0; j < len; j++)
    {
-      mpn_urandomb(i1, state, bits);
-      mpn_urandomb(i2, state, bits);
-  
-      mpn_mul_n(r2, i1, i2, int_limbs);
-      new_mpn_mul3(r1, i1, int_limbs, i2, int_limbs, depth, w, sqrt);
-      
-      for (j = 0; j < 2*int_limbs; j++)
+      mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 2);
+      mpn_normmod_2expp1(ii[j], limbs);
+   }
+   FFT_PHASE_END(FFT_PHASE_SCALE);
+
+   FFT_PHASE_START;
+   if (pb == 0)
+   {
+      for (i = 0; i < rlen; i++)
+         mpz_set_ui(r[i], 0);
+      for (j = 0; j < len; j++)
       {
-         if (r1[j] != r2[j]) 
-         {
-            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
-            abort();
-         } 
+         int neg = FFT_poly_abs(ii[j], limbs);
+
+         mpz_import(c, limbs, -1, sizeof(mp_limb_t), 0, 0, ii[j]);
+         FFT_poly_unpack(r, j*k, rlen, c, k, s, d, h, neg);
       }
+   } else
+   {
+      // the second half of ws is no longer needed
+      mp_limb_t ** pp = (mp_limb_t **) (s1 + size);
+      mp_limb_t ** nn = pp + stride;
+      mp_limb_t * z = (mp_limb_t *) (nn + stride);
+      mp_limb_t * acc = z + size;
+
+      MPN_ZERO(z, size);
+      for (i = 0; i < rlen; i++)
+         FFT_poly_combine(r[i], d, ii + i*stride, stride, pb, limbs, pp, nn, z, acc);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+   FFT_PHASE_END(FFT_PHASE_COMBINE);
+
+   mpz_clear(c);
+   mpz_clear(d);
+   mpz_clear(h);
+   FFT_free_limbs(ws, ws_limbs);
 }
 
-void test_mul5()
-{
-   mp_bitcnt_t depth = 14UL;
-   mp_bitcnt_t w = 1UL;
-   mp_size_t iters = 1;
+/************************************************************************************
 
-   mp_size_t n = (1UL<<depth);
-   mp_size_t sqrt = (1UL<<(depth/2));
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = n*bits1;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   mp_size_t n1 = (3*int_limbs)/4;
-   mp_size_t n2 = (3*int_limbs)/4;
-   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
-   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   Batched multiplication
 
-   TMP_DECL;
+************************************************************************************/
 
-   TMP_MARK;
+/*
+   A run of products of a batch, products lo, lo + step, ... below hi.
+*/
+typedef struct
+{
+   mp_limb_t ** r, ** i1, ** i2;
+   mp_size_t n1, n2, lo, hi, step;
+   mp_bitcnt_t depth, w;
+   int fft, shared;
+} fft_batch_arg_t;
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   for (i = 0; i < iters; i++)
+/*
+   Computes the products of a run with one workspace, or if every product 
+   has the same second operand, with one transform of it.
+*/
+static void * FFT_batch_worker(void * arg)
+{
+   fft_batch_arg_t * a = (fft_batch_arg_t *) arg;
+   fft_mul_precomp_t pre;
+   mp_limb_t * ws;
+   mp_size_t i, ws_limbs;
+
+   if (!a->fft)
    {
-      mpn_urandomb(i1, state, b1);
-      mpn_urandomb(i2, state, b2);
-  
-      mpn_mul(r2, i1, n1, i2, n2);
-      new_mpn_mul5(r1, i1, n1, i2, n2, depth, w);
-      
-      for (j = 0; j < n1+n2; j++)
-      {
-         if (r1[j] != r2[j]) 
-         {
-            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
-            abort();
-         } 
-      }
+      for (i = a->lo; i < a->hi; i += a->step)
+         mpn_mul(a->r[i], a->i1[i], a->n1, a->i2[i], a->n2);
+   } else if (a->shared)
+   {
+      FFT_mul_precomp_init_params(&pre, a->i2[a->lo], a->n2, a->n1, a->depth, a->w);
+      for (i = a->lo; i < a->hi; i += a->step)
+         fft_mul_precomp(a->r[i], a->i1[i], a->n1, &pre);
+      fft_mul_precomp_clear(&pre);
+   } else
+   {
+      ws_limbs = new_mpn_mul6_workspace(a->depth, a->w);
+      ws = FFT_alloc_limbs(ws_limbs);
+      for (i = a->lo; i < a->hi; i += a->step)
+         new_mpn_mul6_ws(a->r[i], a->i1[i], a->n1, a->i2[i], a->n2, a->depth, a->w, ws);
+      FFT_free_limbs(ws, ws_limbs);
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
+
+   return NULL;
 }
 
-void test_mul4()
+#if FFT_THREADS
+
+/*
+   Start routine of the threads which compute the other shares of a batch.
+*/
+static void * FFT_batch_thread(void * arg)
 {
-   mp_bitcnt_t depth = 14UL;
-   mp_bitcnt_t w = 1UL;
-   mp_size_t iters = 1;
+   FFT_PHASE_WORKER;
 
-   mp_size_t n = (1UL<<depth);
-   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
-   mp_bitcnt_t bits = 2*n*bits1;
-   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
-   mp_size_t n1 = (3*int_limbs)/4;
-   mp_size_t n2 = (3*int_limbs)/4;
-   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
-   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
-   
-   mp_size_t i, j;
-   mp_limb_t *i1, *i2, *r1, *r2;
-   gmp_randstate_t state;
-   gmp_randinit_default(state);
+   return FFT_batch_worker(arg);
+}
 
-   TMP_DECL;
+#endif
 
-   TMP_MARK;
+/*
+   Sets {r[i], n1 + n2} to the product of {i1[i], n1} and {i2[i], n2} for 
+   0 <= i < count, where n1 >= n2. The parameters are chosen once for the
+   whole batch. When there are at least as many products as threads, each
+   thread computes every threads-th product with its own workspace, which 
+   is reused from one product to the next and stays in cache when the 
+   products are small. Fewer products are done one after another, each 
+   with all the threads. If i2[i] is the same for all i, each thread only
+   transforms it once, see fft_mul_precomp. Squarings (i1[i] == i2[i] and
+   n1 == n2) are detected as for new_mpn_mul6.
+*/
+void mpn_mul_fft_batch_threaded(mp_limb_t ** r, mp_limb_t ** i1, mp_size_t n1, 
+         mp_limb_t ** i2, mp_size_t n2, mp_size_t count, int threads)
+{
+   fft_mul_plan_t plan;
+   fft_batch_arg_t arg;
+   mp_size_t i;
 
-   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
-   i2 = i1 + int_limbs;
-   r1 = i2 + int_limbs;
-   r2 = r1 + 2*int_limbs;
-   
-   for (i = 0; i < iters; i++)
-   {
-      mpn_urandomb(i1, state, b1);
-      mpn_urandomb(i2, state, b2);
-  
-      mpn_mul(r2, i1, n1, i2, n2);
-      new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+   if (count == 0)
+      return;
+
+   arg.r = r;
+   arg.i1 = i1;
+   arg.i2 = i2;
+   arg.n1 = n1;
+   arg.n2 = n2;
+   arg.lo = 0;
+   arg.hi = count;
+   arg.step = 1;
+   arg.fft = fft_mul_estimate(n1, n2, &plan);
+   arg.depth = arg.fft ? plan.depth : 0;
+   arg.w = arg.fft ? plan.w : 0;
+
+   for (i = 1; i < count && i2[i] == i2[0]; i++) ;
+   arg.shared = (count > 1 && i == count);
+
+#if FFT_THREADS
+   if (threads > 1 && count >= threads)
+   {
+      fft_batch_arg_t * args;
+      pthread_t * pt;
+      int * started;
+      int t;
+
+      args = (fft_batch_arg_t *) malloc(threads*sizeof(fft_batch_arg_t));
+      pt = (pthread_t *) malloc(threads*sizeof(pthread_t));
+      started = (int *) malloc(threads*sizeof(int));
       
-      for (j = 0; j < n1+n2; j++)
+      for (t = 0; t < threads; t++)
       {
-         if (r1[j] != r2[j]) 
-         {
-            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
-            abort();
-         } 
+         args[t] = arg;
+         args[t].lo = t;
+         args[t].step = threads;
       }
+
+      // a share whose thread cannot be created is done by this thread
+      for (t = 1; t < threads; t++)
+         started[t] = (pthread_create(pt + t, NULL, FFT_batch_thread, args + t) == 0);
+      FFT_batch_worker(args);
+      for (t = 1; t < threads; t++)
+      {
+         if (started[t])
+            pthread_join(pt[t], NULL);
+         else
+            FFT_batch_worker(args + t);
+      }
+
+      free(started);
+      free(pt);
+      free(args);
+      return;
    }
-      
-   TMP_FREE;
-   gmp_randclear(state);
-} 
-
-int main(void)
-{
-#if TEST
-   test_mulmod(); printf("MULMOD....PASS\n");
-   test_fft_ifft_negacyclic(); printf("FFT_IFFT_NEGACYCLIC...PASS\n");
-   test_mul4(); printf("MUL4...PASS\n");
-   test_fft_ifft_mfa_truncate(); printf("FFT_IFFT_MFA_TRUNCATE...PASS\n");
-   test_fft_ifft_mfa(); printf("FFT_IFFT_MFA...PASS\n");
-   test_fft_ifft_mfa_sqrt2(); printf("FFT_IFFT_MFA_SQRT2...PASS\n");
-   test_fft_ifft_mfa_truncate_sqrt2(); printf("FFT_IFFT_MFA_TRUNCATE_SQRT2...PASS\n");
-   test_mul5(); printf("MUL5...PASS\n");
-   
-   test_fft_ifft_sqrt2(); printf("FFT_IFFT_SQRT...PASS\n");
-   test_norm(); printf("mpn_normmod_2expp1...PASS\n");
-   test_mul_2expmod(); printf("mpn_mul_2expmod_2expp1...PASS\n");
-   test_div_2expmod(); printf("mpn_div_2expmod_2expp1...PASS\n");
-   test_lshB_sumdiffmod(); printf("mpn_lshB_sumdiffmod_2expp1...PASS\n");
-   test_sumdiff_rshBmod(); printf("mpn_sumdiff_rshBmod_2expp1...PASS\n");
-   
-   test_FFT_negacyclic_twiddle(); printf("FFT_negacyclic_twiddle...PASS\n");
-   test_fft_ifft(); printf("FFT_IFFT...PASS\n");
-   test_fft_truncate(); printf("FFT_TRUNCATE...PASS\n");
-   test_fft_ifft_truncate(); printf("FFT_IFFT_TRUNCATE...PASS\n");
-   test_fft_ifft_truncate_sqrt2(); printf("FFT_IFFT_TRUNCATE_SQRT2...PASS\n");
-   
-#endif
 
-#if TIME
-   //time_ifft();
-   //time_mfa();
-   //time_imfa();
-   //time_mul_with_negacyclic(); // negacyclic is currently *disabled*
-   //time_negacyclic_fft();
-   time_mul6();
+   if (threads > 1 && arg.fft)
+   {
+      for (i = 0; i < count; i++)
+         new_mpn_mul6_threaded(r[i], i1[i], n1, i2[i], n2, arg.depth, arg.w, threads);
+      return;
+   }
 #endif
 
-   return 0;
+   FFT_batch_worker(&arg);
+}
+
+void mpn_mul_fft_batch(mp_limb_t ** r, mp_limb_t ** i1, mp_size_t n1, 
+                       mp_limb_t ** i2, mp_size_t n2, mp_size_t count)
+{
+   mpn_mul_fft_batch_threaded(r, i1, n1, i2, n2, count, 1);
 }
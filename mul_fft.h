@@ -1,4 +1,4 @@
-/* mul_fft -- split-radix fft routines for MPIR.
+/* mul_fft -- radix 2 fft routines for MPIR.
 
 Copyright 2009, 2011 William Hart. All rights reserved.
 
@@ -28,14 +28,43 @@ or implied, of William Hart.
 
 */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include "mpir.h"
-#include "gmp-impl.h"
+/*
+   Internal interface, shared by the library, test and timing code. 
+   Applications should include mpirfft.h.
+*/
 
 #ifndef MUL_FFT_H
 #define MUL_FFT_H
 
+#ifndef FFT_THREADS
+#define FFT_THREADS 0 /* build with -DFFT_THREADS=1 -lpthread for threads */
+#endif
+
+#ifndef FFT_BENCH
+#define FFT_BENCH 0 /* build with -DFFT_BENCH=1 for the benchmark driver */
+#endif
+
+#ifndef FFT_PHASE_STATS
+#define FFT_PHASE_STATS 0 /* build with -DFFT_PHASE_STATS=1 to time each phase */
+#endif
+
+#ifndef FFT_PERF_EVENTS
+#define FFT_PERF_EVENTS 0 /* build with -DFFT_PERF_EVENTS=1 to count hardware events */
+#endif
+
+#ifndef FFT_OP_COUNTS
+#define FFT_OP_COUNTS 0 /* build with -DFFT_OP_COUNTS=1 to count kernel calls */
+#endif
+
+#if FFT_PERF_EVENTS /* implies FFT_PHASE_STATS */
+#undef FFT_PHASE_STATS
+#define FFT_PHASE_STATS 1
+#endif
+
+#include "mpir.h"
+#include "gmp-impl.h"
+#include "mpirfft.h"
+
 /*
    Add the signed limb c to the value r which is an integer 
    modulo 2^GMP_LIMB_BITS*l + 1. We assume that the generic case
@@ -57,26 +86,319 @@ void mpn_addmod_2expp1_1(mp_limb_t * r, mp_size_t l, mp_limb_signed_t c)
    }
 }
 
-void mpn_to_mpz(mpz_t m, mp_limb_t * i, mp_size_t limbs);
+/*
+   The kernels which are dispatched at runtime, see fft_kernels.c. The
+   mpn_*_2expp1 functions call through this table.
+*/
+typedef struct
+{
+   const char * name;
+   unsigned int features;
+   void (*normmod)(mp_limb_t * t, mp_size_t l);
+   void (*lshB_sumdiffmod)(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
+   void (*sumdiff_rshBmod)(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
+   void (*mul_2expmod)(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+   void (*div_2expmod)(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+   mp_limb_t (*neg_n)(mp_limb_t * r, mp_limb_t * s, mp_size_t n);
+   void (*addlsh)(mp_limb_t * r, mp_limb_t * a, mp_size_t n, 
+                                    mp_bitcnt_t s, mp_limb_t * temp);
+} fft_kernels_t;
 
-void set_p(mpz_t p, mp_size_t n, mp_bitcnt_t w);
+extern fft_kernels_t fft_kernels;
 
-void rand_n(mp_limb_t * n, gmp_randstate_t state, mp_size_t limbs);
+void mpn_normmod_2expp1_generic(mp_limb_t * t, mp_size_t l);
 
-void ref_mul_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d);
+void mpn_lshB_sumdiffmod_2expp1_generic(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
 
-void ref_norm(mpz_t m, mpz_t p);
+void mpn_sumdiff_rshBmod_2expp1_generic(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
 
-void ref_sumdiff_rshBmod(mpz_t t, mpz_t u, mpz_t i1,
-                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y);
+void mpn_mul_2expmod_2expp1_generic(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+
+void mpn_div_2expmod_2expp1_generic(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+
+mp_limb_t mpn_neg_n_generic(mp_limb_t * r, mp_limb_t * s, mp_size_t n);
+
+void mpn_addlsh_generic(mp_limb_t * r, mp_limb_t * a, mp_size_t n, 
+                                    mp_bitcnt_t s, mp_limb_t * temp);
+
+mp_limb_t mpir_revbin(mp_limb_t in, mp_bitcnt_t bits);
+
+mp_size_t FFT_split(mp_limb_t ** poly, mp_limb_t * limbs, 
+                mp_size_t total_limbs, mp_size_t coeff_limbs, mp_size_t output_limbs);
+
+mp_size_t FFT_split_bits(mp_limb_t ** poly, mp_limb_t * limbs, 
+               mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs);
+
+void FFT_split_bits_coeff(mp_limb_t * coeff, mp_limb_t * limbs,
+    mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs, mp_size_t i);
+
+void FFT_combine(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+            mp_size_t coeff_limbs, mp_size_t output_limbs, mp_size_t total_limbs);
+
+void FFT_combine_bits(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+                  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs);
+
+mp_size_t FFT_split_bits_signed(mp_limb_t ** poly, mp_limb_t * limbs, 
+               mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs);
+
+void FFT_split_bits_coeff_signed(mp_limb_t * coeff, mp_limb_t * limbs,
+    mp_size_t total_limbs, mp_size_t bits, mp_size_t output_limbs, mp_size_t i);
+
+void FFT_combine_bits_signed(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+                  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs);
+
+/*
+   With FFT_SIGNED_SPLIT set, new_mpn_mul6 and the multipliers built on 
+   it split their inputs into balanced coefficients at even depths, where
+   the bit of headroom this saves gives bits1 one more bit. At odd depths 
+   bits1 would be no larger, so the unsigned split is kept. The number of
+   balanced coefficients of an integer is never more than the number of 
+   unsigned ones of one bit less.
+*/
+#ifndef FFT_SIGNED_SPLIT
+#define FFT_SIGNED_SPLIT 1
+#endif
+
+#define FFT_MUL6_SIGNED(depth) (FFT_SIGNED_SPLIT && ((depth) & 1) == 0)
+
+#define FFT_MUL6_BITS1(n, w, depth) (((n)*(w) - (depth) - !FFT_MUL6_SIGNED(depth))/2)
+
+#define FFT_MUL6_COEFFS(limbs, bits1, depth) (FFT_MUL6_SIGNED(depth) \
+   ? ((limbs)*GMP_LIMB_BITS)/(bits1) + 1 : ((limbs)*GMP_LIMB_BITS - 1)/(bits1) + 1)
+
+mp_size_t FFT_mul6_split(mp_limb_t ** poly, mp_limb_t * limbs, mp_size_t total_limbs, 
+                     mp_size_t bits, mp_size_t output_limbs, mp_bitcnt_t depth);
+
+void FFT_mul6_split_coeff(mp_limb_t * coeff, mp_limb_t * limbs, mp_size_t total_limbs, 
+         mp_size_t bits, mp_size_t output_limbs, mp_size_t i, mp_bitcnt_t depth);
+
+void FFT_mul6_combine(mp_limb_t * res, mp_limb_t ** poly, mp_size_t length, 
+  mp_size_t bits, mp_size_t output_limbs, mp_size_t total_limbs, mp_bitcnt_t depth,
+  mp_bitcnt_t scale);
+
+void mpn_normmod_2expp1(mp_limb_t * t, mp_size_t l);
+
+void mpn_lshB_sumdiffmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
+
+void mpn_sumdiff_rshBmod_2expp1(mp_limb_t * t, mp_limb_t * u, mp_limb_t * i1, 
+                      mp_limb_t * i2, mp_size_t limbs, mp_size_t x, mp_size_t y);
+
+void mpn_mul_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+
+void mpn_div_2expmod_2expp1(mp_limb_t * t, mp_limb_t * i1, mp_size_t limbs, mp_bitcnt_t d);
+
+void FFT_radix2_twiddle_butterfly(mp_limb_t * u, mp_limb_t * v, 
+          mp_limb_t * s, mp_limb_t * t, mp_size_t NW, mp_bitcnt_t b1, mp_bitcnt_t b2);
+
+void FFT_radix2_butterfly(mp_limb_t * s, mp_limb_t * t, 
+                  mp_limb_t * i1, mp_limb_t * i2, mp_size_t i, mp_size_t n, mp_bitcnt_t w);
+
+void FFT_radix2_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t, 
+  mp_limb_t * i1, mp_limb_t * i2, mp_size_t i, mp_size_t n, mp_bitcnt_t w, mp_limb_t * temp);
+
+void FFT_radix2_inverse_butterfly(mp_limb_t * s, mp_limb_t * t, 
+                  mp_limb_t * i1, mp_limb_t * i2, mp_size_t i, mp_size_t n, mp_bitcnt_t w);
+
+void FFT_radix2_inverse_butterfly_sqrt2(mp_limb_t * s, mp_limb_t * t, 
+  mp_limb_t * i1, mp_limb_t * i2, mp_size_t i, mp_size_t n, mp_bitcnt_t w, mp_limb_t * temp);
+
+void FFT_radix2_twiddle_inverse_butterfly(mp_limb_t * s, mp_limb_t * t, 
+                  mp_limb_t * i1, mp_limb_t * i2, mp_size_t NW, mp_bitcnt_t b1, mp_bitcnt_t b2);
+
+void FFT_radix2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
+
+void FFT_radix2_sqrt2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
+
+int FFT_negacyclic_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t n, mp_bitcnt_t w);
+
+void FFT_twiddle(mp_limb_t * r, mp_limb_t * i1, mp_size_t i, mp_size_t n, mp_bitcnt_t w);
+
+void FFT_twiddle_sqrt2(mp_limb_t * r, 
+       mp_limb_t * i1, mp_size_t i, mp_size_t n, mp_bitcnt_t w, mp_limb_t * temp);
+
+void FFT_radix2_truncate1(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t trunc);
+
+void FFT_radix2_truncate1_twiddle(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc);
+
+void FFT_radix2_truncate(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t trunc);
+
+void FFT_radix2_truncate_twiddle(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc);
+
+void FFT_radix2_truncate_sqrt2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t trunc);
+
+void FFT_radix2_negacyclic(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
 
 void FFT_radix2_twiddle(mp_limb_t ** ii, mp_size_t is,
       mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
       mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs);
 
+void IFFT_radix2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
+
+void IFFT_radix2_sqrt2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
+
+void IFFT_radix2_truncate1(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t trunc);
+
+void IFFT_radix2_truncate1_twiddle(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc);
+
+void IFFT_radix2_truncate1_twiddle_next(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc);
+
+void IFFT_radix2_truncate(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t trunc);
+
+void IFFT_radix2_truncate_twiddle(mp_limb_t ** ii, mp_size_t is,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs, mp_size_t trunc);
+
+void IFFT_radix2_truncate_sqrt2(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
+      mp_size_t trunc);
+
+void IFFT_radix2_negacyclic(mp_limb_t ** rr, mp_size_t rs, mp_limb_t ** ii, 
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp);
+
 void IFFT_radix2_twiddle(mp_limb_t ** ii, mp_size_t is,
       mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp,
               mp_size_t ws, mp_size_t r, mp_size_t c, mp_size_t rs);
 
-#endif
+void FFT_radix2_mfa(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+                    mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1);
+
+void FFT_radix2_mfa_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+                    mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1);
+
+void FFT_mfa_revbin_column(mp_limb_t ** ii, mp_size_t n1, mp_size_t n2, 
+                                       mp_size_t i, mp_size_t rows);
+
+void FFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+      mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc);
+
+void FFT_radix2_mfa_truncate_sqrt2_half(mp_limb_t ** jj, mp_size_t half,
+      mp_limb_t * limbs, mp_size_t total_limbs, mp_bitcnt_t bits,
+      mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2,
+      mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc);
+
+void FFT_radix2_mfa_truncate_sqrt2_column(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1, mp_size_t trunc, mp_size_t i);
+
+void FFT_radix2_mfa_truncate_sqrt2_row(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1);
+
+void FFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+        mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc);
+
+void IFFT_radix2_mfa(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+                    mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1);
+
+void IFFT_radix2_mfa_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+                    mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1);
+
+void IFFT_radix2_mfa_truncate_sqrt2(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+      mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc);
+
+void IFFT_radix2_mfa_truncate_sqrt2_row(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1);
+
+void IFFT_radix2_mfa_truncate_sqrt2_column(mp_limb_t ** ii, mp_size_t n, 
+      mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, 
+      mp_size_t n1, mp_size_t trunc, mp_size_t i);
+
+void IFFT_radix2_mfa_truncate_sqrt2_combined(mp_limb_t ** ii, mp_limb_t ** jj, 
+                  mp_size_t n, mp_bitcnt_t w, mp_limb_t ** t1, mp_limb_t ** t2, 
+                mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc, mp_limb_t * tt);
 
+void IFFT_radix2_mfa_truncate(mp_limb_t ** ii, mp_size_t n, mp_bitcnt_t w, 
+     mp_limb_t ** t1, mp_limb_t ** t2, mp_limb_t ** temp, mp_size_t n1, mp_size_t trunc);
+
+void fft_naive_convolution_1(mp_limb_t * r, mp_limb_t * ii, mp_limb_t * jj, mp_size_t m);
+
+void FFT_mulmod_2expp1(mp_limb_t * r1, mp_limb_t * i1, mp_limb_t * i2, 
+                 mp_size_t r_limbs, mp_bitcnt_t depth, mp_bitcnt_t w);
+
+mp_limb_t new_mpn_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2, 
+                           mp_limb_t c, mp_limb_t bits, mp_limb_t * tt);
+
+mp_limb_t fft_mulmod_2expp1(mp_limb_t * r, mp_limb_t * i1, mp_limb_t * i2, 
+                           mp_size_t n, mp_size_t w, mp_limb_t * tt);
+
+mp_limb_t * FFT_alloc_limbs(mp_size_t limbs);
+
+mp_limb_t * FFT_alloc_limbs_local(mp_size_t limbs);
+
+void FFT_free_limbs(mp_limb_t * p, mp_size_t limbs);
+
+mp_limb_t * FFT_mmap_limbs(mp_size_t limbs, const char * dir);
+
+void FFT_munmap_limbs(mp_limb_t * p, mp_size_t limbs);
+
+void FFT_discard_limbs(mp_limb_t * p, mp_size_t limbs);
+
+double FFT_mul_unbalanced_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, 
+                   mp_size_t * m, mp_size_t n1, mp_size_t n2);
+
+double FFT_mulmod_Bexp_params(mp_bitcnt_t * depth, mp_bitcnt_t * w, 
+                                       mp_size_t k, int neg, int exact);
+
+void FFT_mul_precomp_init_params(fft_mul_precomp_t * pre, mp_limb_t * i2, 
+         mp_size_t n2, mp_size_t m, mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul2(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul3(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w, mp_size_t sqrt);
+
+void new_mpn_mul4(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void new_mpn_mul5(mp_limb_t * r1, mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2,
+                 mp_bitcnt_t depth, mp_bitcnt_t w);
+
+void mpn_to_mpz(mpz_t m, mp_limb_t * i, mp_size_t limbs);
+
+void set_p(mpz_t p, mp_size_t n, mp_bitcnt_t w);
+
+void rand_n(mp_limb_t * n, gmp_randstate_t state, mp_size_t limbs);
+
+void ref_mul_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d);
+
+void ref_norm(mpz_t m, mpz_t p);
+
+void ref_sumdiff_rshBmod(mpz_t t, mpz_t u, mpz_t i1,
+                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y);
+
+void run_tests(void);
+
+#endif
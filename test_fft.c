@@ -0,0 +1,2953 @@
+/* mul_fft -- radix 2 fft routines for MPIR.
+
+Copyright 2009, 2011 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of William Hart.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpir.h"
+#include "gmp-impl.h"
+#include "mul_fft.h"
+
+/************************************************************************************
+
+   Test code
+
+************************************************************************************/
+
+void mpn_to_mpz(mpz_t m, mp_limb_t * i, mp_size_t limbs)
+{
+   mp_limb_signed_t hi;
+   
+   mpz_realloc(m, limbs + 1);
+   MPN_COPY(m->_mp_d, i, limbs + 1);
+   hi = i[limbs];
+   if (hi < 0L)
+   {
+      mpn_neg_n(m->_mp_d, m->_mp_d, limbs + 1);
+      m->_mp_size = limbs + 1;
+      while ((m->_mp_size) && (!m->_mp_d[m->_mp_size - 1])) 
+         m->_mp_size--;
+      m->_mp_size = -m->_mp_size;
+   } else
+   {
+      m->_mp_size = limbs + 1;
+      while ((m->_mp_size) && (!m->_mp_d[m->_mp_size - 1])) 
+         m->_mp_size--;
+   }
+}
+
+void ref_norm(mpz_t m, mpz_t p)
+{
+   mpz_mod(m, m, p);
+}
+
+void ref_submod_i(mpz_t m, mpz_t i1, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w)
+{
+   mpz_sub(m, i1, i2);
+   mpz_mul_2exp(m, m, (n*w)/2);
+   mpz_mod(m, m, p);
+}
+
+void ref_mul_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d)
+{
+   mpz_mul_2exp(m, i2, d);
+   mpz_mod(m, m, p);
+}
+
+void ref_div_2expmod(mpz_t m, mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t d)
+{
+   mpz_t temp;
+   mpz_init(temp);
+   mpz_set_ui(temp, 1);
+   mpz_mul_2exp(temp, temp, d);
+   mpz_invert(temp, temp, p);
+   mpz_mul(m, i2, temp);
+   mpz_mod(m, m, p);
+   mpz_clear(temp);
+}
+
+void ref_lshB_sumdiffmod(mpz_t t, mpz_t u, mpz_t i1, 
+                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y)
+{
+   mpz_add(t, i1, i2);
+   mpz_sub(u, i1, i2);
+   mpz_mul_2exp(t, t, x*GMP_LIMB_BITS);
+   mpz_mul_2exp(u, u, y*GMP_LIMB_BITS);
+   mpz_mod(t, t, p);
+   mpz_mod(u, u, p);
+}
+
+void ref_sumdiff_rshBmod(mpz_t t, mpz_t u, mpz_t i1, 
+                      mpz_t i2, mpz_t p, mp_size_t n, mp_bitcnt_t w, mp_bitcnt_t x, mp_bitcnt_t y)
+{
+   mpz_t mult1, mult2;
+   mpz_init(mult1);
+   mpz_init(mult2);
+   mpz_set_ui(mult1, 1);
+   mpz_mul_2exp(mult1, mult1, x*GMP_LIMB_BITS);
+   mpz_invert(mult1, mult1, p);
+   mpz_set_ui(mult2, 1);
+   mpz_mul_2exp(mult2, mult2, y*GMP_LIMB_BITS);
+   mpz_invert(mult2, mult2, p);
+   mpz_mul(mult1, mult1, i1);
+   mpz_mul(mult2, mult2, i2);
+   mpz_add(t, mult1, mult2);
+   mpz_sub(u, mult1, mult2);
+   mpz_mod(t, t, p);
+   mpz_mod(u, u, p);
+   mpz_clear(mult1);
+   mpz_clear(mult2);
+}
+
+/* set p = 2^wn + 1 */
+void set_p(mpz_t p, mp_size_t n, mp_bitcnt_t w)
+{
+   mpz_set_ui(p, 1);
+   mpz_mul_2exp(p, p, n*w);
+   mpz_add_ui(p, p, 1);
+}
+
+void rand_n(mp_limb_t * n, gmp_randstate_t state, mp_size_t limbs)
+{
+   mpn_rrandom(n, state, limbs);
+   n[limbs] = gmp_urandomm_ui(state, 10);
+   if (gmp_urandomm_ui(state, 2)) n[limbs] = -n[limbs];
+}
+
+void test_norm()
+{
+   mp_size_t i, j, k, l, n, w, limbs;
+   mpz_t p, m, m2;
+   mpz_init(p);
+   mpz_init(m);
+   mpz_init(m2);
+   mp_limb_t * nn;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = GMP_LIMB_BITS; i < 32*GMP_LIMB_BITS; i += GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 32; j++)
+      {
+         for (k = 1; k <= GMP_NUMB_BITS; k <<= 1)
+         {
+            n = i/k;
+            w = j*k;
+            limbs = (n*w)/GMP_LIMB_BITS;
+            TMP_MARK;
+            nn = TMP_BALLOC_LIMBS(limbs + 1);
+            mpn_rrandom(nn, state, limbs + 1);
+            mpn_to_mpz(m, nn, limbs);
+            set_p(p, n, w);
+            
+            mpn_normmod_2expp1(nn, limbs);
+            mpn_to_mpz(m2, nn, limbs);
+            ref_norm(m, p);
+
+            if (mpz_cmp(m, m2) != 0)
+            {
+               printf("mpn_normmod_2expp1 error\n");
+               gmp_printf("want %Zx\n\n", m);
+               gmp_printf("got  %Zx\n", m2);
+               abort();
+            }
+            TMP_FREE;
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(m);
+   mpz_clear(m2);
+   gmp_randclear(state);
+}
+
+void test_mul_2expmod()
+{
+   mp_size_t i, j, k, l, n, w, limbs, d;
+   mpz_t p, m, m2, mn1, mn2;
+   mpz_init(p);
+   mpz_init(m);
+   mpz_init(m2);
+   mpz_init(mn1);
+   mp_limb_t * nn1, * r;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = 2*GMP_LIMB_BITS; i < 64*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 32; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            for (d = 0; d < GMP_LIMB_BITS; d++)
+            {
+               n = i/k;
+               w = j*k;
+               limbs = (n*w)/GMP_LIMB_BITS;
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+               mpn_to_mpz(mn1, nn1, limbs);
+               set_p(p, n, w);
+               
+               mpn_mul_2expmod_2expp1(r, nn1, limbs, d);
+               mpn_to_mpz(m2, r, limbs);
+               ref_norm(m2, p);
+               ref_mul_2expmod(m, mn1, p, n, w, d);
+               
+               if (mpz_cmp(m, m2) != 0)
+               {
+                  printf("mpn_mul_2expmod_2expp1 error\n");
+                  gmp_printf("want %Zx\n\n", m);
+                  gmp_printf("got  %Zx\n", m2);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(m);
+   mpz_clear(m2);
+   mpz_clear(mn1);
+   gmp_randclear(state);
+}
+
+void test_FFT_negacyclic_twiddle()
+{
+   mp_size_t i, j, k, l, n, w, limbs, d;
+   mpz_t p, m, m2, mn1, mn2;
+   mpz_init(p);
+   mpz_init(m);
+   mpz_init(m2);
+   mpz_init(mn1);
+   mp_limb_t * nn1, * r;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 10; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            n = i/k;
+            w = 2*j*k;
+            for (d = 0; d < 2*n; d++)
+            {
+               limbs = (n*w)/GMP_LIMB_BITS;
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+               mpn_to_mpz(mn1, nn1, limbs);
+               set_p(p, n, w);
+               
+               if (!FFT_negacyclic_twiddle(r, nn1, d, n, w))
+                  MPN_COPY(r, nn1, limbs + 1);
+               mpn_to_mpz(m2, r, limbs);
+               ref_norm(m2, p);
+               ref_mul_2expmod(m, mn1, p, n, w, d*w/2);
+               
+               if (mpz_cmp(m, m2) != 0)
+               {
+                  printf("FFT_negacyclic_twiddle error\n");
+                  gmp_printf("want %Zx\n\n", m);
+                  gmp_printf("got  %Zx\n", m2);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+
+   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 10; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            n = i/k;
+            w = 2*j*k;
+            for (d = 0; d < 2*n; d++)
+            {
+               limbs = (n*w)/GMP_LIMB_BITS;
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+               mpn_to_mpz(mn1, nn1, limbs);
+               set_p(p, n, w);
+               
+               if (!FFT_negacyclic_twiddle(r, nn1, 4*n - d, n, w))
+                  MPN_COPY(r, nn1, limbs + 1);
+               mpn_to_mpz(m2, r, limbs);
+               ref_norm(m2, p);
+               ref_div_2expmod(m, mn1, p, n, w, d*w/2);
+               
+               if (mpz_cmp(m, m2) != 0)
+               {
+                  printf("FFT_negacyclic_twiddle error\n");
+                  gmp_printf("want %Zx\n\n", m);
+                  gmp_printf("got  %Zx\n", m2);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(m);
+   mpz_clear(m2);
+   mpz_clear(mn1);
+   gmp_randclear(state);
+}
+
+void test_div_2expmod()
+{
+   mp_size_t i, j, k, l, n, w, limbs, d;
+   mpz_t p, m, m2, mn1, mn2;
+   mpz_init(p);
+   mpz_init(m);
+   mpz_init(m2);
+   mpz_init(mn1);
+   mp_limb_t * nn1, * r;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = 2*GMP_LIMB_BITS; i < 64*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 32; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            for (d = 0; d < GMP_LIMB_BITS; d++)
+            {
+               n = i/k;
+               w = j*k;
+               limbs = (n*w)/GMP_LIMB_BITS;
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+            
+               mpn_to_mpz(mn1, nn1, limbs);
+               set_p(p, n, w);
+            
+               mpn_div_2expmod_2expp1(r, nn1, limbs, d);
+               mpn_to_mpz(m2, r, limbs);
+               ref_norm(m2, p);
+               ref_norm(mn1, p);
+               ref_mul_2expmod(m, m2, p, n, w, d);
+
+               if (mpz_cmp(m, mn1) != 0)
+               {
+                  printf("mpn_div_2expmod_2expp1 error\n");
+                  gmp_printf("want %Zx\n\n", mn1);
+                  gmp_printf("got  %Zx\n", m);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(m);
+   mpz_clear(m2);
+   mpz_clear(mn1);
+   gmp_randclear(state);
+}
+
+void test_lshB_sumdiffmod()
+{
+   mp_size_t c, i, j, k, l, x, y, n, w, limbs;
+   mpz_t p, ma, mb, m2a, m2b, mn1, mn2;
+   mpz_init(p);
+   mpz_init(ma);
+   mpz_init(mb);
+   mpz_init(m2a);
+   mpz_init(m2b);
+   mpz_init(mn1);
+   mpz_init(mn2);
+   mp_limb_t * nn1, * nn2, * r1, * r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 10; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            n = i/k;
+            w = j*k;
+            limbs = (n*w)/GMP_LIMB_BITS;
+            for (c = 0; c < limbs; c++)
+            {
+               x = gmp_urandomm_ui(state, limbs + 1);
+               y = gmp_urandomm_ui(state, limbs + 1);
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               nn2 = TMP_BALLOC_LIMBS(limbs + 1);
+               r1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r2 = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+               rand_n(nn2, state, limbs);
+            
+               mpn_to_mpz(mn1, nn1, limbs);
+               mpn_to_mpz(mn2, nn2, limbs);
+               set_p(p, n, w);
+            
+               mpn_lshB_sumdiffmod_2expp1(r1, r2, nn1, nn2, limbs, x, y);
+               mpn_to_mpz(m2a, r1, limbs);
+               mpn_to_mpz(m2b, r2, limbs);
+               ref_norm(m2a, p);
+               ref_norm(m2b, p);
+               ref_lshB_sumdiffmod(ma, mb, mn1, mn2, p, n, w, x, y);
+
+               if (mpz_cmp(ma, m2a) != 0)
+               {
+                  printf("mpn_lshB_sumdiffmod_2expp1 error a\n");
+                  printf("x = %ld, y = %ld\n", x, y);
+                  gmp_printf("want %Zx\n\n", ma);
+                  gmp_printf("got  %Zx\n", m2a);
+                  abort();
+               }
+               if (mpz_cmp(mb, m2b) != 0)
+               {
+                  printf("mpn_lshB_sumdiffmod_2expp1 error b\n");
+                  printf("x = %ld, y = %ld\n", x, y);
+                  gmp_printf("want %Zx\n\n", mb);
+                  gmp_printf("got  %Zx\n", m2b);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(ma);
+   mpz_clear(mb);
+   mpz_clear(m2a);
+   mpz_clear(m2b);
+   mpz_clear(mn1);
+   mpz_clear(mn2);
+   gmp_randclear(state);
+}
+
+void test_sumdiff_rshBmod()
+{
+   mp_size_t c, i, j, k, l, x, y, n, w, limbs;
+   mpz_t p, ma, mb, m2a, m2b, mn1, mn2;
+   mpz_init(p);
+   mpz_init(ma);
+   mpz_init(mb);
+   mpz_init(m2a);
+   mpz_init(m2b);
+   mpz_init(mn1);
+   mpz_init(mn2);
+   mp_limb_t * nn1, * nn2, * r1, * r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (i = 2*GMP_LIMB_BITS; i < 20*GMP_LIMB_BITS; i += 2*GMP_LIMB_BITS)
+   {
+      for (j = 1; j < 10; j++)
+      {
+         for (k = 1; k <= 2*GMP_NUMB_BITS; k <<= 1)
+         {
+            n = i/k;
+            w = j*k;
+            limbs = (n*w)/GMP_LIMB_BITS;
+            for (c = 0; c < limbs; c++)
+            {
+               x = gmp_urandomm_ui(state, limbs);
+               y = gmp_urandomm_ui(state, limbs);
+               TMP_MARK;
+               nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+               nn2 = TMP_BALLOC_LIMBS(limbs + 1);
+               r1 = TMP_BALLOC_LIMBS(limbs + 1);
+               r2 = TMP_BALLOC_LIMBS(limbs + 1);
+               rand_n(nn1, state, limbs);
+               rand_n(nn2, state, limbs);
+            
+               mpn_to_mpz(mn1, nn1, limbs);
+               mpn_to_mpz(mn2, nn2, limbs);
+               set_p(p, n, w);
+            
+               mpn_sumdiff_rshBmod_2expp1(r1, r2, nn1, nn2, limbs, x, y);
+               mpn_to_mpz(m2a, r1, limbs);
+               mpn_to_mpz(m2b, r2, limbs);
+               ref_norm(m2a, p);
+               ref_norm(m2b, p);
+               ref_sumdiff_rshBmod(ma, mb, mn1, mn2, p, n, w, x, y);
+
+               if (mpz_cmp(ma, m2a) != 0)
+               {
+                  printf("mpn_sumdiff_rshBmod_2expp1 error a\n");
+                  printf("x = %ld, y = %ld, limbs = %ld\n", x, y, limbs);
+                  gmp_printf("want %Zx\n\n", ma);
+                  gmp_printf("got  %Zx\n", m2a);
+                  abort();
+               }
+               if (mpz_cmp(mb, m2b) != 0)
+               {
+                  printf("mpn_sumdiff_rshBmod_2expp1 error b\n");
+                  printf("x = %ld, y = %ld, limbs = %ld\n", x, y, limbs);
+                  gmp_printf("want %Zx\n\n", mb);
+                  gmp_printf("got  %Zx\n", m2b);
+                  abort();
+               }
+               TMP_FREE;
+            }
+         }
+      }
+   }
+   mpz_clear(p);
+   mpz_clear(ma);
+   mpz_clear(mb);
+   mpz_clear(m2a);
+   mpz_clear(m2b);
+   mpz_clear(mn1);
+   mpz_clear(mn2);
+   gmp_randclear(state);
+}
+
+void test_mulmod()
+{
+   mp_bitcnt_t depth = 15UL; //should be at least 6 
+   mp_bitcnt_t w = 1UL; /* should be 1 or a power of 2 */
+   mp_size_t iters = 10000;
+
+   mp_size_t n = (1UL<<depth);
+   
+   mp_bitcnt_t bits = n*w;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2, *tt;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*(int_limbs+1));
+   i2 = i1 + int_limbs + 1;
+   r1 = i2 + int_limbs + 1;
+   r2 = r1 + int_limbs + 1;
+   tt = r2 + int_limbs + 1;
+   
+   for (i = 0; i < iters; i++)
+   {
+      mpn_rrandom(i1, state, int_limbs);
+      i1[int_limbs] = CNST_LIMB(0);
+      mpn_rrandom(i2, state, int_limbs);
+      i2[int_limbs] = CNST_LIMB(0);
+      mpn_mulmod_2expp1(r2, i1, i2, 0, bits, tt);
+      fft_mulmod_2expp1(r1, i1, i2, n, w, tt);
+      
+      mp_size_t wrong = 0;
+      for (j = 0; j < int_limbs; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            if (wrong < 10) 
+               printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            wrong++;
+         } 
+      }
+      if (wrong) printf("%ld limbs wrong\n", wrong);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft()
+{
+   mp_bitcnt_t depth = 10UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < 1; i++)
+   {
+      FFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
+      
+      IFFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
+      for (j = 0; j < 2*n; j++)
+      {
+         mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth + 1);
+         mpn_normmod_2expp1(ii[j], limbs);
+      }
+
+      for (j = 0; j < 2*n; j++)
+      {
+         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
+         {
+            printf("Error in entry %ld\n", j);
+            abort();
+         }
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_negacyclic()
+{
+   mp_bitcnt_t depth = 11UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *s1, *s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < 1; i++)
+   {
+      FFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, &s1);
+      
+      IFFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, &s1);
+      for (j = 0; j < 2*n; j++)
+      {
+         mpn_div_2expmod_2expp1(ii[j], ii[j], limbs, depth+1);
+         mpn_normmod_2expp1(ii[j], limbs);
+      }
+
+      for (j = 0; j < 2*n; j++)
+      {
+         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
+         {
+            printf("Error in entry %ld\n", j);
+            abort();
+         }
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_sqrt2()
+{
+   mp_bitcnt_t depth = 6UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *t1, *t2, *s1;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   for (j = 0; j < 4*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+  
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], size);
+   }
+   
+   FFT_radix2_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1);
+   
+   for (j = 0; j < 4*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   IFFT_radix2_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1);
+   
+   for (j = 0; j < 4*n; j++)
+   {
+      mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
+      mpn_normmod_2expp1(jj[j], limbs);
+      mpn_normmod_2expp1(ii[j], limbs);
+   }
+
+   for (j = 0; j < 4*n; j++)
+   {
+      if (mpn_cmp(ii[j], jj[j], size) != 0)
+      {
+         printf("Error in entry %ld\n", j);
+         gmp_printf("%Nx != \n%Nx\n", ii[j], size, jj[j], size);
+         abort();
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_truncate()
+{
+   mp_bitcnt_t depth = 10UL;
+   mp_size_t n = (1UL<<depth);            
+   mp_bitcnt_t w = 1;
+   mp_size_t iter = 1000;
+
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, count;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+ 
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = (mp_limb_t *) ii + 2*n + 2*n*size;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   u1 = (mp_limb_t *) jj + 2*n + 2*n*size;
+   u2 = u1 + size;
+   s2 = (mp_limb_t **) u2 + size;
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
+   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   v1 = (mp_limb_t *) kk + 2*n + 2*n*size;
+   v2 = v1 + size;
+   s3 = (mp_limb_t **) v2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (count = 0; count < iter; count++)
+   {
+      for (i = 0; i < 2*n; i++) 
+      {
+         rand_n(ii[i], state, limbs);
+      }
+   
+      for (j = 0; j < 2*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+
+      for (i = 0; i < 2*n; i++) 
+      {
+         MPN_COPY(jj[i], ii[i], limbs + 1);
+      }
+      
+      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 1;
+      trunc = ((trunc + 1)/2)*2;
+   
+      FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, s1, trunc);
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_normmod_2expp1(ii[j], limbs);
+         MPN_COPY(kk[j], ii[j], limbs + 1);
+      }
+      
+      IFFT_radix2_truncate(kk, 1, kk, n, w, &v1, &v2, s3, trunc);
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(kk[j], limbs);
+         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+
+   TMP_FREE;
+
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_truncate_sqrt2()
+{
+   mp_bitcnt_t depth = 15UL;
+   mp_size_t n = (1UL<<depth);            
+   mp_bitcnt_t w = 1;
+   mp_size_t iter = 1;
+
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, count;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, *s1, *s2, *s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+ 
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = (mp_limb_t *) ii + 4*n + 4*n*size;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   for (j = 0; j < 4*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   u1 = (mp_limb_t *) jj + 4*n + 4*n*size;
+   u2 = u1 + size;
+   s2 = u2 + size;
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   v1 = (mp_limb_t *) kk + 4*n + 4*n*size;
+   v2 = v1 + size;
+   s3 = v2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (count = 0; count < iter; count++)
+   {
+      for (i = 0; i < 4*n; i++) 
+      {
+         rand_n(ii[i], state, limbs);
+      }
+   
+      for (j = 0; j < 4*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+
+      for (i = 0; i < 4*n; i++) 
+      {
+         MPN_COPY(jj[i], ii[i], limbs + 1);
+      }
+      
+      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 2*n + 1;
+      trunc = ((trunc + 7)/8)*8;
+   
+      FFT_radix2_truncate_sqrt2(ii, 1, ii, n, w, &t1, &t2, &s1, trunc);
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_normmod_2expp1(ii[j], limbs);
+         MPN_COPY(kk[j], ii[j], limbs + 1);
+      }
+      
+      IFFT_radix2_truncate_sqrt2(kk, 1, kk, n, w, &v1, &v2, &s3, trunc);
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(kk[j], limbs);
+         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+
+   TMP_FREE;
+
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_mfa_truncate_sqrt2()
+{
+   mp_bitcnt_t depth = 15UL;
+   mp_size_t n = (1UL<<depth);            
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t w = 1;
+   mp_size_t iter = 1;
+
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, count;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, *s1, *s2, *s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+ 
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = (mp_limb_t *) ii + 4*n + 4*n*size;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   for (j = 0; j < 4*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   u1 = (mp_limb_t *) jj + 4*n + 4*n*size;
+   u2 = u1 + size;
+   s2 = u2 + size;
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+   for (i = 0, j = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   v1 = (mp_limb_t *) kk + 4*n + 4*n*size;
+   v2 = v1 + size;
+   s3 = v2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (count = 0; count < iter; count++)
+   {
+      for (i = 0; i < 4*n; i++) 
+      {
+         rand_n(ii[i], state, limbs);
+      }
+   
+      for (j = 0; j < 4*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+
+      for (i = 0; i < 4*n; i++) 
+      {
+         MPN_COPY(jj[i], ii[i], limbs + 1);
+      }
+      
+      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 2*n + 1;
+      trunc = 2*((trunc + 1)/2);
+   
+      FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+      for (j = 0; j < 4*n; j++)
+      {
+         mpn_normmod_2expp1(ii[j], limbs);
+         MPN_COPY(kk[j], ii[j], limbs + 1);
+      }
+      
+      IFFT_radix2_mfa_truncate_sqrt2(kk, n, w, &v1, &v2, &s3, sqrt, trunc);
+      for (j = 0; j < trunc; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(kk[j], limbs);
+         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+
+   TMP_FREE;
+
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_mfa_truncate_sqrt2_partial()
+{
+   mp_bitcnt_t depth, w;
+   mp_size_t n, sqrt, limbs, size, trunc;
+   mp_size_t i, j;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, * t1, * t2, * s1;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   for (depth = 6; depth <= 10; depth++)
+   {
+      for (w = 1; w <= 2; w++)
+      {
+         n = (1UL<<depth);
+         sqrt = (1UL<<(depth/2));
+         limbs = (n*w)/GMP_LIMB_BITS;
+         size = limbs + 1;
+
+         TMP_MARK;
+
+         ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size + 3*size);
+         for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+            ii[i] = ptr;
+         t1 = ptr;
+         t2 = t1 + size;
+         s1 = t2 + size;
+
+         jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*n + 4*n*size);
+         for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+            jj[i] = ptr;
+
+         // every even trunc at small depths, some at the larger ones
+         for (trunc = 2*n + 2; trunc <= 4*n; trunc += 2)
+         {
+            if (depth > 8 && (trunc % sqrt) != 2 && (trunc % sqrt) != sqrt - 2
+                          && gmp_urandomm_ui(state, 16) != 0)
+               continue;
+
+            for (i = 0; i < 4*n; i++) 
+            {
+               rand_n(ii[i], state, limbs);
+               mpn_normmod_2expp1(ii[i], limbs);
+               MPN_COPY(jj[i], ii[i], limbs + 1);
+            }
+
+            FFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+            for (j = 0; j < 4*n; j++)
+               mpn_normmod_2expp1(ii[j], limbs);
+      
+            IFFT_radix2_mfa_truncate_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt, trunc);
+            for (j = 0; j < trunc; j++)
+            {
+               mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
+               mpn_normmod_2expp1(jj[j], limbs);
+               mpn_normmod_2expp1(ii[j], limbs);
+               if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
+               {
+                  printf("Error in entry %ld, depth = %lu, w = %lu, trunc = %ld\n", 
+                                                               j, depth, w, trunc);
+                  abort();
+               }
+            }
+         }
+
+         TMP_FREE;
+      }
+   }
+
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_mfa()
+{
+   mp_bitcnt_t depth = 12UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   u1 = ptr;
+   u2 = u1 + size;
+   s2 = (mp_limb_t **) u2 + size;
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   v1 = ptr;
+   v2 = v1 + size;
+   s3 = (mp_limb_t **) v2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < 10; i++)
+   {
+      for (j = 0; j < 2*n; j++) 
+      {
+          rand_n(ii[j], state, limbs);
+          mpn_normmod_2expp1(ii[j], limbs);
+          MPN_COPY(jj[j], ii[j], limbs + 1);
+      }
+
+      FFT_radix2_mfa(ii, n, w, &t1, &t2, s1, sqrt);
+      for (j = 0; j < 2*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+      for (j = 0; j < 2*n; j++)
+      {
+         MPN_COPY(kk[j], ii[j], limbs + 1);
+      }
+      IFFT_radix2_mfa(kk, n, w, &v1, &v2, s3, sqrt);
+      for (j = 0; j < 2*n; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(kk[j], limbs);
+      }
+
+      for (j = 0; j < 2*n; j++)
+      {
+         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_mfa_sqrt2()
+{
+   mp_bitcnt_t depth = 13UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 4;
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *s1;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+   
+   for (j = 0; j < 4*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) jj + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(4*(n + n*size));
+   for (i = 0, ptr = (mp_limb_t *) kk + 4*n; i < 4*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < 1; i++)
+   {
+      FFT_radix2_mfa_sqrt2(ii, n, w, &t1, &t2, &s1, sqrt);
+
+      for (j = 0; j < 4*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+      
+      for (j = 0; j < 4*n; j++)
+         MPN_COPY(kk[j], ii[j], limbs + 1);
+
+      IFFT_radix2_mfa_sqrt2(kk, n, w, &t1, &t2, &s1, sqrt);
+      for (j = 0; j < 4*n; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 2);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(kk[j], limbs);
+      }
+
+      for (j = 0; j < 4*n; j++)
+      {
+         if (mpn_cmp(kk[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_ifft_mfa_truncate()
+{
+   mp_bitcnt_t depth = 12UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t iters = 100;
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, count, trunc;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+
+   
+   jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      jj[i] = ptr;
+      MPN_COPY(jj[i], ii[i], limbs + 1);
+   }
+   u1 = ptr;
+   u2 = u1 + size;
+   s2 = (mp_limb_t **) u2 + size;
+   
+   kk = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) kk + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      kk[i] = ptr;
+   }
+   v1 = ptr;
+   v2 = v1 + size;
+   s3 = (mp_limb_t **) v2 + size;
+   
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (count = 0; count < iters; count++)
+   {
+      mp_size_t trunc = (gmp_urandomm_ui(state, n/sqrt) + 1)*sqrt*2;
+      for (i = 0; i < 2*n; i++) 
+      {
+         rand_n(ii[i], state, limbs);
+         mpn_normmod_2expp1(ii[i], limbs);
+         MPN_COPY(jj[i], ii[i], limbs + 1);
+      }
+
+      FFT_radix2_mfa_truncate(ii, n, w, &t1, &t2, s1, sqrt, trunc);
+      
+      for (j = 0; j < 2*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+      
+      IFFT_radix2_mfa_truncate(ii, n, w, &v1, &v2, s3, sqrt, trunc);
+      
+      for (j = 0; j < 2*n; j++)
+      {
+         mpn_mul_2expmod_2expp1(jj[j], jj[j], limbs, depth + 1);
+         mpn_normmod_2expp1(jj[j], limbs);
+         mpn_normmod_2expp1(ii[j], limbs);
+      }
+
+      for (j = 0; j < trunc; j++)
+      {
+         if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
+         {
+            gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, kk[j], limbs + 1, jj[j], limbs + 1);
+            abort();
+         }
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_fft_truncate()
+{
+   mp_bitcnt_t depth = 10UL;
+   mp_size_t n = (1UL<<depth);            
+   mp_bitcnt_t w = 1;
+   mp_size_t iter = 1000;
+
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s, count;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, ** kk, *tt, *t1, *t2, *u1, *u2, *v1, *v2, **s1, **s2, **s3;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+ 
+   for (count = 0; count < iter; count++)
+   {
+      mp_size_t trunc = gmp_urandomm_ui(state, 2*n) + 1;
+      trunc = ((trunc + 7)/8)*8;
+   
+      TMP_MARK;
+
+      ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
+      for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+      {
+         ii[i] = ptr;
+         if (i < trunc) rand_n(ii[i], state, limbs);
+         else MPN_ZERO(ii[i], limbs + 1);
+      }
+      t1 = (mp_limb_t *) ii + 2*n + 2*n*size;
+      t2 = t1 + size;
+      s1 = (mp_limb_t **) t2 + size;
+
+      for (j = 0; j < 2*n; j++)
+         mpn_normmod_2expp1(ii[j], limbs);
+
+      jj = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n + 2*n*size + 2*n + 2*size);
+      for (i = 0, ptr = (mp_limb_t *) jj + 2*n; i < 2*n; i++, ptr += size) 
+      {
+         jj[i] = ptr;
+         MPN_COPY(jj[i], ii[i], limbs + 1);
+      }
+      u1 = (mp_limb_t *) jj + 2*n + 2*n*size;
+      u2 = u1 + size;
+      s2 = (mp_limb_t **) u2 + size;
+   
+      tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+      for (i = 0; i < 1; i++)
+      {
+         FFT_radix2_truncate(ii, 1, ii, n, w, &t1, &t2, s1, trunc);
+         FFT_radix2(jj, 1, jj, n, w, &u1, &u2, s2);
+         
+         for (j = 0; j < trunc; j++)
+         {
+            mpn_normmod_2expp1(jj[j], limbs);
+            mpn_normmod_2expp1(ii[j], limbs);
+            if (mpn_cmp(ii[j], jj[j], limbs + 1) != 0)
+            {
+               gmp_printf("Error in entry %ld, %Nx != %Nx\n", j, ii[j], limbs + 1, jj[j], limbs + 1);
+               abort();
+            }
+         }
+      }
+      
+      TMP_FREE;
+   }
+
+   gmp_randclear(state);
+}
+
+void test_mul()
+{
+   mp_bitcnt_t depth = 15UL;
+   mp_bitcnt_t w = 2UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      mpn_urandomb(i1, state, bits);
+      mpn_urandomb(i2, state, bits);
+  
+      mpn_mul_n(r2, i1, i2, int_limbs);
+      new_mpn_mul3(r1, i1, int_limbs, i2, int_limbs, depth, w, sqrt);
+      
+      for (j = 0; j < 2*int_limbs; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_mul5()
+{
+   mp_bitcnt_t depth = 14UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1 = (3*int_limbs)/4;
+   mp_size_t n2 = (3*int_limbs)/4;
+   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
+   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      mpn_urandomb(i1, state, b1);
+      mpn_urandomb(i2, state, b2);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul5(r1, i1, n1, i2, n2, depth, w);
+      
+      for (j = 0; j < n1+n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void test_mul4()
+{
+   mp_bitcnt_t depth = 14UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1 = (3*int_limbs)/4;
+   mp_size_t n2 = (3*int_limbs)/4;
+   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
+   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      mpn_urandomb(i1, state, b1);
+      mpn_urandomb(i2, state, b2);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+      
+      for (j = 0; j < n1+n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+/*
+   new_mpn_mul6 over a range of w at a fixed depth. The pointwise products
+   of some coefficient sizes, such as w = 49 at depth 9 (392 limbs), once 
+   went wrong in fft_mulmod_2expp1.
+*/
+void test_mul6_w()
+{
+   mp_bitcnt_t depth = 9UL;
+   mp_bitcnt_t w, bits1;
+   mp_size_t n = (1UL<<depth);
+   mp_size_t n1, n2, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   for (w = 1; w <= 64; w++)
+   {
+      bits1 = FFT_MUL6_BITS1(n, w, depth);
+      n1 = (2*n*bits1)/GMP_LIMB_BITS;
+      n2 = n1 - gmp_urandomm_ui(state, n1/4) - 1;
+      while (FFT_MUL6_COEFFS(n1, bits1, depth) + FFT_MUL6_COEFFS(n2, bits1, depth) - 1 > 4*n)
+         n1--;
+
+      TMP_MARK;
+
+      i1 = TMP_BALLOC_LIMBS(3*(n1 + n2));
+      i2 = i1 + n1;
+      r1 = i2 + n2;
+      r2 = r1 + n1 + n2;
+      
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+      
+      for (j = 0; j < n1 + n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, w = %lu, %lx != %lx\n", j, w, r1[j], r2[j]);
+            abort();
+         } 
+      }
+
+      TMP_FREE;
+   }
+      
+   gmp_randclear(state);
+} 
+
+void test_mul6_lowmem()
+{
+   mp_bitcnt_t depth = 12UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 4;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1, n2;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      n1 = int_limbs - (i*int_limbs)/8 - 1;
+      n2 = int_limbs/4 + (i*int_limbs)/8 - 1;
+
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul6_lowmem(r1, i1, n1, i2, n2, depth, w);
+      
+      for (j = 0; j < n1+n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+void test_mul6_mmap()
+{
+   mp_bitcnt_t depth = 12UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1 = (3*int_limbs)/4;
+   mp_size_t n2 = (3*int_limbs)/4 - 3;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul6_mmap(r1, i1, n1, i2, n2, depth, w, P_tmpdir);
+      
+      for (j = 0; j < n1+n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+#if FFT_THREADS
+
+void test_mul6_threaded()
+{
+   mp_bitcnt_t depth = 12UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 4;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1, n2;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   for (i = 0; i < iters; i++)
+   {
+      n1 = int_limbs - (i*int_limbs)/8 - 1;
+      n2 = int_limbs/4 + (i*int_limbs)/8 - 1;
+
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+  
+      mpn_mul(r2, i1, n1, i2, n2);
+      new_mpn_mul6_threaded(r1, i1, n1, i2, n2, depth, w, i + 1);
+      
+      for (j = 0; j < n1+n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+#endif
+
+void test_mul_estimate()
+{
+   mp_size_t sizes[4][2] = { { 3000, 3000 }, { 10000, 2000 }, { 25000, 24000 }, { 40000, 7 } };
+   mp_size_t i, j, n1, n2, count, mmap, max = 32*GMP_LIMB_BITS;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   fft_mul_plan_t plan, * plans;
+   char * dir;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 4; i++)
+   {
+      n1 = sizes[i][0];
+      n2 = sizes[i][1];
+
+      i1 = (mp_limb_t *) malloc((3*(n1 + n2))*sizeof(mp_limb_t));
+      i2 = i1 + n1;
+      r1 = i2 + n2;
+      r2 = r1 + n1 + n2;
+
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+      
+      if (!fft_mul_estimate(n1, n2, &plan))
+      {
+         printf("error: no plan for %ld x %ld\n", n1, n2);
+         abort();
+      }
+
+#if FFT_OP_COUNTS
+      fft_op_counts_reset();
+#endif
+      mpn_mul(r2, i1, n1, i2, n2);
+      fft_mul_plan_run(r1, i1, n1, i2, n2, &plan);
+      
+      for (j = 0; j < n1 + n2; j++)
+      {
+         if (r1[j] != r2[j]) 
+         {
+            printf("error in limb %ld, %lx != %lx\n", j, r1[j], r2[j]);
+            abort();
+         } 
+      }
+
+#if FFT_OP_COUNTS
+      {
+         double counted = fft_op_counts.count[FFT_OP_BUTTERFLY] 
+                        + fft_op_counts.count[FFT_OP_BUTTERFLY_SQRT2]
+                        + fft_op_counts.count[FFT_OP_INVERSE_BUTTERFLY]
+                        + fft_op_counts.count[FFT_OP_INVERSE_BUTTERFLY_SQRT2];
+      
+         // the model approximates the truncated half of each transform
+         if (counted > 1.1*plan.butterflies || counted < 0.9*plan.butterflies)
+         {
+            printf("error: %.0f butterflies predicted, %.0f counted\n", 
+               plan.butterflies, counted);
+            abort();
+         }
+      }
+#endif
+
+      free(i1);
+   }
+
+   if (fft_mul_estimate(10, 10, &plan))
+   {
+      printf("error: plan returned for integers which are too small\n");
+      abort();
+   }
+
+   // the mmap candidates are only listed with a directory for their files
+   dir = getenv("FFT_MMAP_DIR");
+   if (dir != NULL) dir = strdup(dir);
+   plans = (fft_mul_plan_t *) malloc(max*sizeof(fft_mul_plan_t));
+
+   for (i = 0; i < 2; i++)
+   {
+      if (i == 0) unsetenv("FFT_MMAP_DIR");
+      else setenv("FFT_MMAP_DIR", P_tmpdir, 1);
+
+      count = fft_mul_plans(plans, max, 25000, 24000);
+      for (mmap = 0, j = 0; j < count; j++)
+      {
+         if (plans[j].variant == FFT_MUL6_MMAP)
+         {
+            mmap++;
+            if (strcmp(plans[j].dir, P_tmpdir) != 0)
+            {
+               printf("error: mmap plan in %s rather than %s\n", plans[j].dir, P_tmpdir);
+               abort();
+            }
+         }
+      }
+
+      if ((mmap != 0) != i)
+      {
+         printf("error: %ld mmap plans with FFT_MMAP_DIR %s\n", mmap, i ? "set" : "unset");
+         abort();
+      }
+   }
+
+   if (dir != NULL) setenv("FFT_MMAP_DIR", dir, 1);
+   else unsetenv("FFT_MMAP_DIR");
+
+   free(dir);
+   free(plans);
+   gmp_randclear(state);
+} 
+
+void test_sqr_auto()
+{
+   mp_size_t sizes[3] = { 100, 5000, 30000 };
+   mp_size_t i, j, n1;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 3; i++)
+   {
+      n1 = sizes[i];
+
+      i1 = (mp_limb_t *) malloc(6*n1*sizeof(mp_limb_t));
+      i2 = i1 + n1;
+      r1 = i2 + n1;
+      r2 = r1 + 2*n1;
+
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n1*GMP_LIMB_BITS);
+      
+      // a squaring, then a product of distinct integers of the same size
+      for (j = 0; j < 2; j++)
+      {
+         if (j == 0)
+         {
+            mpn_mul_n(r2, i1, i1, n1);
+            new_mpn_sqr_auto(r1, i1, n1);
+         } else
+         {
+            mpn_mul_n(r2, i1, i2, n1);
+            new_mpn_mul_auto(r1, i1, n1, i2, n1);
+         }
+
+         if (mpn_cmp(r1, r2, 2*n1) != 0)
+         {
+            printf("error: wrong %s of %ld limbs\n", j == 0 ? "square" : "product", n1);
+            abort();
+         }
+      }
+
+      free(i1);
+   }
+
+   gmp_randclear(state);
+}
+
+/*
+   Checks the kernels selected for each subset of the CPU features against
+   the generic ones. The results are compared after normalisation, so a 
+   kernel is free to leave a different (but equivalent) top limb.
+*/
+void test_cpu_dispatch()
+{
+   unsigned int f, used, all = fft_cpu_features();
+   mp_size_t c, limbs, x, y;
+   mp_bitcnt_t d;
+   mp_limb_t * nn1, * nn2, * t1, * t2, * u1, * u2, * a1, * a2, * temp;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   TMP_DECL;
+
+   for (f = 0; f <= all; f++)
+   {
+      if ((f & all) != f) continue;
+
+      used = fft_cpu_select(f);
+      if (used != f)
+      {
+         printf("error: selected features %x, wanted %x\n", used, f);
+         abort();
+      }
+
+      for (limbs = 1; limbs < 200; limbs += 7)
+      {
+         for (c = 0; c < 20; c++)
+         {
+            TMP_MARK;
+            nn1 = TMP_BALLOC_LIMBS(limbs + 1);
+            nn2 = TMP_BALLOC_LIMBS(limbs + 1);
+            a1 = TMP_BALLOC_LIMBS(limbs + 1);
+            a2 = TMP_BALLOC_LIMBS(limbs + 1);
+            t1 = TMP_BALLOC_LIMBS(limbs + 1);
+            t2 = TMP_BALLOC_LIMBS(limbs + 1);
+            u1 = TMP_BALLOC_LIMBS(limbs + 1);
+            u2 = TMP_BALLOC_LIMBS(limbs + 1);
+            temp = TMP_BALLOC_LIMBS(limbs + 1);
+            rand_n(nn1, state, limbs);
+            rand_n(nn2, state, limbs);
+            x = gmp_urandomm_ui(state, limbs);
+            y = gmp_urandomm_ui(state, limbs);
+            d = gmp_urandomm_ui(state, GMP_LIMB_BITS);
+            
+            MPN_COPY(t1, nn1, limbs + 1);
+            MPN_COPY(t2, nn1, limbs + 1);
+            mpn_normmod_2expp1(t1, limbs);
+            mpn_normmod_2expp1_generic(t2, limbs);
+            if (mpn_cmp(t1, t2, limbs + 1) != 0)
+            {
+               printf("error: %s normmod, limbs = %ld\n", fft_cpu_name(), limbs);
+               abort();
+            }
+
+            mpn_mul_2expmod_2expp1(t1, nn1, limbs, d);
+            mpn_mul_2expmod_2expp1_generic(t2, nn1, limbs, d);
+            mpn_normmod_2expp1_generic(t1, limbs);
+            mpn_normmod_2expp1_generic(t2, limbs);
+            if (mpn_cmp(t1, t2, limbs + 1) != 0)
+            {
+               printf("error: %s mul_2expmod, limbs = %ld, d = %ld\n", 
+                                                  fft_cpu_name(), limbs, d);
+               abort();
+            }
+
+            mpn_div_2expmod_2expp1(t1, nn1, limbs, d);
+            mpn_div_2expmod_2expp1_generic(t2, nn1, limbs, d);
+            mpn_normmod_2expp1_generic(t1, limbs);
+            mpn_normmod_2expp1_generic(t2, limbs);
+            if (mpn_cmp(t1, t2, limbs + 1) != 0)
+            {
+               printf("error: %s div_2expmod, limbs = %ld, d = %ld\n", 
+                                                  fft_cpu_name(), limbs, d);
+               abort();
+            }
+
+            // in place, and with leading zero limbs for the carry of the negation
+            MPN_COPY(t1, nn1, limbs + 1);
+            MPN_ZERO(t1, x);
+            MPN_COPY(t2, t1, limbs + 1);
+            u1[0] = fft_kernels.neg_n(t1, t1, limbs + 1);
+            u2[0] = mpn_neg_n_generic(t2, t2, limbs + 1);
+            if (u1[0] != u2[0] || mpn_cmp(t1, t2, limbs + 1) != 0)
+            {
+               printf("error: %s neg_n, limbs = %ld, x = %ld\n", 
+                                                  fft_cpu_name(), limbs, x);
+               abort();
+            }
+
+            mpn_lshB_sumdiffmod_2expp1(t1, u1, nn1, nn2, limbs, x, y);
+            mpn_lshB_sumdiffmod_2expp1_generic(t2, u2, nn1, nn2, limbs, x, y);
+            mpn_normmod_2expp1_generic(t1, limbs);
+            mpn_normmod_2expp1_generic(t2, limbs);
+            mpn_normmod_2expp1_generic(u1, limbs);
+            mpn_normmod_2expp1_generic(u2, limbs);
+            if (mpn_cmp(t1, t2, limbs + 1) != 0 || mpn_cmp(u1, u2, limbs + 1) != 0)
+            {
+               printf("error: %s lshB_sumdiffmod, limbs = %ld, x = %ld, y = %ld\n", 
+                                                  fft_cpu_name(), limbs, x, y);
+               abort();
+            }
+
+            // sumdiff_rshBmod negates part of its inputs in place
+            MPN_COPY(a1, nn1, limbs + 1);
+            MPN_COPY(a2, nn2, limbs + 1);
+            mpn_sumdiff_rshBmod_2expp1(t1, u1, a1, a2, limbs, x, y);
+            MPN_COPY(a1, nn1, limbs + 1);
+            MPN_COPY(a2, nn2, limbs + 1);
+            mpn_sumdiff_rshBmod_2expp1_generic(t2, u2, a1, a2, limbs, x, y);
+            mpn_normmod_2expp1_generic(t1, limbs);
+            mpn_normmod_2expp1_generic(t2, limbs);
+            mpn_normmod_2expp1_generic(u1, limbs);
+            mpn_normmod_2expp1_generic(u2, limbs);
+            if (mpn_cmp(t1, t2, limbs + 1) != 0 || mpn_cmp(u1, u2, limbs + 1) != 0)
+            {
+               printf("error: %s sumdiff_rshBmod, limbs = %ld, x = %ld, y = %ld\n", 
+                                                  fft_cpu_name(), limbs, x, y);
+               abort();
+            }
+
+            if (d != 0)
+            {
+               MPN_COPY(t1, nn2, limbs + 1);
+               MPN_COPY(t2, nn2, limbs + 1);
+               fft_kernels.addlsh(t1, nn1, limbs + 1, d, temp);
+               mpn_addlsh_generic(t2, nn1, limbs + 1, d, temp);
+               if (mpn_cmp(t1, t2, limbs + 1) != 0)
+               {
+                  printf("error: %s addlsh, limbs = %ld, d = %ld\n", 
+                                                  fft_cpu_name(), limbs, d);
+                  abort();
+               }
+            }
+            TMP_FREE;
+         }
+      }
+   }
+
+   fft_cpu_select(~0U);
+   gmp_randclear(state);
+}
+
+void test_mulmod_Bexp()
+{
+   mp_size_t ks[9] = { 1, 7, 64, 300, 512, 1000, 2048, 6144, 40960 };
+   mp_size_t i, c, k, n1, n2, rn;
+   mp_limb_t * i1, * i2, * r;
+   mpz_t a, b, m, p, q;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   mpz_init(a);
+   mpz_init(b);
+   mpz_init(m);
+   mpz_init(p);
+   mpz_init(q);
+
+   for (i = 0; i < 9; i++)
+   {
+      k = ks[i];
+
+      for (c = 0; c < 6; c++)
+      {
+         // operands shorter and longer than k, and B^k + 1 = -1
+         n1 = 1 + gmp_urandomm_ui(state, 2*k + 2);
+         n2 = (c == 0) ? k + 1 : 1 + gmp_urandomm_ui(state, 2*k + 2);
+         
+         i1 = (mp_limb_t *) malloc((n1 + n2 + k + 1)*sizeof(mp_limb_t));
+         i2 = i1 + n1;
+         r = i2 + n2;
+
+         mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+         mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+         if (c == 0)
+         {
+            MPN_ZERO(i2, k);
+            i2[k] = 1;
+         }
+         if (c == 1)
+            mpn_rrandom(i1, state, n1); // long runs of ones and zeroes
+
+         mpz_import(a, n1, -1, sizeof(mp_limb_t), 0, 0, i1);
+         mpz_import(b, n2, -1, sizeof(mp_limb_t), 0, 0, i2);
+         mpz_mul(p, a, b);
+         
+         mpz_set_ui(m, 1);
+         mpz_mul_2exp(m, m, k*GMP_LIMB_BITS);
+         mpz_add_ui(m, m, 1);
+         mpz_mod(q, p, m);
+
+         mpn_mulmod_Bexpp1_fft(r, i1, n1, i2, n2, k);
+         for (rn = k + 1; rn > 0 && r[rn - 1] == 0; rn--) ;
+         mpz_import(a, rn, -1, sizeof(mp_limb_t), 0, 0, r);
+         if (mpz_cmp(a, q) != 0)
+         {
+            printf("error: mpn_mulmod_Bexpp1_fft, k = %ld, n1 = %ld, n2 = %ld\n", k, n1, n2);
+            abort();
+         }
+
+         mpz_sub_ui(m, m, 2);
+         mpz_mod(q, p, m);
+
+         mpn_mulmod_Bexpm1_fft(r, i1, n1, i2, n2, k);
+         for (rn = k; rn > 0 && r[rn - 1] == 0; rn--) ;
+         mpz_import(a, rn, -1, sizeof(mp_limb_t), 0, 0, r);
+         if (mpz_cmp(a, q) != 0)
+         {
+            printf("error: mpn_mulmod_Bexpm1_fft, k = %ld, n1 = %ld, n2 = %ld\n", k, n1, n2);
+            abort();
+         }
+
+         free(i1);
+      }
+   }
+
+   mpz_clear(a);
+   mpz_clear(b);
+   mpz_clear(m);
+   mpz_clear(p);
+   mpz_clear(q);
+   gmp_randclear(state);
+}
+
+void test_mul_unbalanced()
+{
+   mp_size_t ns[4] = { 50, 700, 3000, 9000 };
+   mp_size_t i, c, n1, n2;
+   mp_limb_t * i1, * i2, * r1, * r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 4; i++)
+   {
+      for (c = 0; c < 3; c++)
+      {
+         // several chunks, with a short last chunk when c = 1
+         n2 = ns[i] + gmp_urandomm_ui(state, ns[i]);
+         n1 = (c == 1) ? 40*n2 + 7 : 4*n2 + gmp_urandomm_ui(state, 60*n2);
+
+         i1 = (mp_limb_t *) malloc(3*(n1 + n2)*sizeof(mp_limb_t));
+         i2 = i1 + n1;
+         r1 = i2 + n2;
+         r2 = r1 + n1 + n2;
+
+         mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+         if (c == 2)
+            mpn_rrandom(i2, state, n2);
+         else
+            mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+
+         mpn_mul(r2, i1, n1, i2, n2);
+
+         new_mpn_mul_unbalanced(r1, i1, n1, i2, n2);
+         if (mpn_cmp(r1, r2, n1 + n2) != 0)
+         {
+            printf("error: new_mpn_mul_unbalanced, n1 = %ld, n2 = %ld\n", n1, n2);
+            abort();
+         }
+
+         new_mpn_mul_auto(r1, i1, n1, i2, n2);
+         if (mpn_cmp(r1, r2, n1 + n2) != 0)
+         {
+            printf("error: new_mpn_mul_auto, n1 = %ld, n2 = %ld\n", n1, n2);
+            abort();
+         }
+
+         free(i1);
+      }
+   }
+
+   gmp_randclear(state);
+}
+
+void test_mpz_mul_fft()
+{
+   mp_size_t ns[4] = { 3, 100, 2000, 9000 };
+   mp_size_t i, c;
+   mpz_t a, b, r, p;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   mpz_init(a);
+   mpz_init(b);
+   mpz_init(r);
+   mpz_init(p);
+
+   for (i = 0; i < 4; i++)
+   {
+      for (c = 0; c < 5; c++)
+      {
+         mpz_rrandomb(a, state, (ns[i] + gmp_urandomm_ui(state, ns[i]))*GMP_LIMB_BITS);
+         mpz_urandomb(b, state, (ns[i]/2 + 1 + gmp_urandomm_ui(state, 2*ns[i]))*GMP_LIMB_BITS);
+         if (c & 1) mpz_neg(a, a);
+         if (c & 2) mpz_neg(b, b);
+         if (c == 4) mpz_set_ui(b, 0);
+
+         mpz_mul(p, a, b);
+
+         mpz_mul_fft(r, a, b);
+         if (mpz_cmp(r, p) != 0)
+         {
+            printf("error: mpz_mul_fft, i = %ld, c = %ld\n", i, c);
+            abort();
+         }
+
+         // r aliasing each input
+         mpz_set(r, a);
+         mpz_mul_fft(r, r, b);
+         if (mpz_cmp(r, p) != 0)
+         {
+            printf("error: mpz_mul_fft(r, r, b), i = %ld, c = %ld\n", i, c);
+            abort();
+         }
+
+         mpz_set(r, b);
+         mpz_mul_fft(r, a, r);
+         if (mpz_cmp(r, p) != 0)
+         {
+            printf("error: mpz_mul_fft(r, a, r), i = %ld, c = %ld\n", i, c);
+            abort();
+         }
+
+         mpz_mul(p, a, a);
+         mpz_set(r, a);
+         mpz_sqr_fft(r, r);
+         if (mpz_cmp(r, p) != 0)
+         {
+            printf("error: mpz_sqr_fft(r, r), i = %ld, c = %ld\n", i, c);
+            abort();
+         }
+      }
+   }
+
+   mpz_clear(a);
+   mpz_clear(b);
+   mpz_clear(r);
+   mpz_clear(p);
+   gmp_randclear(state);
+}
+
+void test_prod_tree()
+{
+   mp_size_t counts[5] = { 1, 2, 7, 300, 3000 };
+   mp_size_t i, j, c, total, rn, pn;
+   mp_limb_t ** x, * r, * p;
+   mp_size_t * xn;
+   mpz_t a, b;
+   fft_mul_precomp_t pre;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   mpz_init(a);
+   mpz_init(b);
+
+   for (i = 0; i < 5; i++)
+   {
+      for (c = 0; c < 3; c++)
+      {
+         // small integers, a few large ones, and a zero when c = 2
+         x = (mp_limb_t **) malloc(counts[i]*sizeof(mp_limb_t *));
+         xn = (mp_size_t *) malloc(counts[i]*sizeof(mp_size_t));
+         for (j = 0, total = 0; j < counts[i]; j++)
+         {
+            xn[j] = 1 + gmp_urandomm_ui(state, (c == 1 && j < 4) ? 4000 : 20);
+            x[j] = (mp_limb_t *) malloc(xn[j]*sizeof(mp_limb_t));
+            mpn_rrandom(x[j], state, xn[j]);
+            total += xn[j];
+         }
+         if (c == 2)
+            MPN_ZERO(x[counts[i]/2], xn[counts[i]/2]);
+
+         r = (mp_limb_t *) malloc(total*sizeof(mp_limb_t));
+         rn = (c == 1) ? mpn_prod_tree_threaded(r, x, xn, counts[i], 3)
+                       : mpn_prod_tree(r, x, xn, counts[i]);
+
+         mpz_set_ui(a, 1);
+         for (j = 0; j < counts[i]; j++)
+         {
+            mpz_import(b, xn[j], -1, sizeof(mp_limb_t), 0, 0, x[j]);
+            mpz_mul(a, a, b);
+         }
+         mpz_import(b, rn, -1, sizeof(mp_limb_t), 0, 0, r);
+         if (mpz_cmp(a, b) != 0 || (rn > 1 && r[rn - 1] == 0))
+         {
+            printf("error: mpn_prod_tree, count = %ld, c = %ld\n", counts[i], c);
+            abort();
+         }
+
+         free(r);
+         for (j = 0; j < counts[i]; j++)
+            free(x[j]);
+         free(x);
+         free(xn);
+      }
+   }
+
+   // one integer multiplied by several others with a single transform
+   r = (mp_limb_t *) malloc(24000*sizeof(mp_limb_t));
+   p = r + 12000;
+   mpn_urandomb(r, state, 3000*GMP_LIMB_BITS);
+   fft_mul_precomp_init(&pre, r, 3000, 5000);
+   x = (mp_limb_t **) malloc(sizeof(mp_limb_t *));
+   x[0] = (mp_limb_t *) malloc(5000*sizeof(mp_limb_t));
+   for (c = 0; c < 4; c++)
+   {
+      pn = 1 + gmp_urandomm_ui(state, 5000);
+      mpn_urandomb(x[0], state, pn*GMP_LIMB_BITS);
+      fft_mul_precomp(p, x[0], pn, &pre);
+      mpz_import(a, 3000, -1, sizeof(mp_limb_t), 0, 0, r);
+      mpz_import(b, pn, -1, sizeof(mp_limb_t), 0, 0, x[0]);
+      mpz_mul(a, a, b);
+      mpz_import(b, pn + 3000, -1, sizeof(mp_limb_t), 0, 0, p);
+      if (mpz_cmp(a, b) != 0)
+      {
+         printf("error: fft_mul_precomp, n1 = %ld\n", pn);
+         abort();
+      }
+   }
+   fft_mul_precomp_clear(&pre);
+   free(x[0]);
+   free(x);
+   free(r);
+
+   mpz_clear(a);
+   mpz_clear(b);
+   gmp_randclear(state);
+}
+
+void test_fft_poly_mul()
+{
+   // alen, blen, abits, bbits
+   mp_size_t cs[9][4] = { { 1, 1, 10, 10 }, { 5, 3, 200, 3000 }, { 300, 200, 20, 20 },
+      { 2000, 1500, 1, 64 }, { 100, 100, 5000, 5000 }, { 3, 2, 200000, 100000 }, 
+      { 4000, 1, 300, 30 }, { 3000, 3000, 64, 64 }, { 50, 40, 100000, 64 } };
+   mp_size_t i, j, k, alen, blen;
+   mpz_t * a, * b, * r, * p;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 9; i++)
+   {
+      alen = cs[i][0];
+      blen = cs[i][1];
+      a = (mpz_t *) malloc(alen*sizeof(mpz_t));
+      b = (mpz_t *) malloc(blen*sizeof(mpz_t));
+      r = (mpz_t *) malloc((alen + blen - 1)*sizeof(mpz_t));
+      p = (mpz_t *) malloc((alen + blen - 1)*sizeof(mpz_t));
+
+      for (j = 0; j < alen; j++)
+      {
+         mpz_init(a[j]);
+         mpz_rrandomb(a[j], state, gmp_urandomm_ui(state, cs[i][2]) + 1);
+         if (gmp_urandomm_ui(state, 2)) mpz_neg(a[j], a[j]);
+      }
+      for (j = 0; j < blen; j++)
+      {
+         mpz_init(b[j]);
+         mpz_urandomb(b[j], state, cs[i][3]);
+         if (gmp_urandomm_ui(state, 2)) mpz_neg(b[j], b[j]);
+      }
+      for (j = 0; j < alen + blen - 1; j++)
+      {
+         mpz_init(r[j]);
+         mpz_init(p[j]);
+      }
+
+      for (j = 0; j < alen; j++)
+         for (k = 0; k < blen; k++)
+            mpz_addmul(p[j + k], a[j], b[k]);
+
+      fft_poly_mul(r, a, alen, b, blen);
+      for (j = 0; j < alen + blen - 1; j++)
+      {
+         if (mpz_cmp(r[j], p[j]) != 0)
+         {
+            printf("error: fft_poly_mul, i = %ld, coeff %ld\n", i, j);
+            abort();
+         }
+      }
+
+      // squaring
+      if (blen == alen)
+      {
+         for (j = 0; j < 2*alen - 1; j++)
+            mpz_set_ui(p[j], 0);
+         for (j = 0; j < alen; j++)
+            for (k = 0; k < alen; k++)
+               mpz_addmul(p[j + k], a[j], a[k]);
+
+         fft_poly_mul(r, a, alen, a, alen);
+         for (j = 0; j < 2*alen - 1; j++)
+         {
+            if (mpz_cmp(r[j], p[j]) != 0)
+            {
+               printf("error: fft_poly_mul squaring, i = %ld, coeff %ld\n", i, j);
+               abort();
+            }
+         }
+      }
+
+      for (j = 0; j < alen; j++)
+         mpz_clear(a[j]);
+      for (j = 0; j < blen; j++)
+         mpz_clear(b[j]);
+      for (j = 0; j < alen + blen - 1; j++)
+      {
+         mpz_clear(r[j]);
+         mpz_clear(p[j]);
+      }
+      free(a);
+      free(b);
+      free(r);
+      free(p);
+   }
+
+   gmp_randclear(state);
+}
+
+void test_mul_fft_batch()
+{
+   mp_size_t ns[3][2] = { { 20, 13 }, { 3000, 2000 }, { 9000, 9000 } };
+   mp_size_t counts[7] = { 5, 5, 5, 2, 7, 2, 7 };
+   mp_size_t i, j, c, n1, n2;
+   mp_limb_t ** r, ** i1, ** i2, * p;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 3; i++)
+   {
+      n1 = ns[i][0];
+      n2 = ns[i][1];
+      p = (mp_limb_t *) malloc((n1 + n2)*sizeof(mp_limb_t));
+
+      // c = 1: all by one integer, c = 2: squares, c >= 3: with 3 threads,
+      // fewer products than threads for c = 3, 5, all by one integer for c >= 5
+      for (c = 0; c < 7; c++)
+      {
+         r = (mp_limb_t **) malloc(counts[c]*sizeof(mp_limb_t *));
+         i1 = (mp_limb_t **) malloc(counts[c]*sizeof(mp_limb_t *));
+         i2 = (mp_limb_t **) malloc(counts[c]*sizeof(mp_limb_t *));
+         for (j = 0; j < counts[c]; j++)
+         {
+            r[j] = (mp_limb_t *) malloc((2*(n1 + n2))*sizeof(mp_limb_t));
+            i1[j] = r[j] + n1 + n2;
+            i2[j] = ((c == 1 || c >= 5) && j > 0) ? i2[0] : ((c == 2 && n1 == n2) ? i1[j] : i1[j] + n1);
+            mpn_urandomb(i1[j], state, n1*GMP_LIMB_BITS);
+            if ((c != 1 && c < 5) || j == 0)
+               mpn_urandomb(i2[j], state, n2*GMP_LIMB_BITS);
+         }
+
+         if (c >= 3)
+            mpn_mul_fft_batch_threaded(r, i1, n1, i2, n2, counts[c], 3);
+         else
+            mpn_mul_fft_batch(r, i1, n1, i2, n2, counts[c]);
+
+         for (j = 0; j < counts[c]; j++)
+         {
+            mpn_mul(p, i1[j], n1, i2[j], n2);
+            if (mpn_cmp(r[j], p, n1 + n2) != 0)
+            {
+               printf("error: mpn_mul_fft_batch, n1 = %ld, c = %ld, product %ld\n", n1, c, j);
+               abort();
+            }
+         }
+
+         for (j = 0; j < counts[c]; j++)
+            free(r[j]);
+         free(r);
+         free(i1);
+         free(i2);
+      }
+
+      free(p);
+   }
+
+   gmp_randclear(state);
+}
+
+void test_split_bits_signed()
+{
+   mp_size_t bitss[5] = { 29, 64, 100, 128, 500 };
+   mp_size_t ns[4] = { 1, 7, 25, 50 };
+   mp_size_t i, j, k, c, n, bits, limbs, length;
+   mp_limb_t * in, * res, * coeff, ** poly, * ptr;
+   mpz_t a, b, m;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   mpz_init(a);
+   mpz_init(b);
+   mpz_init(m);
+
+   for (i = 0; i < 5; i++)
+   {
+      for (j = 0; j < 4; j++)
+      {
+         bits = bitss[i];
+         n = ns[j];
+         limbs = 2*(bits/GMP_LIMB_BITS + 1);
+         length = (n*GMP_LIMB_BITS)/bits + 1;
+         
+         in = (mp_limb_t *) malloc((2*n + 2 + (length + 1)*(limbs + 1))*sizeof(mp_limb_t));
+         res = in + n;
+         coeff = res + n + 2;
+         poly = (mp_limb_t **) malloc(length*sizeof(mp_limb_t *));
+         for (k = 0, ptr = coeff + limbs + 1; k < length; k++, ptr += limbs + 1)
+            poly[k] = ptr;
+
+         for (c = 0; c < 10; c++)
+         {
+            mpn_rrandom(in, state, n);
+            if (c == 0) // top bit of the last full coefficient set
+               MPN_ZERO(in, n), in[n - 1] = ~CNST_LIMB(0);
+
+            if (FFT_split_bits_signed(poly, in, n, bits, limbs) != length)
+            {
+               printf("error: FFT_split_bits_signed length, bits = %ld, n = %ld\n", bits, n);
+               abort();
+            }
+
+            // balanced, agreeing with the single coefficient extractor
+            mpz_set_ui(a, 0);
+            for (k = length - 1; k >= 0; k--)
+            {
+               FFT_split_bits_coeff_signed(coeff, in, n, bits, limbs, k);
+               if (mpn_cmp(coeff, poly[k], limbs + 1) != 0)
+               {
+                  printf("error: FFT_split_bits_coeff_signed, bits = %ld, n = %ld, k = %ld\n", bits, n, k);
+                  abort();
+               }
+               mpn_to_mpz(m, poly[k], limbs);
+               if (mpz_sizeinbase(m, 2) > bits - 1 && mpz_scan1(m, 0) != bits - 1)
+               {
+                  printf("error: FFT_split_bits_signed not balanced, bits = %ld, n = %ld, k = %ld\n", bits, n, k);
+                  abort();
+               }
+               mpz_mul_2exp(a, a, bits);
+               mpz_add(a, a, m);
+            }
+            mpz_import(b, n, -1, sizeof(mp_limb_t), 0, 0, in);
+            if (mpz_cmp(a, b) != 0)
+            {
+               printf("error: FFT_split_bits_signed, bits = %ld, n = %ld\n", bits, n);
+               abort();
+            }
+
+            for (k = 0; k < length; k++)
+               mpn_normmod_2expp1(poly[k], limbs);
+            MPN_ZERO(res, n);
+            FFT_combine_bits_signed(res, poly, length, bits, limbs, n);
+            if (mpn_cmp(res, in, n) != 0)
+            {
+               printf("error: FFT_combine_bits_signed of split, bits = %ld, n = %ld\n", bits, n);
+               abort();
+            }
+
+            // arbitrary signed coefficients, the sum taken mod B^(n + 2)
+            mpz_set_ui(a, 0);
+            for (k = length - 1; k >= 0; k--)
+            {
+               mpz_rrandomb(m, state, gmp_urandomm_ui(state, limbs*GMP_LIMB_BITS - 1));
+               if (gmp_urandomm_ui(state, 2)) mpz_neg(m, m);
+               MPN_ZERO(poly[k], limbs + 1);
+               mpz_export(poly[k], NULL, -1, sizeof(mp_limb_t), 0, 0, m);
+               if (mpz_sgn(m) < 0) 
+               {
+                  mpn_neg_n(poly[k], poly[k], limbs + 1);
+                  mpn_normmod_2expp1(poly[k], limbs);
+               }
+               mpz_mul_2exp(a, a, bits);
+               mpz_add(a, a, m);
+            }
+            mpz_fdiv_r_2exp(a, a, (n + 2)*GMP_LIMB_BITS);
+            MPN_ZERO(res, n + 2);
+            FFT_combine_bits_signed(res, poly, length, bits, limbs, n + 2);
+            mpz_import(b, n + 2, -1, sizeof(mp_limb_t), 0, 0, res);
+            if (mpz_cmp(a, b) != 0)
+            {
+               printf("error: FFT_combine_bits_signed, bits = %ld, n = %ld\n", bits, n);
+               abort();
+            }
+         }
+
+         free(poly);
+         free(in);
+      }
+   }
+
+   mpz_clear(a);
+   mpz_clear(b);
+   mpz_clear(m);
+   gmp_randclear(state);
+}
+
+void test_mulmid()
+{
+   mp_size_t i, n1, n2, rn;
+   mp_limb_t * i1, * i2, * r;
+   mpz_t a, b, m, p;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+   mpz_init(a);
+   mpz_init(b);
+   mpz_init(m);
+   mpz_init(p);
+
+   for (i = 0; i < 40; i++)
+   {
+      n1 = 1 + gmp_urandomm_ui(state, i < 30 ? 300 : (i < 36 ? 5000 : 50000));
+      n2 = (i & 1) ? (n1 + 1)/2 : 1 + gmp_urandomm_ui(state, n1);
+      
+      i1 = (mp_limb_t *) malloc((2*n1 + 1)*sizeof(mp_limb_t));
+      i2 = i1 + n1;
+      r = i2 + n2;
+
+      if (i & 2)
+      {
+         mpn_rrandom(i1, state, n1);
+         mpn_rrandom(i2, state, n2);
+      } else
+      {
+         mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+         mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+      }
+
+      mpn_mulmid_fft(r, i1, n1, i2, n2);
+
+      // r must be i1*i2 >> n2 limbs modulo B^(n1 - n2 + 1)
+      mpz_import(a, n1, -1, sizeof(mp_limb_t), 0, 0, i1);
+      mpz_import(b, n2, -1, sizeof(mp_limb_t), 0, 0, i2);
+      mpz_mul(p, a, b);
+      mpz_tdiv_q_2exp(p, p, n2*GMP_LIMB_BITS);
+      for (rn = n1 - n2 + 1; rn > 0 && r[rn - 1] == 0; rn--) ;
+      mpz_import(a, rn, -1, sizeof(mp_limb_t), 0, 0, r);
+      mpz_sub(a, a, p);
+      mpz_set_ui(m, 1);
+      mpz_mul_2exp(m, m, (n1 - n2 + 1)*GMP_LIMB_BITS);
+      mpz_mod(a, a, m);
+      if (mpz_sgn(a) != 0)
+      {
+         printf("error: mpn_mulmid_fft, n1 = %ld, n2 = %ld\n", n1, n2);
+         abort();
+      }
+
+      free(i1);
+   }
+
+   mpz_clear(a);
+   mpz_clear(b);
+   mpz_clear(m);
+   mpz_clear(p);
+   gmp_randclear(state);
+}
+
+#if FFT_PHASE_STATS
+
+void test_phase_stats()
+{
+   mp_bitcnt_t depth = 10UL;
+   mp_bitcnt_t w = 1UL;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_size_t int_limbs = (2*n*bits1)/GMP_LIMB_BITS;
+   mp_size_t n1 = int_limbs - 1, n2 = int_limbs/2;
+   
+   mp_size_t j;
+   mp_limb_t *i1, *i2, *r1;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(4*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   
+   mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+   mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+  
+   fft_phase_stats_reset();
+   new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+
+   // two splits and three transforms, each with two column and two row 
+   // passes, and no separate scaling, as the combine does it
+   if (fft_phase_stats.calls[FFT_PHASE_SPLIT] != 2
+    || fft_phase_stats.calls[FFT_PHASE_FFT_COLUMNS] != 4
+    || fft_phase_stats.calls[FFT_PHASE_FFT_ROWS] != 4
+    || fft_phase_stats.calls[FFT_PHASE_IFFT_COLUMNS] != 2
+    || fft_phase_stats.calls[FFT_PHASE_IFFT_ROWS] != 2
+    || fft_phase_stats.calls[FFT_PHASE_SCALE] != 0)
+   {
+      printf("error: wrong number of calls recorded\n");
+      abort();
+   }
+
+   for (j = 0; j < FFT_PHASES; j++)
+   {
+      if (j == FFT_PHASE_SCALE)
+         continue;
+
+      if (fft_phase_stats.calls[j] == 0 || fft_phase_stats.cycles[j] == 0)
+      {
+         printf("error: no time recorded for %s\n", fft_phase_names[j]);
+         abort();
+      }
+
+      // counters which could not be opened read as zero
+      if (fft_event_available(FFT_EVENT_INSTRUCTIONS) 
+         && fft_phase_stats.events[j][FFT_EVENT_INSTRUCTIONS] == 0)
+      {
+         printf("error: no instructions counted for %s\n", fft_phase_names[j]);
+         abort();
+      }
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+#endif
+
+#if FFT_OP_COUNTS
+
+void test_op_counts()
+{
+   mp_bitcnt_t depth = 8UL;
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t w = 1;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, *t1, *t2, *s1;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 3*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      rand_n(ii[i], state, limbs);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = t2 + size;
+
+   fft_op_counts_reset();
+   FFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
+   
+   // a length 2n FFT does n butterflies in each of depth + 1 layers 
+   if (fft_op_counts.count[FFT_OP_BUTTERFLY] != n*(depth + 1)
+      || fft_op_counts.limbs[FFT_OP_BUTTERFLY] != 4*size*n*(depth + 1))
+   {
+      printf("error: %llu butterflies counted, expected %ld\n", 
+         fft_op_counts.count[FFT_OP_BUTTERFLY], n*(depth + 1));
+      abort();
+   }
+
+   fft_op_counts_reset();
+   IFFT_radix2(ii, 1, ii, n, w, &t1, &t2, &s1);
+   
+   if (fft_op_counts.count[FFT_OP_INVERSE_BUTTERFLY] != n*(depth + 1)
+      || fft_op_counts.count[FFT_OP_BUTTERFLY] != 0)
+   {
+      printf("error: %llu inverse butterflies counted, expected %ld\n", 
+         fft_op_counts.count[FFT_OP_INVERSE_BUTTERFLY], n*(depth + 1));
+      abort();
+   }
+
+   TMP_FREE;
+   gmp_randclear(state);
+} 
+
+#endif
+
+void run_tests(void)
+{
+   test_mulmod(); printf("MULMOD....PASS\n");
+   test_fft_ifft_negacyclic(); printf("FFT_IFFT_NEGACYCLIC...PASS\n");
+   test_mul4(); printf("MUL4...PASS\n");
+   test_mul6_lowmem(); printf("MUL6_LOWMEM...PASS\n");
+   test_mul6_mmap(); printf("MUL6_MMAP...PASS\n");
+#if FFT_THREADS
+   test_mul6_threaded(); printf("MUL6_THREADED...PASS\n");
+#endif
+   test_mul_estimate(); printf("MUL_ESTIMATE...PASS\n");
+   test_sqr_auto(); printf("SQR_AUTO...PASS\n");
+   test_cpu_dispatch(); printf("CPU_DISPATCH...PASS\n");
+   test_mulmod_Bexp(); printf("MULMOD_BEXP...PASS\n");
+   test_mulmid(); printf("MULMID...PASS\n");
+   test_mul_unbalanced(); printf("MUL_UNBALANCED...PASS\n");
+   test_mpz_mul_fft(); printf("MPZ_MUL_FFT...PASS\n");
+   test_prod_tree(); printf("PROD_TREE...PASS\n");
+   test_fft_poly_mul(); printf("FFT_POLY_MUL...PASS\n");
+   test_mul_fft_batch(); printf("MUL_FFT_BATCH...PASS\n");
+   test_split_bits_signed(); printf("SPLIT_BITS_SIGNED...PASS\n");
+#if FFT_PHASE_STATS
+   test_phase_stats(); printf("PHASE_STATS...PASS\n");
+#endif
+#if FFT_OP_COUNTS
+   test_op_counts(); printf("OP_COUNTS...PASS\n");
+#endif
+   test_fft_ifft_mfa_truncate(); printf("FFT_IFFT_MFA_TRUNCATE...PASS\n");
+   test_fft_ifft_mfa(); printf("FFT_IFFT_MFA...PASS\n");
+   test_fft_ifft_mfa_sqrt2(); printf("FFT_IFFT_MFA_SQRT2...PASS\n");
+   test_fft_ifft_mfa_truncate_sqrt2(); printf("FFT_IFFT_MFA_TRUNCATE_SQRT2...PASS\n");
+   test_fft_ifft_mfa_truncate_sqrt2_partial(); printf("FFT_IFFT_MFA_TRUNCATE_SQRT2_PARTIAL...PASS\n");
+   test_mul5(); printf("MUL5...PASS\n");
+   test_mul6_w(); printf("MUL6_W...PASS\n");
+   
+   test_fft_ifft_sqrt2(); printf("FFT_IFFT_SQRT...PASS\n");
+   test_norm(); printf("mpn_normmod_2expp1...PASS\n");
+   test_mul_2expmod(); printf("mpn_mul_2expmod_2expp1...PASS\n");
+   test_div_2expmod(); printf("mpn_div_2expmod_2expp1...PASS\n");
+   test_lshB_sumdiffmod(); printf("mpn_lshB_sumdiffmod_2expp1...PASS\n");
+   test_sumdiff_rshBmod(); printf("mpn_sumdiff_rshBmod_2expp1...PASS\n");
+   
+   test_FFT_negacyclic_twiddle(); printf("FFT_negacyclic_twiddle...PASS\n");
+   test_fft_ifft(); printf("FFT_IFFT...PASS\n");
+   test_fft_truncate(); printf("FFT_TRUNCATE...PASS\n");
+   test_fft_ifft_truncate(); printf("FFT_IFFT_TRUNCATE...PASS\n");
+   test_fft_ifft_truncate_sqrt2(); printf("FFT_IFFT_TRUNCATE_SQRT2...PASS\n");
+}
@@ -0,0 +1,1088 @@
+/* mul_fft -- radix 2 fft routines for MPIR.
+
+Copyright 2009, 2011 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of William Hart.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpir.h"
+#include "gmp-impl.h"
+#include "mul_fft.h"
+
+/************************************************************************************
+
+   Timing code
+
+************************************************************************************/
+
+void time_mul_with_negacyclic()
+{
+   mp_bitcnt_t depth = 17UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - depth)/2; 
+   mp_bitcnt_t bits = n*bits1;
+   mp_size_t int_limbs = (bits - 1UL)/GMP_LIMB_BITS + 1;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(4*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   
+   mpn_urandomb(i1, state, bits);
+   mpn_urandomb(i2, state, bits);
+  
+   for (i = 0; i < iters; i++)
+   {
+      new_mpn_mul(r1, i1, int_limbs, i2, int_limbs, depth, w);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mfa()
+{
+   mp_bitcnt_t depth = 12L;
+   mp_size_t iters = 1000;
+   mp_bitcnt_t w2 = 1;
+
+   mp_size_t n = (1UL<<depth)/w2;
+   mp_bitcnt_t w = w2*w2;
+   
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      if (i < n) rand_n(ii[i], state, limbs);
+      else MPN_ZERO(ii[i], limbs + 1);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+   
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+     
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < iters; i++)
+   {
+      FFT_radix2_mfa(ii, n, w, &t1, &t2, s1, (1UL<<(depth/2))/w2);
+   }
+     
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+/*
+   Times the column pass of an MFA transform of length 2n, i.e. n1 column 
+   FFTs of length 2n/n1 with stride n1, first with the coefficients in 
+   ordinary pages and then with them in huge pages from FFT_alloc_limbs.
+*/
+void time_column_pass()
+{
+   mp_bitcnt_t depth = 14L;
+   mp_size_t iters = 10;
+   mp_bitcnt_t w = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_size_t n1 = (1UL<<(depth/2));
+   mp_size_t n2 = (2*n)/n1;
+   
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, k;
+   mp_limb_t * ptr, * data, * temp;
+   mp_limb_t ** ii, *t1, *t2, *s1;
+   clock_t start;
+   double times[2];
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*n);
+   temp = TMP_BALLOC_LIMBS(3*size);
+   
+   for (k = 0; k < 2; k++)
+   {
+      t1 = temp;
+      t2 = t1 + size;
+      s1 = t2 + size;
+
+      if (k == 0) data = TMP_BALLOC_LIMBS(2*n*size);
+      else data = FFT_alloc_limbs(2*n*size);
+
+      for (i = 0, ptr = data; i < 2*n; i++, ptr += size) 
+      {
+         ii[i] = ptr;
+         rand_n(ii[i], state, limbs);
+         mpn_normmod_2expp1(ii[i], limbs);
+      }
+
+      start = clock();
+      for (j = 0; j < iters; j++)
+      {
+         for (i = 0; i < n1; i++)
+            FFT_radix2_twiddle(ii + i, n1, n2/2, w*n1, &t1, &t2, &s1, w, 0, i, 1);
+      }
+      times[k] = (double) (clock() - start)/CLOCKS_PER_SEC;
+
+      if (k == 1) FFT_free_limbs(data, 2*n*size);
+   }
+
+   printf("column pass, depth = %ld: small pages %.3fs, huge pages %.3fs\n", 
+                                                   depth, times[0], times[1]);
+     
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_ifft()
+{
+   mp_bitcnt_t depth = 16L;
+   mp_size_t iters = 1;
+   mp_bitcnt_t w = 1;
+   
+   mp_size_t n = (1UL<<depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      if (i < n) rand_n(ii[i], state, limbs);
+      else MPN_ZERO(ii[i], limbs + 1);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+   
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+     
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < iters; i++)
+   {
+      IFFT_radix2(ii, 1, ii, n, w, &t1, &t2, s1);
+   }
+     
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_negacyclic_fft()
+{
+   mp_bitcnt_t depth = 10L;
+   mp_size_t iters = 10000;
+   mp_bitcnt_t w = 4;
+   
+   mp_size_t n = 512;//(1UL<<depth);
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      if (i < n) rand_n(ii[i], state, limbs);
+      else MPN_ZERO(ii[i], limbs + 1);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+     
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < iters; i++)
+   {
+      FFT_radix2_negacyclic(ii, 1, ii, n, w, &t1, &t2, s1);
+   }
+     
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_imfa()
+{
+   mp_bitcnt_t depth = 16L;
+   mp_size_t iters = 1;
+   mp_bitcnt_t w2 = 1;
+
+   mp_bitcnt_t w = w2*w2;
+   mp_size_t n = (1UL<<depth)/w2;
+   mp_size_t limbs = (n*w)/GMP_LIMB_BITS;
+   mp_size_t size = limbs + 1;
+   mp_size_t i, j, s;
+   mp_limb_t * ptr;
+   mp_limb_t ** ii, ** jj, *tt, *t1, *t2, *u1, *u2, **s1, **s2;
+   mp_limb_t c;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   ii = (mp_limb_t **) TMP_BALLOC_LIMBS(2*(n + n*size) + 2*n + 2*size);
+   for (i = 0, ptr = (mp_limb_t *) ii + 2*n; i < 2*n; i++, ptr += size) 
+   {
+      ii[i] = ptr;
+      if (i < n) rand_n(ii[i], state, limbs);
+      else MPN_ZERO(ii[i], limbs + 1);
+   }
+   t1 = ptr;
+   t2 = t1 + size;
+   s1 = (mp_limb_t **) t2 + size;
+
+   for (j = 0; j < 2*n; j++)
+      mpn_normmod_2expp1(ii[j], limbs);
+     
+   tt = (mp_limb_t *) TMP_BALLOC_LIMBS(2*size);
+   
+   for (i = 0; i < iters; i++)
+   {
+      IFFT_radix2_mfa(ii, n, w, &t1, &t2, s1, (1UL<<(depth/2))/w2);
+   }
+     
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mul()
+{
+   mp_bitcnt_t depth = 10UL;
+   mp_bitcnt_t w = 3UL;
+   mp_size_t iters = 100;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - depth)/2; 
+   mp_bitcnt_t bits = (8364032*8)/8; //n*bits1;
+   printf("bits = %ld\n", bits);
+   mp_size_t int_limbs = (bits - 1UL)/GMP_LIMB_BITS + 1;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   mpn_urandomb(i1, state, bits);
+   mpn_urandomb(i2, state, bits);
+  
+   for (i = 0; i < iters; i++)
+   {
+      new_mpn_mul(r1, i1, int_limbs, i2, int_limbs, depth, w);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mul2()
+{
+   mp_bitcnt_t depth = 17UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   printf("bits = %ld\n", bits);
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   mpn_urandomb(i1, state, bits);
+   mpn_urandomb(i2, state, bits);
+  
+   for (i = 0; i < iters; i++)
+   {
+      new_mpn_mul3(r1, i1, int_limbs, i2, int_limbs, depth, w, sqrt);
+      //mpn_mul(r1, i1, int_limbs, i2, int_limbs);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mul4()
+{
+   mp_bitcnt_t depth = 13UL;
+   mp_bitcnt_t w = 1UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_size_t sqrt = (1UL<<(depth/2));
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   //mp_size_t n1 = (3*int_limbs)/4;
+   //mp_size_t n2 = (3*int_limbs)/4;
+   mp_size_t n1 = int_limbs;
+   mp_size_t n2 = int_limbs;
+   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
+   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   mpn_urandomb(i1, state, b1);
+   mpn_urandomb(i2, state, b2);
+  
+   printf("b1 = %ld, b2 = %ld\n", b1, b2);
+
+   for (i = 0; i < iters; i++)
+   {
+      new_mpn_mul4(r1, i1, n1, i2, n2, depth, w);
+      //mpn_mul(r1, i1, n1, i2, n2);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mul6()
+{
+   mp_bitcnt_t depth = 13UL;
+   mp_bitcnt_t w = 2UL;
+   mp_size_t iters = 1;
+
+   mp_size_t n = (1UL<<depth);
+   mp_bitcnt_t bits1 = (n*w - (depth + 1))/2; 
+   mp_bitcnt_t bits = 2*n*bits1;
+   mp_size_t int_limbs = bits/GMP_LIMB_BITS;
+   mp_size_t n1 = (3*int_limbs)/4;
+   mp_size_t n2 = (3*int_limbs)/4;
+   //mp_size_t n1 = int_limbs;
+   //mp_size_t n2 = int_limbs;
+   mp_bitcnt_t b1 = n1 * GMP_LIMB_BITS;
+   mp_bitcnt_t b2 = n2 * GMP_LIMB_BITS;
+   
+   mp_size_t i, j;
+   mp_limb_t *i1, *i2, *r1, *r2;
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   TMP_DECL;
+
+   TMP_MARK;
+
+   i1 = TMP_BALLOC_LIMBS(6*int_limbs);
+   i2 = i1 + int_limbs;
+   r1 = i2 + int_limbs;
+   r2 = r1 + 2*int_limbs;
+   
+   mpn_urandomb(i1, state, b1);
+   mpn_urandomb(i2, state, b2);
+  
+   printf("b1 = %ld, b2 = %ld\n", b1, b2);
+
+   for (i = 0; i < iters; i++)
+   {
+      new_mpn_mul6(r1, i1, n1, i2, n2, depth, w);
+      //mpn_mul(r1, i1, n1, i2, n2);
+   }
+      
+   TMP_FREE;
+   gmp_randclear(state);
+}
+
+void time_mulmid()
+{
+   mp_size_t sizes[4] = { 5000, 50000, 500000, 2000000 };
+   mp_size_t i, j, n1, n2, iters;
+   mp_limb_t *i1, *i2, *r1;
+   clock_t start;
+   double times[2];
+   gmp_randstate_t state;
+   gmp_randinit_default(state);
+
+   for (i = 0; i < 4; i++)
+   {
+      // the balanced case of Newton iteration, n1 = 2*n2 - 1
+      n2 = sizes[i];
+      n1 = 2*n2 - 1;
+      iters = 10000000/n1 + 1;
+
+      i1 = (mp_limb_t *) malloc((2*n1 + 2*n2)*sizeof(mp_limb_t));
+      i2 = i1 + n1;
+      r1 = i2 + n2;
+
+      mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+      mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+
+      start = clock();
+      for (j = 0; j < iters; j++)
+         mpn_mulmid_fft(r1, i1, n1, i2, n2);
+      times[0] = (double) (clock() - start)/CLOCKS_PER_SEC/iters;
+
+      start = clock();
+      for (j = 0; j < iters; j++)
+         new_mpn_mul_auto(r1, i1, n1, i2, n2);
+      times[1] = (double) (clock() - start)/CLOCKS_PER_SEC/iters;
+
+      printf("mulmid, n1 = %ld, n2 = %ld: %.6fs, full product %.6fs, ratio %.2f%s\n", 
+             n1, n2, times[0], times[1], times[0]/times[1], 
+             times[0] > times[1] ? " (slower)" : "");
+
+      free(i1);
+   }
+
+   gmp_randclear(state);
+}
+
+/************************************************************************************
+
+   Benchmark driver
+
+************************************************************************************/
+
+double wall_time(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+int cmp_double(const void * a, const void * b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+
+   return (x > y) - (x < y);
+}
+
+typedef struct
+{
+   const char * variant;
+   mp_size_t n1, n2, max_n1;
+   double factor;
+   int threads, reps, warmup;
+   const char * format;
+   const char * dir;
+   int compare;
+   mp_size_t tol;
+   int plans;
+} bench_opts_t;
+
+/* 
+   Multiplies {i1, n1} by {i2, n2} with the given variant, returning 0 
+   if the variant is unknown or the integers are too small for it.
+*/
+int bench_mul_variant(const bench_opts_t * opts, const char * variant, mp_limb_t * r, 
+                  mp_limb_t * i1, mp_size_t n1, mp_limb_t * i2, mp_size_t n2, 
+                  mp_bitcnt_t depth, mp_bitcnt_t w)
+{
+   if (strcmp(variant, "mpn_mul") == 0)
+      mpn_mul(r, i1, n1, i2, n2);
+   else if (strcmp(variant, "mpn_mul_fft") == 0)
+      mpn_mul_fft_full(r, i1, n1, i2, n2);
+   else if (strcmp(variant, "unbalanced") == 0)
+      new_mpn_mul_unbalanced(r, i1, n1, i2, n2);
+   else if (depth == 0)
+      return 0;
+   else if (strcmp(variant, "mul6") == 0)
+      new_mpn_mul6(r, i1, n1, i2, n2, depth, w);
+   else if (strcmp(variant, "lowmem") == 0)
+      new_mpn_mul6_lowmem(r, i1, n1, i2, n2, depth, w);
+   else if (strcmp(variant, "mmap") == 0)
+      new_mpn_mul6_mmap(r, i1, n1, i2, n2, depth, w, opts->dir);
+#if FFT_THREADS
+   else if (strcmp(variant, "threaded") == 0)
+      new_mpn_mul6_threaded(r, i1, n1, i2, n2, depth, w, opts->threads);
+#endif
+   else
+      return 0;
+
+   return 1;
+}
+
+/*
+   Times opts->reps multiplications of random integers of n1 >= n2 limbs 
+   with the given variant, after opts->warmup untimed ones to warm up the 
+   caches, and sets min and med to the minimum and median times. Returns
+   0 if the variant could not be run.
+*/
+int bench_time_variant(const bench_opts_t * opts, const char * variant, 
+            mp_size_t n1, mp_size_t n2, mp_bitcnt_t depth, mp_bitcnt_t w, 
+            double * min, double * med)
+{
+   mp_limb_t * i1, * i2, * r;
+   double * times, start;
+   int k, ok = 1;
+   gmp_randstate_t state;
+
+   gmp_randinit_default(state);
+   i1 = (mp_limb_t *) malloc((2*(n1 + n2))*sizeof(mp_limb_t));
+   i2 = i1 + n1;
+   r = i2 + n2;
+   times = (double *) malloc(opts->reps*sizeof(double));
+
+   mpn_urandomb(i1, state, n1*GMP_LIMB_BITS);
+   mpn_urandomb(i2, state, n2*GMP_LIMB_BITS);
+
+   for (k = 0; k < opts->warmup && ok; k++)
+      ok = bench_mul_variant(opts, variant, r, i1, n1, i2, n2, depth, w);
+
+   for (k = 0; k < opts->reps && ok; k++)
+   {
+      start = wall_time();
+      ok = bench_mul_variant(opts, variant, r, i1, n1, i2, n2, depth, w);
+      times[k] = wall_time() - start;
+   }
+
+   if (ok)
+   {
+      qsort(times, opts->reps, sizeof(double), cmp_double);
+      *min = times[0];
+      *med = (opts->reps & 1) ? times[opts->reps/2] 
+                              : (times[opts->reps/2 - 1] + times[opts->reps/2])/2;
+   }
+
+   free(times);
+   free(i1);
+   gmp_randclear(state);
+
+   return ok;
+}
+
+/*
+   Times the variant in opts on integers of n1 and n2 limbs and prints 
+   the minimum and median times and the throughput in limbs of product 
+   per second. Returns 0 if the variant could not be run.
+*/
+int bench_mul(const bench_opts_t * opts, mp_size_t n1, mp_size_t n2, int first)
+{
+   mp_bitcnt_t depth = 0, w = 0;
+   double min, med;
+
+   if (n1 < n2)
+   {
+      mp_size_t t = n1;
+      n1 = n2;
+      n2 = t;
+   }
+
+   if (!FFT_mul6_params(&depth, &w, n1, n2))
+      depth = w = 0;
+
+   fft_phase_stats_reset();
+   fft_op_counts_reset();
+
+   if (!bench_time_variant(opts, opts->variant, n1, n2, depth, w, &min, &med))
+   {
+      fprintf(stderr, "%s cannot multiply %ld x %ld limbs\n", opts->variant, n1, n2);
+      return 0;
+   }
+
+   if (strcmp(opts->format, "csv") == 0)
+   {
+      if (first) 
+         printf("variant,n1,n2,depth,w,threads,reps,min_s,median_s,limbs_per_s\n");
+      printf("%s,%ld,%ld,%ld,%ld,%d,%d,%.9f,%.9f,%.6e\n", opts->variant, n1, n2, 
+         depth, w, opts->threads, opts->reps, min, med, (n1 + n2)/med);
+   } else if (strcmp(opts->format, "json") == 0)
+   {
+      printf("%s\n  {\"variant\": \"%s\", \"n1\": %ld, \"n2\": %ld, "
+         "\"depth\": %ld, \"w\": %ld, \"threads\": %d, \"reps\": %d, "
+         "\"min_s\": %.9f, \"median_s\": %.9f, \"limbs_per_s\": %.6e}", 
+         first ? "[" : ",", opts->variant, n1, n2, depth, w, opts->threads, 
+         opts->reps, min, med, (n1 + n2)/med);
+   } else
+   {
+      printf("%s %ld x %ld (depth = %ld, w = %ld, %s kernels): min %.6fs, median %.6fs, %.4e limbs/s\n",
+         opts->variant, n1, n2, depth, w, fft_cpu_name(), min, med, (n1 + n2)/med);
+   }
+
+#if FFT_PHASE_STATS
+   if (strcmp(opts->format, "text") == 0)
+   {
+      unsigned long long total = 0;
+      int p;
+
+      for (p = 0; p < FFT_PHASES; p++)
+         total += fft_phase_stats.cycles[p];
+      
+      // only new_mpn_mul6 records phase timings
+      for (p = 0; p < FFT_PHASES && total != 0; p++)
+      {
+         printf("   %-12s %14.0f cycles per multiply (%5.1f%%)", fft_phase_names[p], 
+            (double) fft_phase_stats.cycles[p]/(opts->reps + opts->warmup), 
+            (100.0*fft_phase_stats.cycles[p])/total);
+#if FFT_PERF_EVENTS
+         {
+            unsigned long long * ev = fft_phase_stats.events[p];
+            int e;
+
+            if (fft_event_available(FFT_EVENT_CYCLES) && ev[FFT_EVENT_CYCLES] != 0
+               && fft_event_available(FFT_EVENT_INSTRUCTIONS))
+               printf(", IPC %.2f", (double) ev[FFT_EVENT_INSTRUCTIONS]/ev[FFT_EVENT_CYCLES]);
+
+            // misses per limb of the product per multiply
+            for (e = FFT_EVENT_L1D_MISSES; e < FFT_EVENTS; e++)
+               if (fft_event_available(e))
+                  printf(", %s/limb %.3f", fft_event_names[e], 
+                     (double) ev[e]/((n1 + n2)*(opts->reps + opts->warmup)));
+         }
+#endif
+         printf("\n");
+      }
+   }
+#endif
+
+#if FFT_OP_COUNTS
+   if (strcmp(opts->format, "text") == 0)
+   {
+      unsigned long long butterflies = 0;
+      int op, mults = opts->reps + opts->warmup;
+
+      for (op = 0; op < FFT_OPS; op++)
+      {
+         if (fft_op_counts.count[op] != 0)
+            printf("   %-24s %14.0f calls, %14.0f bytes per multiply\n", fft_op_names[op], 
+               (double) fft_op_counts.count[op]/mults,
+               (double) fft_op_counts.limbs[op]*sizeof(mp_limb_t)/mults);
+      }
+
+      for (op = FFT_OP_BUTTERFLY; op <= FFT_OP_INVERSE_BUTTERFLY_SQRT2; op++)
+         butterflies += fft_op_counts.count[op];
+
+#if FFT_PHASE_STATS
+      // rates over the transform phases, which do (nearly) all the butterflies
+      if (butterflies != 0)
+      {
+         fft_phase_t p[4] = { FFT_PHASE_FFT_COLUMNS, FFT_PHASE_FFT_ROWS, 
+                              FFT_PHASE_IFFT_ROWS, FFT_PHASE_IFFT_COLUMNS };
+         unsigned long long cycles = 0;
+#if FFT_PERF_EVENTS
+         unsigned long long ev[FFT_EVENTS] = { 0 };
+         int e;
+#endif
+         int k;
+
+         for (k = 0; k < 4; k++)
+         {
+            cycles += fft_phase_stats.cycles[p[k]];
+#if FFT_PERF_EVENTS
+            for (e = 0; e < FFT_EVENTS; e++)
+               ev[e] += fft_phase_stats.events[p[k]][e];
+#endif
+         }
+
+         printf("   transforms: %.1f cycles per butterfly", (double) cycles/butterflies);
+#if FFT_PERF_EVENTS
+         for (e = 0; e < FFT_EVENTS; e++)
+            if (fft_event_available(e))
+               printf(", %s/butterfly %.3f", fft_event_names[e], (double) ev[e]/butterflies);
+#endif
+         printf("\n");
+      }
+#endif
+   }
+#endif
+
+   return 1;
+}
+
+/*
+   Median time of the faster of the library's mpn_mul and mpn_mul_fft 
+   divided by the median time of new_mpn_mul6, on integers of n1 and 
+   n2 = n1*ratio limbs. Returns 0 if new_mpn_mul6 cannot be used or any
+   of the three cannot be timed. The individual times are returned in t.
+*/
+double bench_speedup(const bench_opts_t * opts, mp_size_t n1, double ratio, double * t)
+{
+   mp_size_t n2 = (mp_size_t) (n1*ratio);
+   mp_bitcnt_t depth, w;
+   double min;
+
+   if (n2 < 1) n2 = 1;
+   if (n1 < n2)
+   {
+      mp_size_t t = n1;
+      n1 = n2;
+      n2 = t;
+   }
+   
+   if (!FFT_mul6_params(&depth, &w, n1, n2))
+      return 0.0;
+
+   if (!bench_time_variant(opts, "mul6", n1, n2, depth, w, &min, t + 0)
+    || !bench_time_variant(opts, "mpn_mul", n1, n2, depth, w, &min, t + 1)
+    || !bench_time_variant(opts, "mpn_mul_fft", n1, n2, depth, w, &min, t + 2))
+      return 0.0;
+
+   return MIN(t[1], t[2])/t[0];
+}
+
+/*
+   Compares new_mpn_mul6 with the linked library's mpn_mul and 
+   mpn_mul_fft over the sweep in opts, printing the times and the speedup
+   of new_mpn_mul6 over the faster of the two. Wherever the faster routine
+   changes between consecutive sizes of the sweep, the size at which it 
+   changes is located by bisection, to within opts->tol limbs (or 1% if 
+   it is zero), and reported at the end as a crossover point. The output
+   is CSV if requested, otherwise text.
+*/
+int bench_compare(const bench_opts_t * opts)
+{
+   double ratio = (double) opts->n2/opts->n1, t[3], s, s_mid, s_prev = 0.0;
+   mp_size_t n1, prev = 0, lo, hi, mid;
+   mp_size_t cross[64];
+   int i, num_cross = 0, csv = (strcmp(opts->format, "csv") == 0);
+
+   if (csv) printf("n1,n2,mul6_s,mpn_mul_s,mpn_mul_fft_s,speedup\n");
+   
+   for (n1 = opts->n1; n1 <= opts->max_n1; n1 = (mp_size_t) (n1*opts->factor))
+   {
+      s = bench_speedup(opts, n1, ratio, t);
+      if (s == 0.0) 
+      {
+         fprintf(stderr, "cannot compare at %ld x %ld limbs\n", n1, (mp_size_t) (n1*ratio));
+         continue;
+      }
+
+      if (csv)
+         printf("%ld,%ld,%.9f,%.9f,%.9f,%.4f\n", n1, (mp_size_t) (n1*ratio), t[0], t[1], t[2], s);
+      else
+         printf("%ld x %ld: mul6 %.6fs, mpn_mul %.6fs, mpn_mul_fft %.6fs, speedup %.4f\n", 
+            n1, (mp_size_t) (n1*ratio), t[0], t[1], t[2], s);
+
+      if (prev != 0 && (s >= 1.0) != (s_prev >= 1.0) && num_cross < 64)
+      {
+         // bisect on the sign of speedup - 1 between prev and n1
+         lo = prev;
+         hi = n1;
+         while (hi - lo > (opts->tol ? opts->tol : (lo + 99)/100))
+         {
+            mid = lo + (hi - lo)/2;
+            s_mid = bench_speedup(opts, mid, ratio, t);
+            if (s_mid != 0.0 && (s_mid >= 1.0) == (s_prev >= 1.0)) lo = mid;
+            else hi = mid;
+         }
+         cross[num_cross++] = hi;
+      }
+
+      prev = n1;
+      s_prev = s;
+   }
+
+   if (!csv)
+   {
+      printf("\ncrossover points (n1 limbs):");
+      if (num_cross == 0) printf(" none in range");
+      for (i = 0; i < num_cross; i++)
+         printf(" %ld", cross[i]);
+      printf("\n");
+   } else
+   {
+      for (i = 0; i < num_cross; i++)
+         printf("crossover,%ld,%ld\n", cross[i], (mp_size_t) (cross[i]*ratio));
+   }
+
+   return 1;
+}
+
+/*
+   Prints the candidate plans for the sizes in opts, with their predicted
+   costs, and the one fft_mul_estimate would pick. Nothing is run.
+*/
+int bench_plans(const bench_opts_t * opts)
+{
+   mp_size_t max = 32*GMP_LIMB_BITS, count, i;
+   fft_mul_plan_t * plans = (fft_mul_plan_t *) malloc(max*sizeof(fft_mul_plan_t));
+   fft_mul_plan_t best;
+   int csv = (strcmp(opts->format, "csv") == 0);
+
+   count = fft_mul_plans(plans, max, opts->n1, opts->n2);
+   
+   if (csv) 
+      printf("variant,depth,w,n1,trunc,threads,butterflies,pointwise,cycles,memory,disk\n");
+   
+   for (i = 0; i < count; i++)
+   {
+      fft_mul_plan_t * p = plans + i;
+
+      printf(csv ? "%s,%ld,%ld,%ld,%ld,%d,%.0f,%.0f,%.0f,%lu,%lu\n" 
+           : "%-8s depth %2ld w %2ld n1 %5ld trunc %8ld threads %2d: %.4g butterflies, "
+             "%.4g pointwise, %.4g cycles, %lu bytes RAM, %lu bytes disk\n",
+         fft_mul_variant_names[p->variant], p->depth, p->w, p->n1, p->trunc, p->threads,
+         p->butterflies, p->pointwise, p->cycles, (unsigned long) p->memory, 
+         (unsigned long) p->disk);
+   }
+
+   if (fft_mul_estimate(opts->n1, opts->n2, &best) && !csv)
+      printf("\nbest: %s depth %ld w %ld, %.4g cycles, %lu bytes RAM\n", 
+         fft_mul_variant_names[best.variant], best.depth, best.w, best.cycles, 
+         (unsigned long) best.memory);
+
+   free(plans);
+
+   return count != 0;
+}
+
+void bench_usage(const char * name)
+{
+   fprintf(stderr, "usage: %s [-n limbs] [-m limbs] [-N max_limbs] [-s factor] "
+                   "[-v variant] [-t threads] [-r reps] [-W warmup] [-f format] [-d dir] [-c] [-T limbs] [-P] [-K features]\n\n"
+      "  -n  limbs in the first operand (default 100000)\n"
+      "  -m  limbs in the second operand (default the same as the first)\n"
+      "  -N  sweep the first operand up to this many limbs, scaling the second with it\n"
+      "  -s  factor to multiply the sizes by in a sweep (default 2)\n"
+      "  -v  mul6, lowmem, mmap, threaded, unbalanced, mpn_mul or mpn_mul_fft\n"
+      "      (default mul6)\n"
+      "  -t  threads for the threaded variant (default 1)\n"
+      "  -r  timed repetitions (default 5)\n"
+      "  -W  untimed warm up repetitions (default 1)\n"
+      "  -f  text, csv or json (default text)\n"
+      "  -d  directory for the mmap variant's files, which -P then also plans\n"
+      "      with (default $FFT_MMAP_DIR, or if unset %s for the mmap variant)\n"
+      "  -c  compare mul6 with mpn_mul and mpn_mul_fft and report the crossover points\n"
+      "  -T  locate crossover points to within this many limbs (default 1%% of the size)\n"
+      "  -P  print the candidate plans and their predicted costs, without multiplying\n"
+      "  -K  restrict the kernels to these FFT_CPU_* features, e.g. 0 for the generic ones\n", 
+      name, P_tmpdir);
+}
+
+int bench_main(int argc, char ** argv)
+{
+   bench_opts_t opts;
+   mp_size_t n1, n2;
+   int c, first = 1, ok = 1;
+
+   opts.variant = "mul6";
+   opts.n1 = 100000;
+   opts.n2 = 0;
+   opts.max_n1 = 0;
+   opts.factor = 2.0;
+   opts.threads = 1;
+   opts.reps = 5;
+   opts.warmup = 1;
+   opts.format = "text";
+   opts.dir = getenv("FFT_MMAP_DIR");
+   if (opts.dir == NULL || *opts.dir == '\0') opts.dir = P_tmpdir;
+   opts.compare = 0;
+   opts.tol = 0;
+   opts.plans = 0;
+
+   while ((c = getopt(argc, argv, "n:m:N:s:v:t:r:W:f:d:cT:PK:h")) != -1)
+   {
+      switch (c)
+      {
+      case 'n': opts.n1 = atol(optarg); break;
+      case 'm': opts.n2 = atol(optarg); break;
+      case 'N': opts.max_n1 = atol(optarg); break;
+      case 's': opts.factor = atof(optarg); break;
+      case 'v': opts.variant = optarg; break;
+      case 't': opts.threads = atoi(optarg); break;
+      case 'r': opts.reps = atoi(optarg); break;
+      case 'W': opts.warmup = atoi(optarg); break;
+      case 'f': opts.format = optarg; break;
+      case 'd': opts.dir = optarg; setenv("FFT_MMAP_DIR", optarg, 1); break;
+      case 'c': opts.compare = 1; break;
+      case 'T': opts.tol = atol(optarg); break;
+      case 'P': opts.plans = 1; break;
+      case 'K': fft_cpu_select(strtoul(optarg, NULL, 0)); break;
+      default: bench_usage(argv[0]); return 1;
+      }
+   }
+
+   if (opts.n2 == 0) opts.n2 = opts.n1;
+   if (opts.max_n1 < opts.n1) opts.max_n1 = opts.n1;
+   if (opts.n1 < 1 || opts.n2 < 1 || opts.reps < 1 || opts.threads < 1 || opts.factor <= 1.0)
+   {
+      bench_usage(argv[0]);
+      return 1;
+   }
+
+   if (opts.compare)
+      return !bench_compare(&opts);
+
+   if (opts.plans)
+      return !bench_plans(&opts);
+
+   for (n1 = opts.n1, n2 = opts.n2; n1 <= opts.max_n1; )
+   {
+      if (bench_mul(&opts, n1, n2, first)) first = 0;
+      else ok = 0;
+      
+      n2 = (mp_size_t) (n2*opts.factor);
+      n1 = (mp_size_t) (n1*opts.factor);
+   }
+
+   if (strcmp(opts.format, "json") == 0 && !first) printf("\n]\n");
+
+   return !ok;
+}
+
+/************************************************************************************
+
+   Main: runs the test code, the timing function named on the command line,
+   or if built with FFT_BENCH defined, the benchmark driver.
+
+************************************************************************************/
+
+typedef struct
+{
+   const char * name;
+   void (*fn)(void);
+} timing_fn_t;
+
+timing_fn_t timing_fns[] = 
+{
+   { "time_ifft", time_ifft },
+   { "time_mfa", time_mfa },
+   { "time_imfa", time_imfa },
+   { "time_mul_with_negacyclic", time_mul_with_negacyclic }, // negacyclic is currently *disabled*
+   { "time_negacyclic_fft", time_negacyclic_fft },
+   { "time_column_pass", time_column_pass },
+   { "time_mul", time_mul },
+   { "time_mul2", time_mul2 },
+   { "time_mul4", time_mul4 },
+   { "time_mul6", time_mul6 },
+   { "time_mulmid", time_mulmid },
+   { NULL, NULL }
+};
+
+int main(int argc, char ** argv)
+{
+   int i;
+
+#if FFT_BENCH
+   return bench_main(argc, argv);
+#endif
+
+   if (argc < 2 || strcmp(argv[1], "test") == 0)
+   {
+      run_tests();
+      return 0;
+   }
+
+   for (i = 0; timing_fns[i].name != NULL; i++)
+   {
+      if (strcmp(argv[1], timing_fns[i].name) == 0)
+      {
+         timing_fns[i].fn();
+         return 0;
+      }
+   }
+
+   fprintf(stderr, "usage: %s [test | time_function]\n\ntiming functions:", argv[0]);
+   for (i = 0; timing_fns[i].name != NULL; i++)
+      fprintf(stderr, " %s", timing_fns[i].name);
+   fprintf(stderr, "\n");
+
+   return 1;
+}
@@ -0,0 +1,111 @@
+/* time_gmp -- timing of GMP mpn_mul for comparison with the new FFT.
+
+Copyright 2009, 2011 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of William Hart.
+
+*/
+
+/*
+   Times GMP's mpn_mul over the same sweep of sizes as the bench driver
+   in time_fft.c, printing the same CSV columns, so that the output can
+   be set against that of ./bench -f csv -v mul6 when comparing with a
+   GMP build rather than the MPIR the FFT is linked against.
+
+   usage: ./time_gmp [n1 [n2 [max_n1 [factor [reps]]]]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gmp.h"
+
+double wall_time(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+int cmp_double(const void * a, const void * b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+
+   return (x > y) - (x < y);
+}
+
+int main(int argc, char ** argv)
+{
+   mp_size_t n1 = argc > 1 ? atol(argv[1]) : 100000;
+   mp_size_t n2 = argc > 2 ? atol(argv[2]) : n1;
+   mp_size_t max_n1 = argc > 3 ? atol(argv[3]) : n1;
+   double factor = argc > 4 ? atof(argv[4]) : 2.0;
+   int reps = argc > 5 ? atoi(argv[5]) : 5;
+   mp_limb_t * i1, * i2, * r;
+   double * times, start, med;
+   int k;
+
+   if (n1 < 1 || n2 < 1 || n2 > n1 || factor <= 1.0 || reps < 1)
+   {
+      fprintf(stderr, "usage: %s [n1 [n2 <= n1 [max_n1 [factor > 1 [reps]]]]]\n", argv[0]);
+      return 1;
+   }
+
+   times = (double *) malloc(reps*sizeof(double));
+
+   printf("variant,n1,n2,depth,w,threads,reps,min_s,median_s,limbs_per_s\n");
+
+   for ( ; n1 <= max_n1; n1 = (mp_size_t) (n1*factor), n2 = (mp_size_t) (n2*factor))
+   {
+      i1 = (mp_limb_t *) malloc((2*(n1 + n2))*sizeof(mp_limb_t));
+      i2 = i1 + n1;
+      r = i2 + n2;
+
+      mpn_random(i1, n1);
+      mpn_random(i2, n2);
+
+      mpn_mul(r, i1, n1, i2, n2); // warm up
+
+      for (k = 0; k < reps; k++)
+      {
+         start = wall_time();
+         mpn_mul(r, i1, n1, i2, n2);
+         times[k] = wall_time() - start;
+      }
+
+      qsort(times, reps, sizeof(double), cmp_double);
+      med = (reps & 1) ? times[reps/2] : (times[reps/2 - 1] + times[reps/2])/2;
+
+      printf("gmp_mpn_mul,%ld,%ld,0,0,1,%d,%.9f,%.9f,%.6e\n", n1, n2, reps,
+         times[0], med, (n1 + n2)/med);
+
+      free(i1);
+   }
+
+   free(times);
+
+   return 0;
+}